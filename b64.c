@@ -3,13 +3,13 @@
  * This file is part of str2hex project.
  *
  * Copyright 2005 Dzmitry Plashchynski <plashchynski@gmail.com>
- * 
+ *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
  * You may obtain a copy of the License at
- * 
+ *
  *     http://www.apache.org/licenses/LICENSE-2.0
- * 
+ *
  * Unless required by applicable law or agreed to in writing, software
  * distributed under the License is distributed on an "AS IS" BASIS,
  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
@@ -20,65 +20,432 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "b64.h"
+#include "encode.h"
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/* Base64 alphabet -> sextet, BAD, B64_SKIP or B64_PAD */
+const signed char base64val[256] = {
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -2, -1, -1, -2, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+	52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -3, -1, -1,
+	-1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+	15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+	-1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+	41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
 
 void base64_init(base64_state_t *stat)
 {
 	stat->remlen = 0;
 }
 
-char *base64_append(base64_state_t *stat, char *in , size_t in_len, size_t *out_len, int mode)
+/* 3 input bytes -> 4 output chars */
+static char *base64_group(char *out, const unsigned char *in)
 {
-	int i=0, i2=0;
-	char *out = NULL;
-	size_t outlen = 1 + BASE64_LENGTH(in_len);
-	
-	out = malloc(outlen);
-	
-	if (stat->remlen > 0)
+	out[0] = base64digits[in[0] >> 2];
+	out[1] = base64digits[((in[0] << 4) & 0x30) | (in[1] >> 4)];
+	out[2] = base64digits[((in[1] << 2) & 0x3c) | (in[2] >> 6)];
+	out[3] = base64digits[in[2] & 0x3f];
+
+	return out + 4;
+}
+
+/* last 1 or 2 bytes of the stream, padded with '=' */
+static char *base64_tail(char *out, const unsigned char *in, int len)
+{
+	unsigned char fragment;
+
+	out[0] = base64digits[in[0] >> 2];
+	fragment = (in[0] << 4) & 0x30;
+	if (len > 1)
+		fragment |= in[1] >> 4;
+
+	out[1] = base64digits[fragment];
+	out[2] = (len < 2) ? '=' : base64digits[(in[1] << 2) & 0x3c];
+	out[3] = '=';
+
+	return out + 4;
+}
+
+#ifdef HAVE_X86_SIMD
+
+/*
+ * 24 input bytes -> 32 chars. Every 3 bytes are spread over a 32-bit
+ * lane, the four 6-bit fields are moved into separate bytes with two
+ * multiplies, and the fields are turned into ASCII by adding a per-range
+ * offset picked with a shuffle.
+ */
+__attribute__((target("avx2")))
+static size_t base64_avx2(char *out, const unsigned char *in, size_t len)
+{
+	const __m256i	spread = _mm256_setr_epi8(
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	const __m256i	offsets = _mm256_setr_epi8(
+		65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0,
+		65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+	size_t	i;
+
+	/* each lane reads 16 bytes but uses 12, so stop 4 bytes early */
+	for (i = 0; i + 28 <= len; i += 24)
 	{
-		out[i++] = base64digits[stat->rem[1] >> 2];
-		out[i++] = base64digits[((stat->rem[1] << 4) & 0x30) | ((stat->remlen > 1 ? stat->rem[2] : in[i2]) >> 4)];
-		out[i++] = base64digits[(((stat->remlen > 1 ? stat->rem[2] : in[i2++]) << 2) & 0x3c) |  \
-			((stat->remlen > 2 ? stat->rem[3] : in[i2]) >> 6)];
-		out[i++] = base64digits[(stat->remlen > 2 ? stat->rem[3] : in[i2++]) & 0x3f];	
+		__m256i	x = _mm256_inserti128_si256(
+			_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) (in + i))),
+			_mm_loadu_si128((const __m128i *) (in + i + 12)), 1);
+		__m256i	t0, t1, idx;
+
+		x = _mm256_shuffle_epi8(x, spread);
+		t0 = _mm256_mulhi_epu16(_mm256_and_si256(x, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+		t1 = _mm256_mullo_epi16(_mm256_and_si256(x, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+		x = _mm256_or_si256(t0, t1);
+
+		/* 0..25 -> 'A', 26..51 -> 'a', 52..61 -> '0', 62 -> '+', 63 -> '/' */
+		idx = _mm256_subs_epu8(x, _mm256_set1_epi8(51));
+		idx = _mm256_sub_epi8(idx, _mm256_cmpgt_epi8(x, _mm256_set1_epi8(25)));
+		x = _mm256_add_epi8(x, _mm256_shuffle_epi8(offsets, idx));
+
+		_mm256_storeu_si256((__m256i *) out, x);
+		out += 32;
 	}
 
-	for (; in_len >= 3; in_len -= 3)
+	return i;
+}
+
+/* 48 input bytes -> 64 chars: byte permute, multishift into 6-bit fields, permute through the alphabet */
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+static size_t base64_avx512(char *out, const unsigned char *in, size_t len)
+{
+	const __m512i	spread = _mm512_setr_epi32(
+		0x01020001, 0x04050304, 0x07080607, 0x0a0b090a,
+		0x0d0e0c0d, 0x10110f10, 0x13141213, 0x16171516,
+		0x191a1819, 0x1c1d1b1c, 0x1f201e1f, 0x22232122,
+		0x25262425, 0x28292728, 0x2b2c2a2b, 0x2e2f2d2e);
+	const __m512i	shifts = _mm512_set1_epi64(0x3036242a1016040aLL);
+	const __m512i	alphabet = _mm512_loadu_si512((const void *) base64digits);
+	size_t	i;
+
+	for (i = 0; i + 48 <= len; i += 48)
 	{
-		out[i++] = base64digits[in[i2] >> 2];
-		out[i++] = base64digits[((in[i2] << 4) & 0x30) | (in[i2+1] >> 4)];
-		out[i++] = base64digits[((in[i2+1] << 2) & 0x3c) | (in[i2+2] >> 6)];
-		out[i++] = base64digits[in[i2+2] & 0x3f];
-		i2 += 3;
-
-		if (outlen < i)
-			out = realloc(out, outlen+=32);
+		__m512i	x = _mm512_maskz_loadu_epi8(0x0000ffffffffffffULL, (const void *) (in + i));
+
+		x = _mm512_permutexvar_epi8(spread, x);
+		x = _mm512_multishift_epi64_epi8(shifts, x);
+		x = _mm512_permutexvar_epi8(x, alphabet);
+
+		_mm512_storeu_si512((void *) out, x);
+		out += 64;
 	}
-	
+
+	return i;
+}
+
+#endif
+
+/* Encode the longest prefix of whole groups the vector unit can handle, returns input bytes consumed */
+static size_t base64_simd(char *out, const unsigned char *in, size_t len)
+{
+#ifdef HAVE_X86_SIMD
+	switch (encode_simd_level())
+	{
+		case ENCODE_SIMD_AVX512:
+			return base64_avx512(out, in, len);
+		case ENCODE_SIMD_AVX2:
+			return base64_avx2(out, in, len);
+	}
+#endif
+	return 0;
+}
+
+/*
+ * Encode the next chunk of the stream into "out", which must hold
+ * BASE64_LENGTH(remlen + in_len) bytes. Up to 2 trailing bytes that don't
+ * make a whole group are kept in "stat" until the next call; mode != 0
+ * marks the last chunk and flushes them with '=' padding. Returns the
+ * number of characters written.
+ */
+size_t base64_encode_into(base64_state_t *stat, char *out, const unsigned char *in, size_t in_len, int mode)
+{
+	size_t	n;
+	char	*p = out;
+
+	/* finish the group started by the previous chunk */
+	if (stat->remlen > 0)
+	{
+		unsigned char	group[3];
+		int	k;
+
+		for (k = 0; k < stat->remlen; k++)
+			group[k] = stat->rem[k];
+
+		for (; k < 3 && in_len > 0; k++, in_len--)
+			group[k] = *in++;
+
+		stat->remlen = 0;
+
+		if (k == 3)
+			p = base64_group(p, group);
+		else if (mode)
+			p = base64_tail(p, group, k);
+		else
+		{
+			for (stat->remlen = k; k > 0; k--)
+				stat->rem[k-1] = group[k-1];
+		}
+	}
+
+	n = base64_simd(p, in, in_len);
+	p += n / 3 * 4;
+	in += n;
+	in_len -= n;
+
+	for (; in_len >= 3; in_len -= 3, in += 3)
+		p = base64_group(p, in);
+
 	if (in_len > 0)
 	{
 		if (!mode)
 		{
 			stat->remlen = in_len;
-			for (;in_len > 0; in_len--)
-				stat->rem[in_len] = in[in_len];
+			for (n = 0; n < in_len; n++)
+				stat->rem[n] = in[n];
 		} else
+			p = base64_tail(p, in, in_len);
+	}
+
+	return p - out;
+}
+
+/*
+ * Decoding.
+ *
+ * The vector kernels validate and translate whole blocks of alphabet
+ * characters and stop at the first block holding anything else (line
+ * breaks, padding, garbage). The scalar loop then takes over until it has
+ * stepped over the line break and is back on a quantum boundary, so a
+ * MIME body is decoded in long vector runs with only the line tails
+ * going through the table.
+ */
+
+void base64_decode_init(base64_decode_state_t *stat)
+{
+	stat->remlen = 0;
+	stat->pads = -1;
+	stat->offset = 0;
+	stat->error = B64_NO_ERROR;
+}
+
+#ifdef HAVE_X86_SIMD
+
+/* 32 chars -> 24 bytes; a block is valid when no character hits both of its nibble classes */
+__attribute__((target("avx2")))
+static size_t base64_decode_avx2(unsigned char *out, const unsigned char *in, size_t len)
+{
+	const __m256i	lut_lo = _mm256_setr_epi8(
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m256i	lut_hi = _mm256_setr_epi8(
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m256i	lut_roll = _mm256_setr_epi8(
+		0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i	pack = _mm256_setr_epi8(
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	const __m256i	mask_2f = _mm256_set1_epi8(0x2f);
+	size_t	i;
+
+	for (i = 0; i + 32 <= len; i += 32)
+	{
+		__m256i	x = _mm256_loadu_si256((const __m256i *) (in + i));
+		__m256i	hi = _mm256_and_si256(_mm256_srli_epi32(x, 4), mask_2f);
+		__m256i	lo = _mm256_and_si256(x, mask_2f);
+
+		if (!_mm256_testz_si256(_mm256_shuffle_epi8(lut_lo, lo), _mm256_shuffle_epi8(lut_hi, hi)))
+			break;
+
+		/* ASCII -> sextets: the offset depends on the high nibble, '/' has its own */
+		x = _mm256_add_epi8(x, _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(_mm256_cmpeq_epi8(x, mask_2f), hi)));
+
+		/* four sextets -> 24 bits per lane, then drop the empty bytes */
+		x = _mm256_maddubs_epi16(x, _mm256_set1_epi32(0x01400140));
+		x = _mm256_madd_epi16(x, _mm256_set1_epi32(0x00011000));
+		x = _mm256_shuffle_epi8(x, pack);
+		x = _mm256_permutevar8x32_epi32(x, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+
+		_mm256_storeu_si256((__m256i *) out, x);
+		out += 24;
+	}
+
+	return i;
+}
+
+/* 64 chars -> 48 bytes; the 128-entry half of base64val is the lookup, its sign bit flags bad input */
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+static size_t base64_decode_avx512(unsigned char *out, const unsigned char *in, size_t len)
+{
+	static const unsigned char	pack_idx[64] = {
+		 2,  1,  0,  6,  5,  4, 10,  9,  8, 14, 13, 12, 18, 17, 16, 22,
+		21, 20, 26, 25, 24, 30, 29, 28, 34, 33, 32, 38, 37, 36, 42, 41,
+		40, 46, 45, 44, 50, 49, 48, 54, 53, 52, 58, 57, 56, 62, 61, 60 };
+	const __m512i	lookup_0 = _mm512_loadu_si512((const void *) base64val);
+	const __m512i	lookup_1 = _mm512_loadu_si512((const void *) (base64val + 64));
+	const __m512i	pack = _mm512_loadu_si512((const void *) pack_idx);
+	size_t	i;
+
+	for (i = 0; i + 64 <= len; i += 64)
+	{
+		__m512i	x = _mm512_loadu_si512((const void *) (in + i));
+		__m512i	v = _mm512_permutex2var_epi8(lookup_0, x, lookup_1);
+
+		if (_mm512_movepi8_mask(_mm512_or_si512(v, x)))
+			break;
+
+		v = _mm512_maddubs_epi16(v, _mm512_set1_epi32(0x01400140));
+		v = _mm512_madd_epi16(v, _mm512_set1_epi32(0x00011000));
+		v = _mm512_permutexvar_epi8(pack, v);
+
+		_mm512_mask_storeu_epi8((void *) out, 0x0000ffffffffffffULL, v);
+		out += 48;
+	}
+
+	return i;
+}
+
+#endif
+
+/* Decode the longest run of whole valid blocks, returns input characters consumed */
+static size_t base64_decode_simd(unsigned char *out, const unsigned char *in, size_t len)
+{
+#ifdef HAVE_X86_SIMD
+	switch (encode_simd_level())
+	{
+		case ENCODE_SIMD_AVX512:
+			return base64_decode_avx512(out, in, len);
+		case ENCODE_SIMD_AVX2:
+			return base64_decode_avx2(out, in, len);
+	}
+#endif
+	return 0;
+}
+
+/* the first "len" bytes of the quantum in progress */
+static unsigned char *base64_quantum(unsigned char *out, const int *rem, int len)
+{
+	unsigned long	bits = (rem[0] << 18) | (rem[1] << 12) | (rem[2] << 6) | rem[3];
+
+	out[0] = bits >> 16;
+	if (len > 1)
+		out[1] = bits >> 8;
+	if (len > 2)
+		out[2] = bits;
+
+	return out + len;
+}
+
+/*
+ * Decode the next chunk of the stream into "out", which must hold
+ * BASE64_DECODED_LENGTH(remlen + in_len) + B64_DEC_SLACK bytes. CR and LF
+ * are skipped anywhere. On bad input the bytes before it are written and
+ * stat->error holds the offset of the offending character from the start
+ * of the stream. mode != 0 marks the last chunk. Returns the number of
+ * bytes written.
+ */
+size_t base64_decode_into(base64_decode_state_t *stat, unsigned char *out, const unsigned char *in_buf, size_t in_len, int mode)
+{
+	const unsigned char	*start = in_buf, *in = start, *end = start + in_len;
+	unsigned char	*p = out;
+	size_t	n, scalar;
+	int	v;
+
+	while (in < end && stat->error == B64_NO_ERROR)
+	{
+		if (!stat->remlen && stat->pads < 0)
+		{
+			n = base64_decode_simd(p, in, end - in);
+			p += n / 4 * 3;
+			in += n;
+		}
+
+		/* go back to the vector kernel after a line break, or once a whole block went through here */
+		for (scalar = 0; in < end; in++, scalar++)
 		{
-			out = realloc(out, outlen+=32);
-
-			unsigned char fragment;
-			out[i++] = base64digits[in[i2] >> 2];
-			fragment = (in[i2] << 4) & 0x30;
-			if (in_len > 1)
-				fragment |= in[i2+1] >> 4;
- 
-			out[i++] = base64digits[fragment];
-			out[i++] = (in_len < 2) ? '=' : base64digits[(in[i2+1] << 2) & 0x3c];
-			out[i++] = '=';
+			if (!stat->remlen && stat->pads < 0 && scalar >= 32 && base64val[*in] >= 0)
+				break;
+
+			v = base64val[*in];
+
+			if (v == B64_SKIP)
+			{
+				scalar = 32;
+				continue;
+			}
+
+			if (v >= 0 && stat->pads < 0)
+			{
+				stat->rem[stat->remlen++] = v;
+
+				if (stat->remlen == 4)
+				{
+					p = base64_quantum(p, stat->rem, 3);
+					stat->remlen = 0;
+				}
+				continue;
+			}
+
+			/* "xx==" or "xxx=": the data ends here */
+			if (v == B64_PAD && stat->pads < 0 && stat->remlen >= 2)
+			{
+				stat->rem[3] = 0;
+				if (stat->remlen == 2)
+					stat->rem[2] = 0;
+
+				p = base64_quantum(p, stat->rem, stat->remlen - 1);
+				stat->pads = 3 - stat->remlen;
+				stat->remlen = 0;
+				continue;
+			}
+
+			if (v == B64_PAD && stat->pads > 0)
+			{
+				stat->pads--;
+				continue;
+			}
+
+			stat->error = stat->offset + (in - start);
+			break;
+		}
+	}
+
+	/* unpadded input may stop after 2 or 3 characters of the last quantum */
+	if (mode && stat->error == B64_NO_ERROR && stat->remlen)
+	{
+		if (stat->remlen == 1)
+			stat->error = stat->offset + in_len;
+		else
+		{
+			stat->rem[3] = 0;
+			if (stat->remlen == 2)
+				stat->rem[2] = 0;
+
+			p = base64_quantum(p, stat->rem, stat->remlen - 1);
 		}
+		stat->remlen = 0;
 	}
 
-	*out_len = i;
+	stat->offset += in_len;
 
-	return out;
+	return p - out;
 }
@@ -4,11 +4,18 @@
 #include <stdio.h>
 
 #define BASE64_LENGTH(inlen) ((((inlen) + 2) / 3) * 4)
+#define BASE64_DECODED_LENGTH(inlen) ((((inlen) + 3) / 4) * 3)
 
 #define B64_DEF_LINE_SIZE   72
+#define B64_DEC_SLACK	8	/* the AVX2 decoder stores 32 bytes for every 24 it decodes */
+
 #define BAD     -1
+#define B64_SKIP  -2	/* CR/LF between lines */
+#define B64_PAD   -3	/* '=' */
 #define DECODE64(c)  (isascii(c) ? base64val[c] : BAD)
 
+#define B64_NO_ERROR	((size_t) -1)
+
 static const char base64digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
 typedef struct {
@@ -16,7 +23,20 @@ typedef struct {
 	int	rem[3];
 } base64_state_t; 
 
+typedef struct {
+	int	remlen;
+	int	rem[4];			/* sextets of the quantum in progress */
+	int	pads;			/* '=' still allowed after the end of data, -1 before any padding */
+	size_t	offset;			/* input characters consumed by previous chunks */
+	size_t	error;			/* offset of the first invalid character, B64_NO_ERROR if none */
+} base64_decode_state_t;
+
+extern const signed char base64val[256];
+
 void base64_init(base64_state_t *stat);
-char *base64_append(base64_state_t *stat, char *in , size_t in_len, size_t *out_len, int mode);
+size_t base64_encode_into(base64_state_t *stat, char *out, const unsigned char *in, size_t in_len, int mode);
+
+void base64_decode_init(base64_decode_state_t *stat);
+size_t base64_decode_into(base64_decode_state_t *stat, unsigned char *out, const unsigned char *in, size_t in_len, int mode);
 
 #endif
@@ -0,0 +1,422 @@
+/*
+ * batch.c
+ * This file is part of str2hex project.
+ *
+ * Copyright 2005 Dzmitry Plashchynski <plashchynski@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Many input files in one run.
+ *
+ * Worker threads take the files in input order, convert each one into a
+ * memory buffer and hand it back; the main thread writes the buffers out
+ * strictly in input order. Workers never run more than a few files ahead
+ * of the writer, and only files whose output fits in a few read buffers
+ * are held in memory: larger ones, and the ones of unknown size, are
+ * left open for the writer, which streams them out when their turn comes.
+ * The memory held is bounded by the window, not by the number or the
+ * size of the files. With one thread the files are converted straight
+ * into the output stream.
+ *
+ * A single large file is handled the same way: it is cut into segments
+ * aligned for the mode (whole pages for mmap(), and whole Base64 groups)
+ * that every worker maps on its own. No state crosses a segment boundary,
+ * only the last one closes the stream, and the joined output is identical
+ * to the one of a sequential run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+
+#ifndef WIN32
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#include <io.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY	0
+#endif
+
+#include "main.h"
+#include "batch.h"
+#include "process.h"
+#include "io.h"
+#include "convert.h"
+#include "pool.h"
+
+#define BATCH_WINDOW	4	/* files converted ahead of the writer, per thread */
+#define BATCH_SEGMENT	256	/* pages in one segment of a large file */
+#define BATCH_BUFFERED	16	/* largest output held in memory for a file, in read buffers */
+
+typedef struct {
+	char	*name;
+	unsigned long long	offset;	/* segment of a large file */
+	size_t	length;
+	char	*out;			/* converted data */
+	size_t	out_size;
+	int	fd;			/* the file left to the writer */
+	int	status;			/* 0 - pending, 1 - converted, 2 - left to the writer, -1 - can't be read */
+} batch_item_t;
+
+/* "name: data", or md5sum style "digest  name" for the digests */
+static void batch_header(struct _config *config, const char *name, io_out_t *out)
+{
+	/* the digest lines of -md5l and -md5z are complete */
+	if (!config->tag || (config->mode == 11 && config->mode2))
+		return;
+
+	io_puts(out, (config->mode == 11) ? "MD5 (" : (config->mode == 13) ? "SHA256 (" : "");
+	io_puts(out, name);
+	io_puts(out, (config->mode == 11 || config->mode == 13) ? ") = " : ": ");
+}
+
+static void batch_trailer(struct _config *config, const char *name, io_out_t *out)
+{
+	if (config->mode == 11 && config->mode2)
+		return;
+
+	if ((config->mode == 11 || config->mode == 13) && !config->tag)
+	{
+		io_puts(out, "  ");
+		io_puts(out, name);
+	}
+
+	/* decoded data is binary, don't touch it */
+	if (config->mode != 12)
+		io_puts(out, config->eol);
+}
+
+static void batch_error(const char *name)
+{
+	fprintf(stderr, "ERROR: Can\'t read the input file \'%s\'.\n", name);
+}
+
+/* One file straight into the output stream */
+static int batch_serial(struct _config *config, io_out_t *out)
+{
+	int	i, in_fd, failed = 0;
+
+	for (i = 0; i < config->files_count; i++)
+	{
+		if ((in_fd = open(config->files[i], O_RDONLY | O_BINARY)) < 0)
+		{
+			batch_error(config->files[i]);
+			failed++;
+			continue;
+		}
+
+		batch_header(config, config->files[i], out);
+		convert_stream(config, in_fd, out);
+		batch_trailer(config, config->files[i], out);
+
+		close(in_fd);
+	}
+
+	return failed;
+}
+
+#ifndef WIN32
+
+typedef struct _batch batch_t;
+
+struct _batch {
+	struct _config	*config;
+	int	(*convert)(batch_t *batch, batch_item_t *item);	/* the status of the item */
+	int	fd;				/* the large file being cut */
+	batch_item_t	*items;
+	int	count;
+	int	next;				/* next file to convert */
+	int	written;			/* files already written out */
+	int	window;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+};
+
+/* One whole input file */
+static int batch_convert_file(batch_t *batch, batch_item_t *item)
+{
+	struct _config	*config = batch->config;
+	io_out_t	mem;
+	struct stat	st;
+	size_t	size;
+	int	in_fd;
+
+	if ((in_fd = open(item->name, O_RDONLY | O_BINARY)) < 0)
+		return -1;
+
+	/* too large to hold, or of unknown size: the writer streams it */
+	if (fstat(in_fd, &st) || !S_ISREG(st.st_mode) || (unsigned long long) st.st_size > (size_t) -1 ||
+		(size = convert_output_size(config, st.st_size, NULL)) / BATCH_BUFFERED > config->bufsize)
+	{
+		item->fd = in_fd;
+		return 2;
+	}
+
+	/* the whole result fits in the first buffer unless the file grows meanwhile */
+	io_out_init(&mem, -1, size + CONVERT_SLACK + 2 * strlen(item->name));
+
+	batch_header(config, item->name, &mem);
+	convert_stream(config, in_fd, &mem);
+	batch_trailer(config, item->name, &mem);
+
+	item->out = io_release(&mem, &item->out_size);
+	close(in_fd);
+
+	return 1;
+}
+
+/* One segment of a large file, converted straight from its mapping */
+static int batch_convert_segment(batch_t *batch, batch_item_t *item)
+{
+	io_out_t	mem;
+	void	*map;
+
+	map = mmap(NULL, item->length, PROT_READ, MAP_PRIVATE, batch->fd, item->offset);
+	if (map == MAP_FAILED)
+		return -1;
+
+	madvise(map, item->length, MADV_SEQUENTIAL);
+
+	io_out_init(&mem, -1, convert_output_size(batch->config, item->length, NULL) + CONVERT_SLACK);
+	convert_memory(batch->config, map, item->length, &mem, item->offset, item == &batch->items[batch->count - 1]);
+
+	item->out = io_release(&mem, &item->out_size);
+	munmap(map, item->length);
+
+	return 1;
+}
+
+/* A file left to the writer, straight into the output; cut for all threads if it is large enough */
+static int batch_stream(struct _config *config, batch_item_t *item, io_out_t *out)
+{
+	int	failed;
+
+	batch_header(config, item->name, out);
+
+	if ((failed = batch_split(config, item->fd, out)) < 0)
+	{
+		failed = 0;
+		convert_stream(config, item->fd, out);
+	}
+
+	batch_trailer(config, item->name, out);
+	close(item->fd);
+
+	return failed;
+}
+
+static void *batch_worker(void *arg)
+{
+	batch_t	*batch = arg;
+	int	n, status;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&batch->lock);
+
+		while (batch->next < batch->count && batch->next >= batch->written + batch->window)
+			pthread_cond_wait(&batch->cond, &batch->lock);
+
+		if (batch->next >= batch->count)
+		{
+			pthread_mutex_unlock(&batch->lock);
+			return NULL;
+		}
+
+		n = batch->next++;
+		pthread_mutex_unlock(&batch->lock);
+
+		status = batch->convert(batch, &batch->items[n]);
+
+		pthread_mutex_lock(&batch->lock);
+		batch->items[n].status = status;
+		pthread_cond_broadcast(&batch->cond);
+		pthread_mutex_unlock(&batch->lock);
+	}
+}
+
+/* Convert batch->items on "threads" workers and write the results in order */
+static int batch_parallel(batch_t *b, io_out_t *out, int threads)
+{
+	batch_t	batch = *b;
+	pthread_t	*tid;
+	int	i, failed = 0;
+
+	batch.next = batch.written = 0;
+	batch.window = threads * BATCH_WINDOW;
+	tid = malloc(threads * sizeof(pthread_t));
+
+	if (!tid)
+		exit_error("Not enough memory.");
+
+	pthread_mutex_init(&batch.lock, NULL);
+	pthread_cond_init(&batch.cond, NULL);
+
+	/* settle the CPU dispatch before the workers race for it */
+	encoder_dispatch();
+
+	for (i = 0; i < threads; i++)
+		if (pthread_create(&tid[i], NULL, batch_worker, &batch))
+			exit_error("Can\'t start a worker thread.");
+
+	for (i = 0; i < batch.count; i++)
+	{
+		batch_item_t	*item = &batch.items[i];
+
+		pthread_mutex_lock(&batch.lock);
+		while (!item->status)
+			pthread_cond_wait(&batch.cond, &batch.lock);
+		pthread_mutex_unlock(&batch.lock);
+
+		if (item->status < 0)
+		{
+			batch_error(item->name);
+			failed++;
+		} else if (item->status == 2)
+			failed += batch_stream(batch.config, item, out);
+		else
+			io_write(out, item->out, item->out_size);
+
+		pool_put(item->out);
+		item->out = NULL;
+
+		pthread_mutex_lock(&batch.lock);
+		batch.written++;
+		pthread_cond_broadcast(&batch.cond);
+		pthread_mutex_unlock(&batch.lock);
+	}
+
+	for (i = 0; i < threads; i++)
+		pthread_join(tid[i], NULL);
+
+	pthread_cond_destroy(&batch.cond);
+	pthread_mutex_destroy(&batch.lock);
+	free(tid);
+
+	return failed;
+}
+
+#endif
+
+int batch_run(struct _config *config, io_out_t *out)
+{
+	int	threads = config->threads;
+
+	if (threads > config->files_count)
+		threads = config->files_count;
+
+#ifndef WIN32
+	if (threads > 1)
+	{
+		batch_t	batch;
+		int	i, failed;
+
+		memset(&batch, 0, sizeof(batch));
+		batch.config = config;
+		batch.convert = batch_convert_file;
+		batch.count = config->files_count;
+
+		if (!(batch.items = calloc(batch.count, sizeof(batch_item_t))))
+			exit_error("Not enough memory.");
+
+		for (i = 0; i < batch.count; i++)
+			batch.items[i].name = config->files[i];
+
+		failed = batch_parallel(&batch, out, threads);
+		free(batch.items);
+
+		return failed;
+	}
+#endif
+
+	return batch_serial(config, out);
+}
+
+int batch_split(struct _config *config, int in_fd, io_out_t *out)
+{
+#ifndef WIN32
+	batch_t	batch;
+	struct stat	st;
+	unsigned long long	size, segment;
+	size_t	align = encoder_align(config);
+	long	page_size = sysconf(_SC_PAGESIZE);
+	int	i, failed, threads = config->threads;
+
+	if (page_size == -1)
+		page_size = 4096;
+
+	/* mmap() offsets are whole pages */
+	segment = (unsigned long long) page_size * align * BATCH_SEGMENT;
+
+	/* segments are mapped from offset 0, an input already partly read is streamed from where it is */
+	if (threads < 2 || !align || config->io == IO_READ || config->io == IO_URING || fstat(in_fd, &st) || !S_ISREG(st.st_mode) ||
+		lseek(in_fd, 0, SEEK_CUR) != 0)
+			return -1;
+
+	size = st.st_size;
+	if (size < 2 * segment)
+		return -1;
+
+	memset(&batch, 0, sizeof(batch));
+	batch.config = config;
+	batch.convert = batch_convert_segment;
+	batch.fd = in_fd;
+	batch.count = (size + segment - 1) / segment;
+
+	if (!(batch.items = calloc(batch.count, sizeof(batch_item_t))))
+		exit_error("Not enough memory.");
+
+	for (i = 0; i < batch.count; i++)
+	{
+		batch.items[i].name = config->files[0];
+		batch.items[i].offset = i * segment;
+		batch.items[i].length = (i == batch.count - 1) ? size - i * segment : segment;
+	}
+
+	if (threads > batch.count)
+		threads = batch.count;
+
+	failed = batch_parallel(&batch, out, threads);
+	free(batch.items);
+
+	return failed;
+#else
+	return -1;
+#endif
+}
+
+void batch_read_list(struct _config *config, FILE *list_file)
+{
+	char	line[4096];
+	size_t	len;
+
+	while (fgets(line, sizeof(line), list_file))
+	{
+		len = strlen(line);
+		while (len && (line[len-1] == '\n' || line[len-1] == '\r'))
+			line[--len] = '\0';
+
+		if (!len)
+			continue;
+
+		add_file(config, line);
+	}
+}
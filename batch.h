@@ -0,0 +1,19 @@
+#ifndef __BATCH_H
+#define __BATCH_H
+
+#include <stdio.h>
+#include "main.h"
+#include "io.h"
+
+/* Convert every file of config->files, writing the results to "out" in input order.
+ * Returns the number of files that could not be read. */
+int batch_run(struct _config *config, io_out_t *out);
+
+/* Convert one large regular file in parallel segments.
+ * Returns -1 when the file or the mode can't be split, otherwise the number of failed segments. */
+int batch_split(struct _config *config, int in_fd, io_out_t *out);
+
+/* Read file names, one per line, and append them to config->files */
+void batch_read_list(struct _config *config, FILE *list_file);
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ * md5_bench.c
+ * This file is part of str2hex project.
+ *
+ * Copyright 2005 Dzmitry Plashchynski <plashchynski@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Single core MD5 throughput: one long message from an aligned and from
+ * an unaligned buffer, and 32 byte records through md5_many(). Reports
+ * MB/s and, on x86, time stamp counter cycles per byte; the best of
+ * several runs is taken.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define CYCLES()	__rdtsc()
+#else
+#define CYCLES()	0ULL
+#endif
+
+#include "../md5.h"
+
+#define BENCH_SIZE	(64 * 1024 * 1024)
+#define BENCH_RUNS	5
+#define BENCH_RECORD	32
+
+static double now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double seconds, unsigned long long cycles)
+{
+	printf("%-24s %9.1f MB/s", name, BENCH_SIZE / seconds / 1e6);
+	if (cycles)
+		printf(" %7.3f cycles/byte", (double) cycles / BENCH_SIZE);
+	printf("\n");
+}
+
+static void bench_stream(const char *name, const md5_byte_t *data)
+{
+	md5_state_t	state;
+	md5_byte_t	digest[16];
+	double	t, best = 1e30;
+	unsigned long long	c, best_c = 0;
+	int	r;
+
+	for (r = 0; r < BENCH_RUNS; r++)
+	{
+		t = now();
+		c = CYCLES();
+		md5_init(&state);
+		md5_append(&state, data, BENCH_SIZE);
+		md5_finish(&state, digest);
+		c = CYCLES() - c;
+		t = now() - t;
+
+		if (t < best)
+		{
+			best = t;
+			best_c = c;
+		}
+	}
+
+	report(name, best, best_c);
+}
+
+static void bench_records(const md5_byte_t *data)
+{
+	int	count = BENCH_SIZE / BENCH_RECORD, i, r;
+	const md5_byte_t	**ptr = malloc(count * sizeof(*ptr));
+	size_t	*len = malloc(count * sizeof(*len));
+	md5_byte_t	(*digest)[16] = malloc(count * sizeof(*digest));
+	double	t, best = 1e30;
+	unsigned long long	c, best_c = 0;
+
+	if (!ptr || !len || !digest)
+		exit(EXIT_FAILURE);
+
+	for (i = 0; i < count; i++)
+	{
+		ptr[i] = data + (size_t) i * BENCH_RECORD;
+		len[i] = BENCH_RECORD;
+	}
+
+	for (r = 0; r < BENCH_RUNS; r++)
+	{
+		t = now();
+		c = CYCLES();
+		md5_many(ptr, len, count, digest);
+		c = CYCLES() - c;
+		t = now() - t;
+
+		if (t < best)
+		{
+			best = t;
+			best_c = c;
+		}
+	}
+
+	report("md5_many, 32 byte records", best, best_c);
+
+	free(ptr);
+	free(len);
+	free(digest);
+}
+
+int main(void)
+{
+	md5_byte_t	*data = malloc(BENCH_SIZE + 64);
+	size_t	i;
+
+	if (!data)
+		return EXIT_FAILURE;
+
+	/* fixed pseudo-random content, faulted in before the clock starts */
+	for (i = 0; i < BENCH_SIZE + 64; i++)
+		data[i] = (md5_byte_t) (i * 2654435761u >> 13);
+
+	bench_stream("md5_append, aligned", data);
+	bench_stream("md5_append, unaligned", data + 1);
+	bench_records(data);
+
+	free(data);
+	return 0;
+}
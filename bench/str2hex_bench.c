@@ -0,0 +1,555 @@
+/*
+ * str2hex_bench.c
+ * This file is part of str2hex project.
+ *
+ * Copyright 2005 Dzmitry Plashchynski <plashchynski@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Throughput of every convertion mode.
+ *
+ * Four corpora are generated from a fixed seed, so every run sees the
+ * same bytes: random binary, ASCII text, Latin-1/cp1252 text and streams
+ * of decimal numbers. Every mode main() accepts converts every corpus at
+ * every size, once through the encoder in chunks of the default buffer
+ * size ("lib") and once end to end through the command line program
+ * ("cli"), writing to /dev/null. The decoders get their corpus encoded in
+ * their format first. Reports MB/s of input and, on x86, time stamp
+ * counter cycles per byte; the best of several runs is taken, with short
+ * runs repeated for a while to get over the noise.
+ *
+ * -save writes the results to a file, -compare reads such a file back and
+ * adds the change against it to every line.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define CYCLES()	__rdtsc()
+#else
+#define CYCLES()	0ULL
+#endif
+
+#include "../main.h"
+#include "../process.h"
+#include "../b64.h"
+#include "../decode.h"
+
+#define BENCH_CHUNK	(256 * 1024)	/* the default -bufsize */
+#define BENCH_RUNS	3
+#define BENCH_TIME	0.05	/* seconds every measurement is repeated for at least */
+#define BENCH_SIZES	4
+#define BENCH_RESULTS	4096
+
+/* every mode main() accepts */
+typedef struct {
+	const char	*option;
+	int	mode;
+	int	mode2;
+	const char	*source;			/* decoders: the option that encodes their input */
+} bench_mode_t;
+
+static const bench_mode_t	bench_modes[] = {
+	{"-p", 9, 0, NULL},
+	{"-t", 1, 0, NULL},
+	{"-tc", 1, 1, NULL},
+	{"-tp", 1, 2, NULL},
+	{"-a", 2, 0, NULL},
+	{"-ac", 2, 1, NULL},
+	{"-ap", 2, 2, NULL},
+	{"-m", 3, 0, NULL},
+	{"-mc", 3, 1, NULL},
+	{"-u", 4, 0, NULL},
+	{"-x", 5, 0, NULL},
+	{"-xe", 5, 1, NULL},
+	{"-xw", 5, 2, NULL},
+	{"-b64", 7, 0, NULL},
+	{"-bn", 7, 1, NULL},
+	{"-c", 8, 0, NULL},
+	{"-cf", 8, 1, NULL},
+	{"-cc", 8, 2, NULL},
+	{"-ch", 8, 3, NULL},
+	{"-n", 10, 0, NULL},
+	{"-no", 10, 1, NULL},
+	{"-dn", 10, 2, NULL},
+	{"-md5", 11, 0, NULL},
+	{"-md5l", 11, 1, NULL},
+	{"-md5z", 11, 2, NULL},
+	{"-sha256", 13, 0, NULL},
+	{"-db64", 12, DECODE_BASE64, "-bn"},
+	{"-dp", 12, DECODE_PLAIN, "-p"},
+	{"-dm", 12, DECODE_MYSQL, "-m"},
+	{"-dmc", 12, DECODE_CHAR, "-mc"},
+	{"-du", 12, DECODE_URL, "-u"},
+	{"-dt", 12, DECODE_ATT, "-t"},
+	{"-da", 12, DECODE_MASM, "-a"},
+	{NULL, 0, 0, NULL}
+};
+
+static const char	*bench_corpora[] = {"random", "ascii", "latin1", "digits", NULL};
+
+typedef struct {
+	char	key[64];			/* "lib ascii 64k -t" */
+	double	mbs;
+} bench_result_t;
+
+static bench_result_t	bench_base[BENCH_RESULTS];
+static int	bench_base_count;
+static FILE	*bench_save;
+static int	bench_runs = BENCH_RUNS;
+static char	bench_dir[] = "/tmp/str2hex_bench.XXXXXX";
+
+void exit_error(char *message)
+{
+	fprintf(stderr, "ERROR: %s\n", message);
+	exit(EXIT_FAILURE);
+}
+
+static double now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long long	bench_seed;
+
+/* xorshift64*: the same corpora on every machine */
+static unsigned bench_rand(void)
+{
+	bench_seed ^= bench_seed >> 12;
+	bench_seed ^= bench_seed << 25;
+	bench_seed ^= bench_seed >> 27;
+
+	return (unsigned) ((bench_seed * 2685821657736338717ULL) >> 32);
+}
+
+/* Text of words, punctuation and lines of about 70 characters; "latin1" puts accented cp1252 letters in */
+static void bench_text(unsigned char *p, size_t len, int latin1)
+{
+	static const unsigned char	accents[] = "\xe0\xe1\xe2\xe4\xe7\xe8\xe9\xea\xeb\xee\xef\xf4\xf6\xf9\xfb\xfc\xdf\xc9\xc0\xd6";
+	static const char	*punct[] = {" ", " ", " ", " ", ", ", ". ", "; ", " \"", "\" ", " (", ") ", " 100% ", "'s "};
+	size_t	i = 0, line = 0, n;
+	const char	*s;
+
+	while (i < len)
+	{
+		for (n = 1 + bench_rand() % 10; n && i < len; n--, i++, line++)
+		{
+			if (latin1 && bench_rand() % 7 == 0)
+				p[i] = accents[bench_rand() % (sizeof(accents) - 1)];
+			else
+				p[i] = 'a' + bench_rand() % 26;
+		}
+
+		if (line > 70)
+		{
+			s = "\n";
+			line = 0;
+		} else
+			s = punct[bench_rand() % (sizeof(punct) / sizeof(punct[0]))];
+
+		for (; *s && i < len; s++, i++, line++)
+			p[i] = *s;
+	}
+}
+
+/* Decimal numbers of 1 to 40 digits, some negative, between spaces and new lines */
+static void bench_digits(unsigned char *p, size_t len)
+{
+	size_t	i = 0, n;
+
+	while (i < len)
+	{
+		if (bench_rand() % 8 == 0)
+			p[i++] = '-';
+
+		for (n = 1 + bench_rand() % 40; n && i < len; n--, i++)
+			p[i] = '0' + bench_rand() % 10;
+
+		if (i < len)
+			p[i++] = (bench_rand() % 8 == 0) ? '\n' : ' ';
+	}
+}
+
+static unsigned char *bench_corpus(const char *name, size_t len)
+{
+	unsigned char	*p = malloc(len + 1);
+	size_t	i;
+
+	if (!p)
+		exit_error("Not enough memory.");
+
+	bench_seed = 0x9e3779b97f4a7c15ULL;
+
+	if (!strcmp(name, "random"))
+		for (i = 0; i < len; i++)
+			p[i] = bench_rand() >> 24;
+	else if (!strcmp(name, "digits"))
+		bench_digits(p, len);
+	else
+		bench_text(p, len, !strcmp(name, "latin1"));
+
+	return p;
+}
+
+/* The settings main() gives a mode reading a file */
+static void bench_config(struct _config *config, const bench_mode_t *m)
+{
+	memset(config, 0, sizeof(struct _config));
+	config->from = 2;
+	config->mode = m->mode;
+	config->mode2 = m->mode2;
+	config->threads = 1;
+	config->bufsize = BENCH_CHUNK;
+	config->eol = "\n";
+	config->linesize = B64_DEF_LINE_SIZE;
+
+	if (m->mode == 7 && m->mode2 != 1)
+		config->wrap = config->linesize;
+}
+
+static const bench_mode_t *bench_find(const char *option)
+{
+	const bench_mode_t	*m;
+
+	for (m = bench_modes; m->option; m++)
+		if (!strcmp(m->option, option))
+			return m;
+
+	return NULL;
+}
+
+/*
+ * Convert "len" bytes in chunks of BENCH_CHUNK, the way the read loop of
+ * the program does. Every chunk goes to the start of "out" like to a write
+ * buffer, unless "keep" asks for the whole output. Returns its length.
+ */
+static size_t bench_convert(const bench_mode_t *m, const unsigned char *in, size_t len, char **out, size_t *out_size, int keep)
+{
+	struct _config	config;
+	encoder_t	*enc = malloc(sizeof(encoder_t));
+	size_t	i, n, total = 0, at, need;
+
+	if (!enc)
+		exit_error("Not enough memory.");
+
+	bench_config(&config, m);
+	encoder_init(enc, &config);
+
+	for (i = 0; ; i += n)
+	{
+		n = (len - i < BENCH_CHUNK) ? len - i : BENCH_CHUNK;
+		at = keep ? total : 0;
+		need = at + encoder_bound(enc, n, i + n == len) + 1;
+
+		if (need > *out_size)
+		{
+			*out_size = need * 2;
+			if (!(*out = realloc(*out, *out_size)))
+				exit_error("Not enough memory.");
+		}
+
+		total += encoder_convert_into(enc, *out + at, (unsigned char *) in + i, n, i + n == len);
+
+		if (i + n == len)
+			break;
+	}
+
+	free(enc);
+	return total;
+}
+
+static void bench_report(const char *way, const char *corpus, const char *size, const char *option, size_t len, double seconds, unsigned long long cycles)
+{
+	char	line[128];
+	double	mbs = len / seconds / 1e6;
+	int	i, n;
+
+	n = snprintf(line, sizeof(line), "%-3s %-6s %6s %-8s %9.1f MB/s", way, corpus, size, option, mbs);
+	if (cycles)
+		snprintf(line + n, sizeof(line) - n, " %8.3f c/B", (double) cycles / len);
+
+	printf("%s", line);
+	if (bench_save)
+		fprintf(bench_save, "%s\n", line);
+
+	snprintf(line, sizeof(line), "%s %s %s %s", way, corpus, size, option);
+
+	for (i = 0; i < bench_base_count; i++)
+		if (!strcmp(bench_base[i].key, line))
+		{
+			printf("  %+6.1f%%", (mbs / bench_base[i].mbs - 1) * 100);
+			break;
+		}
+
+	printf("\n");
+	fflush(stdout);
+}
+
+static void bench_lib(const bench_mode_t *m, const char *corpus, const char *size, const unsigned char *in, size_t len)
+{
+	char	*out = NULL;
+	size_t	out_size = 0;
+	double	t, best = 1e30, spent = 0;
+	unsigned long long	c, best_c = 0;
+	int	r;
+
+	/* the output buffer is faulted in by a first run that isn't counted */
+	bench_convert(m, in, len, &out, &out_size, 0);
+
+	for (r = 0; r < bench_runs || spent < BENCH_TIME; r++)
+	{
+		t = now();
+		c = CYCLES();
+		bench_convert(m, in, len, &out, &out_size, 0);
+		c = CYCLES() - c;
+		t = now() - t;
+		spent += t;
+
+		if (t < best)
+		{
+			best = t;
+			best_c = c;
+		}
+	}
+
+	free(out);
+	bench_report("lib", corpus, size, m->option, len, best, best_c);
+}
+
+/* Run the program on "path", output to /dev/null; returns 0 if it succeeded */
+static int bench_exec(const char *cli, const char *option, const char *path)
+{
+	int	status, fd;
+	pid_t	pid = fork();
+
+	if (pid < 0)
+		return -1;
+
+	if (!pid)
+	{
+		if ((fd = open("/dev/null", O_WRONLY)) >= 0)
+			dup2(fd, 1);
+		execl(cli, cli, option, "-f", path, (char *) NULL);
+		_exit(127);
+	}
+
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+		return -1;
+
+	return WEXITSTATUS(status);
+}
+
+static void bench_cli(const char *cli, const bench_mode_t *m, const char *corpus, const char *size, const unsigned char *in, size_t len)
+{
+	char	path[64];
+	FILE	*f;
+	double	t, best = 1e30, spent = 0;
+	unsigned long long	c, best_c = 0;
+	int	r;
+
+	snprintf(path, sizeof(path), "%s/input", bench_dir);
+
+	if (!(f = fopen(path, "wb")) || fwrite(in, 1, len, f) != len || fclose(f))
+		exit_error("Can\'t write the corpus file.");
+
+	for (r = 0; r < bench_runs || spent < BENCH_TIME; r++)
+	{
+		t = now();
+		c = CYCLES();
+		if (bench_exec(cli, m->option, path))
+		{
+			fprintf(stderr, "%s %s failed on %s %s\n", cli, m->option, corpus, size);
+			unlink(path);
+			return;
+		}
+		c = CYCLES() - c;
+		t = now() - t;
+		spent += t;
+
+		if (t < best)
+		{
+			best = t;
+			best_c = c;
+		}
+	}
+
+	unlink(path);
+	bench_report("cli", corpus, size, m->option, len, best, best_c);
+}
+
+/* "64k", "4M": sizes as -bufsize takes them */
+static size_t bench_size(const char *s)
+{
+	char	*end;
+	size_t	n = strtoul(s, &end, 10);
+
+	switch (*end)
+	{
+		case 'k': case 'K':
+			return n << 10;
+		case 'm': case 'M':
+			return n << 20;
+		case 'g': case 'G':
+			return n << 30;
+	}
+
+	return n;
+}
+
+static void bench_load(const char *name)
+{
+	FILE	*f = fopen(name, "r");
+	char	line[256], way[16], corpus[16], size[16], option[16];
+	double	mbs;
+
+	if (!f)
+		exit_error("Can\'t open the baseline file.");
+
+	while (fgets(line, sizeof(line), f) && bench_base_count < BENCH_RESULTS)
+	{
+		if (sscanf(line, "%15s %15s %15s %15s %lf", way, corpus, size, option, &mbs) != 5 || mbs <= 0)
+			continue;
+
+		snprintf(bench_base[bench_base_count].key, sizeof(bench_base[0].key), "%s %s %s %s", way, corpus, size, option);
+		bench_base[bench_base_count++].mbs = mbs;
+	}
+
+	fclose(f);
+}
+
+/* Is "option" in the comma separated list "only" (NULL: every mode) */
+static int bench_selected(const char *only, const char *option)
+{
+	size_t	n = strlen(option);
+	const char	*p;
+
+	if (!only)
+		return 1;
+
+	for (p = only; (p = strstr(p, option)); p += n)
+		if ((p == only || p[-1] == ',') && (p[n] == ',' || !p[n]))
+			return 1;
+
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: str2hex_bench [options]\n"
+		"   -sizes <n>[k|M],...	Corpus sizes (Default is 64k,4M).\n"
+		"   -runs <n>	Runs of every measurement, the best is reported (Default is %d).\n"
+		"   -only <option>,...	Only these modes, as given to str2hex: -t,-u,-xe\n"
+		"   -cli <path>	Measure this str2hex binary end to end too.\n"
+		"   -nolib 	Don\'t measure the library calls.\n"
+		"   -save <file>	Write the results to the file, as a baseline.\n"
+		"   -compare <file>	Show the change against a saved baseline.\n", BENCH_RUNS);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	const char	*cli = NULL, *only = NULL, *sizes = "64k,4M", *p;
+	char	size_name[BENCH_SIZES][16];
+	size_t	size[BENCH_SIZES], len;
+	int	sizes_count = 0, lib = 1, i, k, s;
+	const bench_mode_t	*m;
+	unsigned char	*in, *src;
+	char	*coded = NULL;
+	size_t	coded_size = 0;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-nolib"))
+			lib = 0;
+		else if (i + 1 == argc)
+			usage();
+		else if (!strcmp(argv[i], "-sizes"))
+			sizes = argv[++i];
+		else if (!strcmp(argv[i], "-runs"))
+			bench_runs = atoi(argv[++i]) > 0 ? atoi(argv[i]) : 1;
+		else if (!strcmp(argv[i], "-only"))
+			only = argv[++i];
+		else if (!strcmp(argv[i], "-cli"))
+			cli = argv[++i];
+		else if (!strcmp(argv[i], "-save"))
+		{
+			if (!(bench_save = fopen(argv[++i], "w")))
+				exit_error("Can\'t create the baseline file.");
+		} else if (!strcmp(argv[i], "-compare"))
+			bench_load(argv[++i]);
+		else
+			usage();
+	}
+
+	for (p = sizes; *p && sizes_count < BENCH_SIZES; p += strcspn(p, ","), p += (*p == ','))
+	{
+		len = strcspn(p, ",");
+		snprintf(size_name[sizes_count], sizeof(size_name[0]), "%.*s", (int) (len < 15 ? len : 15), p);
+		if (!(size[sizes_count] = bench_size(size_name[sizes_count])))
+			usage();
+		sizes_count++;
+	}
+
+	if (cli && !mkdtemp(bench_dir))
+		exit_error("Can\'t create a temporary directory.");
+
+	for (s = 0; s < sizes_count; s++)
+		for (k = 0; bench_corpora[k]; k++)
+		{
+			src = bench_corpus(bench_corpora[k], size[s]);
+
+			for (m = bench_modes; m->option; m++)
+			{
+				if (!bench_selected(only, m->option))
+					continue;
+
+				in = src;
+				len = size[s];
+
+				/* the decoders read the corpus as their encoder writes it */
+				if (m->source)
+				{
+					len = bench_convert(bench_find(m->source), src, size[s], &coded, &coded_size, 1);
+					in = (unsigned char *) coded;
+				}
+
+				if (lib)
+					bench_lib(m, bench_corpora[k], size_name[s], in, len);
+				if (cli)
+					bench_cli(cli, m, bench_corpora[k], size_name[s], in, len);
+			}
+
+			free(src);
+		}
+
+	if (cli)
+		rmdir(bench_dir);
+	if (bench_save)
+		fclose(bench_save);
+	free(coded);
+
+	return 0;
+}
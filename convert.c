@@ -0,0 +1,440 @@
+/*
+ * convert.c
+ * This file is part of str2hex project.
+ *
+ * Copyright 2005 Dzmitry Plashchynski <plashchynski@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Drive an encoder over a whole input: mapped, read through io_uring or
+ * with plain read(), and write the results through the I/O layer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifndef WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "main.h"
+#include "process.h"
+#include "io.h"
+#include "uring.h"
+#include "convert.h"
+#include "pool.h"
+
+static void convert_step(encoder_t *enc, const unsigned char *in, size_t len, int last, io_out_t *out);
+static void convert_read(encoder_t *enc, io_out_t *out, int count, int in_fd);
+static unsigned char *convert_map(struct _config *config, int in_fd, size_t *size);
+static int convert_mapped(struct _config *config, int in_fd, io_out_t *out);
+static int convert_uring(struct _config *config, int in_fd, io_out_t *out);
+
+/* Page size: the buffer size is rounded up to it */
+size_t convert_chunk_size(void)
+{
+#ifndef WIN32
+	long	page_size = sysconf(_SC_PAGESIZE);
+
+	if (page_size > 0)
+		return page_size;
+#endif
+	return 4096;
+}
+
+/*
+ * Feed "len" bytes to the encoder in spans of the buffer size. The encoder
+ * keeps its state between them, so the input may be cut anywhere.
+ */
+void convert_span(encoder_t *enc, const unsigned char *in, size_t len, io_out_t *out)
+{
+	size_t	step = enc->config->bufsize;
+	size_t	n;
+
+	for (; len && !out->error; in += n, len -= n)
+	{
+		n = (len < step) ? len : step;
+		convert_step(enc, in, n, 0, out);
+	}
+}
+
+/* End of the stream: write what the encoder kept back */
+void convert_finish(encoder_t *enc, io_out_t *out)
+{
+	convert_step(enc, NULL, 0, 1, out);
+}
+
+/*
+ * Output of "len" input bytes before wrapping, see convert_output_size();
+ * "end" counts what the end of the stream adds (the ")" of CHAR(..)).
+ */
+static size_t convert_raw_size(struct _config *config, size_t len, int end, int *exact)
+{
+	size_t	lead, trail;
+	encoder_t	enc;
+
+	*exact = 1;
+
+	switch (config->mode)
+	{
+		case 7:
+			return BASE64_LENGTH(len);
+
+		case 10:	/* see number_bound() */
+			*exact = 0;
+			return (len + 1) * (3 + strlen(config->eol));
+
+		case 11:	/* a digest line for every record, at worst every byte ends one */
+			if (config->mode2)
+			{
+				*exact = 0;
+				return (len + 1) * (32 + strlen(config->eol));
+			}
+			return 32;
+
+		case 13:
+			return SHA256_DIGEST_SIZE * 2;
+
+		case 12:
+			*exact = 0;
+			return (config->mode2 == DECODE_BASE64) ? BASE64_DECODED_LENGTH(len) : len;
+	}
+
+	if (!len)
+		return 0;
+
+	encoder_init(&enc, config);
+	lead = enc.table.lead ? strlen(enc.table.lead) : 0;
+	trail = (end && len > 1 && enc.table.trail) ? strlen(enc.table.trail) : 0;	/* CHAR(..) of one byte stays open */
+
+	if (!enc.table.width || config->exclude_symbols_size || config->include_symbols_size || config->nlign)
+	{
+		*exact = 0;
+		return len * encode_max_width(config->mode, config->mode2) + lead + trail;
+	}
+
+	/* only the first cell of the stream goes without its separator */
+	return lead + len * enc.table.width - enc.table.skip + trail;
+}
+
+/*
+ * Size of the whole conversion of "len" input bytes, without the final
+ * new line. *exact is set to 1 when the size is exact and to 0 when it is
+ * only the worst case (filters, variable width and decoding modes).
+ */
+size_t convert_output_size(struct _config *config, size_t len, int *exact)
+{
+	size_t	size;
+	int	dummy;
+
+	if (!exact)
+		exact = &dummy;
+
+	size = convert_raw_size(config, len, 1, exact);
+
+	/* a break after every full line that more output follows */
+	if (config->wrap && size)
+		size += (*exact ? (size - 1) / config->wrap : size / config->wrap + 1) * strlen(config->eol);
+
+	return size;
+}
+
+/* Convert "in_fd" up to its end; the caller writes the final new line */
+void convert_stream(struct _config *config, int in_fd, io_out_t *out)
+{
+	encoder_t	enc;
+
+	/* regular files are mapped or read through io_uring, pipes and terminals are read */
+	if (convert_uring(config, in_fd, out) || convert_mapped(config, in_fd, out))
+		return;
+
+	encoder_init(&enc, config);
+	convert_read(&enc, out, 1, in_fd);
+	convert_finish(&enc, out);
+}
+
+/* 1 when writing any of the outputs has failed */
+static int convert_failed(io_out_t *out, int count)
+{
+	int	k;
+
+	for (k = 0; k < count; k++)
+		if (out[k].error)
+			return 1;
+
+	return 0;
+}
+
+/*
+ * Convert "in_fd" into several outputs, each with its own mode
+ * (-b64 -o a.b64 -md5 -o a.md5). The input is read once: every buffer
+ * sized span goes to all the encoders while it is still in the cache.
+ * The caller writes the final new lines.
+ */
+void convert_outputs(struct _config **configs, io_out_t *out, int count, int in_fd)
+{
+	encoder_t	*enc = calloc(count, sizeof(encoder_t));
+	unsigned char	*map = NULL;
+	size_t	size, n, off;
+	int	k;
+
+	if (!enc)
+		exit_error("Not enough memory.");
+
+	for (k = 0; k < count; k++)
+		encoder_init(&enc[k], configs[k]);
+
+	if ((map = convert_map(configs[0], in_fd, &size)))
+	{
+		for (off = 0; off < size && !convert_failed(out, count); off += n)
+		{
+			n = (size - off < configs[0]->bufsize) ? size - off : configs[0]->bufsize;
+
+			for (k = 0; k < count; k++)
+				convert_span(&enc[k], map + off, n, &out[k]);
+		}
+
+#ifndef WIN32
+		munmap(map, size);
+#endif
+	} else
+		convert_read(enc, out, count, in_fd);
+
+	for (k = 0; k < count; k++)
+		convert_finish(&enc[k], &out[k]);
+
+	free(enc);
+}
+
+/* Read "in_fd" to its end with read() and feed every buffer to "count" encoders, each with its own output */
+static void convert_read(encoder_t *enc, io_out_t *out, int count, int in_fd)
+{
+	size_t	in_buffer_size = enc->config->bufsize;
+	unsigned char	*in_buffer;
+	long	n = 0;
+	int	k;
+
+	in_buffer = pool_get(in_buffer_size);
+
+	/* every read goes on as it comes, short ones too: the encoders keep their state */
+	while (!convert_failed(out, count) && (n = io_read(in_fd, in_buffer, in_buffer_size)) > 0)
+		for (k = 0; k < count; k++)
+			convert_span(&enc[k], in_buffer, n, &out[k]);
+
+	if (n < 0)
+		exit_error("Can\'t read the input file.");
+
+	pool_put(in_buffer);
+}
+
+/*
+ * Convert "len" bytes of memory, a stream starting at "offset" of the
+ * input; "last" when the input ends with them and the stream is closed
+ */
+void convert_memory(struct _config *config, const unsigned char *in, size_t len, io_out_t *out, unsigned long long offset, int last)
+{
+	encoder_t	enc;
+	int	exact;
+
+	encoder_init(&enc, config);
+
+	/* wrapped lines go on from the column the output before "offset" ends in */
+	encoder_seek(&enc, offset, config->wrap ? convert_raw_size(config, offset, 0, &exact) : 0);
+
+	convert_span(&enc, in, len, out);
+	if (last)
+		convert_finish(&enc, out);
+}
+
+/* Map a regular file for reading. Returns NULL if the file can't be mapped or the backend is another one. */
+static unsigned char *convert_map(struct _config *config, int in_fd, size_t *size)
+{
+#ifndef WIN32
+	struct stat	st;
+	void	*map;
+
+	if (config->io == IO_READ || config->io == IO_URING)
+		return NULL;
+
+	if (fstat(in_fd, &st) || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+		(unsigned long long) st.st_size > (size_t) -1 || lseek(in_fd, 0, SEEK_CUR) != 0)
+			return NULL;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in_fd, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	*size = st.st_size;
+
+	return map;
+#else
+	return NULL;
+#endif
+}
+
+/* Map a regular file and convert it in place. Returns 0 if the file can't be mapped. */
+static int convert_mapped(struct _config *config, int in_fd, io_out_t *out)
+{
+	unsigned char	*map;
+	size_t	size;
+
+	if (!(map = convert_map(config, in_fd, &size)))
+		return 0;
+
+	convert_memory(config, map, size, out, 0, 1);
+#ifndef WIN32
+	munmap(map, size);
+#endif
+
+	return 1;
+}
+
+#ifdef HAVE_URING
+/* Queue the read of buffer "i" from "done" on; the ring has room for a read of every buffer */
+static void convert_uring_read(uring_t *ring, int fixed, int in_fd, const struct iovec *iov, size_t done, size_t len,
+	unsigned long long pos, int i)
+{
+	struct io_uring_sqe	*sqe = uring_sqe(ring, fixed ? IORING_OP_READ_FIXED : IORING_OP_READ, in_fd,
+		(char *) iov->iov_base + done, len, pos, i);
+
+	if (!sqe)
+		exit_error("Can\'t read the input file.");
+
+	sqe->buf_index = i;
+}
+#endif
+
+/*
+ * Read a regular file through io_uring: IO_ASYNC buffers of the buffer
+ * size are being read ahead while the encoder works on the oldest one.
+ * Returns 0 if io_uring isn't wanted or available.
+ */
+static int convert_uring(struct _config *config, int in_fd, io_out_t *out)
+{
+#ifdef HAVE_URING
+	uring_t	ring;
+	struct io_uring_cqe	cqe;
+	struct iovec	iov[IO_ASYNC];
+	unsigned long long	pos[IO_ASYNC], next = 0, size;
+	size_t	want[IO_ASYNC], got[IO_ASYNC];
+	struct stat	st;
+	encoder_t	enc;
+	int	i, s, fixed;
+
+	if (config->io != IO_URING || fstat(in_fd, &st) || !S_ISREG(st.st_mode) ||
+		lseek(in_fd, 0, SEEK_CUR) != 0 || uring_init(&ring, 2 * IO_ASYNC))
+			return 0;
+
+	for (i = 0; i < IO_ASYNC; i++)
+	{
+		iov[i].iov_base = pool_get(config->bufsize);
+		iov[i].iov_len = config->bufsize;
+	}
+
+	/* pinned buffers spare the kernel a page walk on every read */
+	fixed = !uring_register_buffers(&ring, iov, IO_ASYNC);
+	size = st.st_size;
+
+	/* every buffer is read full, in file order */
+	for (i = 0; i < IO_ASYNC; i++)
+	{
+		pos[i] = next;
+		got[i] = 0;
+		want[i] = (size - next < config->bufsize) ? size - next : config->bufsize;
+		next += want[i];
+
+		if (want[i])
+			convert_uring_read(&ring, fixed, in_fd, &iov[i], 0, want[i], pos[i], i);
+	}
+
+	encoder_init(&enc, config);
+
+	for (i = 0; want[i] && !out->error; i = (i + 1) % IO_ASYNC)
+	{
+		while (got[i] < want[i])
+		{
+			if (uring_submit(&ring, 1) < 0)
+				exit_error("Can\'t read the input file.");
+
+			while (uring_reap(&ring, &cqe))
+			{
+				s = cqe.user_data;
+
+				if (cqe.res < 0 && cqe.res != -EINTR && cqe.res != -EAGAIN)
+					exit_error("Can\'t read the input file.");
+
+				/* the file got shorter */
+				if (!cqe.res)
+					want[s] = got[s];
+				else if (cqe.res > 0)
+					got[s] += cqe.res;
+
+				if (got[s] < want[s])
+					convert_uring_read(&ring, fixed, in_fd, &iov[s], got[s], want[s] - got[s], pos[s] + got[s], s);
+			}
+		}
+
+		convert_span(&enc, iov[i].iov_base, got[i], out);
+
+		/* the buffer goes back to the kernel for the next part of the file */
+		pos[i] = next;
+		got[i] = 0;
+		want[i] = (size - next < config->bufsize) ? size - next : config->bufsize;
+		next += want[i];
+
+		if (want[i])
+			convert_uring_read(&ring, fixed, in_fd, &iov[i], 0, want[i], pos[i], i);
+	}
+
+	convert_finish(&enc, out);
+
+	/*
+	 * After a write error reads are still queued or in flight. Every
+	 * buffer has at most one: wait for it to complete before the buffers
+	 * are unpinned and go back to the pool.
+	 */
+	for (i = 0; i < IO_ASYNC; i++)
+		while (got[i] < want[i])
+		{
+			if (uring_submit(&ring, 1) < 0)
+				exit_error("Can\'t read the input file.");
+
+			while (uring_reap(&ring, &cqe))
+				want[cqe.user_data] = got[cqe.user_data];
+		}
+
+	uring_exit(&ring);
+	for (i = 0; i < IO_ASYNC; i++)
+		pool_put(iov[i].iov_base);
+
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/* Convert straight into the output buffer, line breaks included */
+static void convert_step(encoder_t *enc, const unsigned char *in, size_t len, int last, io_out_t *out)
+{
+	char	*p = io_reserve(out, encoder_bound(enc, len, last));
+
+	io_commit(out, encoder_convert_into(enc, p, (unsigned char *) in, len, last));
+}
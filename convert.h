@@ -0,0 +1,27 @@
+#ifndef __CONVERT_H
+#define __CONVERT_H
+
+#include "main.h"
+#include "process.h"
+#include "io.h"
+
+/* Room an encoder may ask for beyond the final output size */
+#define CONVERT_SLACK	64
+
+size_t convert_chunk_size(void);
+size_t convert_output_size(struct _config *config, size_t len, int *exact);
+
+/* Convert the whole stream, without the final new line */
+void convert_stream(struct _config *config, int in_fd, io_out_t *out);
+
+/* The same into "count" outputs with their own modes, reading the input once */
+void convert_outputs(struct _config **configs, io_out_t *out, int count, int in_fd);
+
+/* The same for a part of the input held in memory, starting at "offset" of the input; "last" closes the stream */
+void convert_memory(struct _config *config, const unsigned char *in, size_t len, io_out_t *out, unsigned long long offset, int last);
+
+/* Feed more input to an encoder, and flush it at the end of the stream */
+void convert_span(encoder_t *enc, const unsigned char *in, size_t len, io_out_t *out);
+void convert_finish(encoder_t *enc, io_out_t *out);
+
+#endif
@@ -0,0 +1,364 @@
+/*
+ * decode.c
+ * This file is part of str2hex project.
+ *
+ * Copyright 2005 Dzmitry Plashchynski <plashchynski@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Hex decoding of the formats produced by the fixed-width modes.
+ *
+ * Every format is described as an optional lead ("0x", "CHAR("), a token
+ * of prefix + two hex digits + suffix repeated for every byte, separators
+ * (white space and commas) between the tokens, and an optional trailer.
+ * The scalar state machine accepts any mix of upper and lower case and
+ * any separators. Once the separator between the first two tokens is
+ * known, the layout of one cell is fixed and the vector kernel decodes
+ * 16 cells per step, checking the separator bytes against a
+ * template and gathering the digits with shuffles.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "decode.h"
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#define PHASE_LEAD	0
+#define PHASE_BODY	1
+#define PHASE_END	2
+
+static int hex_value(unsigned char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/* Lower case for the syntax; letters only, so no control byte can pass for '0', '%' or '(' */
+static unsigned char lower_case(unsigned char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c | 0x20 : c;
+}
+
+static int is_separator(const hex_decode_state_t *stat, unsigned char c)
+{
+	/* URL text keeps its literal bytes; a line break can only be one of ours, -u escapes CR and LF */
+	if (stat->format == DECODE_URL)
+		return c == '\r' || c == '\n';
+
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n' ||
+		(c == ',' && (stat->format == DECODE_ATT || stat->format == DECODE_MASM || stat->format == DECODE_CHAR));
+}
+
+void hex_decode_init(hex_decode_state_t *stat, int format)
+{
+	memset(stat, 0, sizeof(hex_decode_state_t));
+
+	stat->format = format;
+	stat->lead = stat->prefix = stat->suffix = "";
+	stat->error = DECODE_NO_ERROR;
+
+	switch (format)
+	{
+		case DECODE_MYSQL:
+			stat->lead = "0x";
+			break;
+		case DECODE_CHAR:
+			stat->lead = "char(";
+			stat->trailer = ')';
+			break;
+		case DECODE_URL:
+			stat->prefix = "%";
+			break;
+		case DECODE_ATT:
+			stat->prefix = "0x";
+			break;
+		case DECODE_MASM:
+			stat->suffix = "h";
+			break;
+	}
+
+	stat->phase = *stat->lead ? PHASE_LEAD : PHASE_BODY;
+}
+
+/* Fix the cell layout once the separator between two tokens is known */
+static void hex_decode_layout(hex_decode_state_t *stat)
+{
+	int	plen = strlen(stat->prefix), slen = strlen(stat->suffix);
+	int	w = stat->seplen + plen + 2 + slen;
+	int	o = stat->seplen + plen;
+	char	cell[ENCODE_CELL_SIZE];
+	int	k, j;
+
+	if (w > ENCODE_CELL_SIZE || encode_simd_level() == ENCODE_SIMD_NONE)
+		return;
+
+	memcpy(cell, stat->sep, stat->seplen);
+	memcpy(cell + stat->seplen, stat->prefix, plen);
+	memcpy(cell + o + 2, stat->suffix, slen);
+
+	for (k = 0; k < 16 * w; k++)
+	{
+		int	r = k % w;
+
+		stat->hexpos[k] = (r == o || r == o + 1) ? 0xff : 0;
+		stat->tpl[k] = stat->hexpos[k] ? 0 : cell[r];
+		stat->gather_h[k] = stat->gather_l[k] = 0x80;
+	}
+
+	/* cell j has its digits at j*w + o and j*w + o + 1 */
+	for (j = 0; j < 16; j++)
+	{
+		k = j * w + o;
+		stat->gather_h[(k / 16) * 16 + j] = k % 16;
+		k++;
+		stat->gather_l[(k / 16) * 16 + j] = k % 16;
+	}
+
+	stat->width = w;
+}
+
+#ifdef HAVE_X86_SIMD
+
+/* ASCII hex digits -> values, flags anything else in "bad" */
+__attribute__((target("ssse3")))
+static inline __m128i hex_digits_ssse3(__m128i c, __m128i *bad)
+{
+	__m128i	lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+	__m128i	digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), c));
+	__m128i	alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), lower));
+
+	*bad = _mm_or_si128(*bad, _mm_andnot_si128(_mm_or_si128(digit, alpha), _mm_set1_epi8(-1)));
+
+	return _mm_add_epi8(_mm_and_si128(c, _mm_set1_epi8(0x0f)), _mm_and_si128(alpha, _mm_set1_epi8(9)));
+}
+
+/* 16 cells per step: template check and digit gather over the "width" input vectors */
+__attribute__((target("ssse3")))
+static size_t hex_decode_ssse3(const hex_decode_state_t *stat, unsigned char *out, const unsigned char *in, size_t len)
+{
+	const int	w = stat->width;
+	size_t	i;
+	int	v;
+
+	for (i = 0; i + 16*w <= len; i += 16*w)
+	{
+		__m128i	h = _mm_setzero_si128(), l = _mm_setzero_si128(), bad = _mm_setzero_si128();
+		int	match = 0xffff;
+
+		for (v = 0; v < w; v++)
+		{
+			__m128i	x = _mm_loadu_si128((const __m128i *) (in + i + 16*v));
+			__m128i	eq = _mm_cmpeq_epi8(x, _mm_loadu_si128((const __m128i *) (stat->tpl + 16*v)));
+
+			match &= _mm_movemask_epi8(_mm_or_si128(eq, _mm_loadu_si128((const __m128i *) (stat->hexpos + 16*v))));
+			h = _mm_or_si128(h, _mm_shuffle_epi8(x, _mm_loadu_si128((const __m128i *) (stat->gather_h + 16*v))));
+			l = _mm_or_si128(l, _mm_shuffle_epi8(x, _mm_loadu_si128((const __m128i *) (stat->gather_l + 16*v))));
+		}
+
+		h = hex_digits_ssse3(h, &bad);
+		l = hex_digits_ssse3(l, &bad);
+
+		if (match != 0xffff || _mm_movemask_epi8(bad))
+			break;
+
+		_mm_storeu_si128((__m128i *) out, _mm_or_si128(_mm_slli_epi16(h, 4), l));
+		out += 16;
+	}
+
+	return i;
+}
+
+/* plain pairs, 32 digits per step */
+__attribute__((target("avx2")))
+static size_t hex_decode_avx2(unsigned char *out, const unsigned char *in, size_t len)
+{
+	size_t	i;
+
+	for (i = 0; i + 32 <= len; i += 32)
+	{
+		__m256i	c = _mm256_loadu_si256((const __m256i *) (in + i));
+		__m256i	lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+		__m256i	digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+		__m256i	alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+		__m256i	v;
+
+		if (_mm256_movemask_epi8(_mm256_or_si256(digit, alpha)) != -1)
+			break;
+
+		v = _mm256_add_epi8(_mm256_and_si256(c, _mm256_set1_epi8(0x0f)), _mm256_and_si256(alpha, _mm256_set1_epi8(9)));
+
+		/* (high, low) -> high * 16 + low, then pack the 16-bit results down to bytes */
+		v = _mm256_maddubs_epi16(v, _mm256_set1_epi16(0x0110));
+		v = _mm256_packus_epi16(v, v);
+		v = _mm256_permute4x64_epi64(v, 0x08);
+
+		_mm_storeu_si128((__m128i *) out, _mm256_castsi256_si128(v));
+		out += 16;
+	}
+
+	return i;
+}
+
+#endif
+
+/* Decode the longest run of whole cells matching the layout, returns input characters consumed */
+static size_t hex_decode_simd(const hex_decode_state_t *stat, unsigned char *out, const unsigned char *in, size_t len)
+{
+#ifdef HAVE_X86_SIMD
+	if (stat->width == 2 && encode_simd_level() >= ENCODE_SIMD_AVX2)
+		return hex_decode_avx2(out, in, len);
+
+	if (stat->width)
+		return hex_decode_ssse3(stat, out, in, len);
+#endif
+	return 0;
+}
+
+/*
+ * Decode the next chunk of the stream into "out", which must hold in_len
+ * bytes: URL literals are copied 1:1, every other format at least halves.
+ * On bad input the bytes before it are written and stat->error holds the
+ * offset of the offending character from the start of the stream.
+ * mode != 0 marks the last chunk. Returns the number of bytes written.
+ */
+size_t hex_decode_into(hex_decode_state_t *stat, unsigned char *out, const unsigned char *in_buf, size_t in_len, int mode)
+{
+	const unsigned char	*start = in_buf, *in = start, *end = start + in_len;
+	int	plen = strlen(stat->prefix), slen = strlen(stat->suffix);
+	int	toklen = plen + 2 + slen;
+	unsigned char	*p = out;
+	size_t	n, scalar = 0;
+
+	for (; in < end; in++, scalar++)
+	{
+		unsigned char	c = *in;
+		int	v;
+
+		if (stat->phase == PHASE_LEAD)
+		{
+			if (!stat->pos && is_separator(stat, c))
+				continue;
+
+			if (lower_case(c) != stat->lead[stat->pos])
+				goto error;
+
+			if (!stat->lead[++stat->pos])
+			{
+				stat->phase = PHASE_BODY;
+				stat->pos = 0;
+			}
+			continue;
+		}
+
+		if (stat->phase == PHASE_END)
+		{
+			if (!is_separator(stat, c))
+				goto error;
+			continue;
+		}
+
+		/* between tokens */
+		if (!stat->pos)
+		{
+			/* vector kernel on the bulk, retried after every block's worth of scalar input */
+			if (stat->width && !stat->gap && scalar >= (size_t) 16 * stat->width)
+			{
+				n = hex_decode_simd(stat, p, in, end - in);
+				p += n / stat->width;
+				in += n;
+				scalar = 0;
+
+				if (in == end)
+					break;
+				c = *in;
+			}
+
+			if (is_separator(stat, c))
+			{
+				if (stat->tokens == 1 && stat->seplen < ENCODE_CELL_SIZE)
+					stat->sep[stat->seplen++] = c;
+				stat->gap++;
+				continue;
+			}
+
+			if (stat->trailer && c == stat->trailer)
+			{
+				stat->phase = PHASE_END;
+				continue;
+			}
+
+			if (stat->format == DECODE_URL && c != '%')
+			{
+				*p++ = c;
+				continue;
+			}
+		}
+
+		/* inside a token: prefix, two digits, suffix */
+		if (stat->pos < plen)
+		{
+			if (lower_case(c) != stat->prefix[stat->pos])
+				goto error;
+		} else if (stat->pos < plen + 2)
+		{
+			if ((v = hex_value(c)) < 0)
+				goto error;
+
+			if (stat->pos == plen)
+				stat->hi = v;
+			else
+				*p++ = (stat->hi << 4) | v;
+		} else if (lower_case(c) != stat->suffix[stat->pos - plen - 2])
+			goto error;
+
+		if (++stat->pos == toklen)
+		{
+			stat->pos = 0;
+			stat->gap = 0;
+
+			if (stat->tokens < 2 && ++stat->tokens == 2)
+			{
+				hex_decode_layout(stat);
+				scalar = (size_t) 16 * ENCODE_CELL_SIZE;
+			}
+		}
+	}
+
+	/*
+	 * The stream may not stop inside a token. The trailer may be missing:
+	 * -mc leaves out the ")" when the last input byte isn't converted.
+	 */
+	if (mode && stat->pos)
+		stat->error = stat->offset + in_len;
+
+	stat->offset += in_len;
+
+	return p - out;
+
+error:
+	stat->error = stat->offset + (in - start);
+	stat->offset += in_len;
+
+	return p - out;
+}
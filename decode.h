@@ -0,0 +1,47 @@
+#ifndef __DECODE_H
+#define __DECODE_H
+
+#include <stddef.h>
+#include "encode.h"
+
+/* decoding minor modes (major mode 12) */
+#define DECODE_BASE64	0	/* -db64: AAEC... */
+#define DECODE_PLAIN	1	/* -dp: 2f6574 */
+#define DECODE_MYSQL	2	/* -dm: 0x2f6574 */
+#define DECODE_CHAR	3	/* -dmc: CHAR(2f,65,74) */
+#define DECODE_URL	4	/* -du: %2f%65%74 */
+#define DECODE_ATT	5	/* -dt: 0x2f, 0x65, 0x74 */
+#define DECODE_MASM	6	/* -da: 2fh, 65h, 74h */
+
+#define DECODE_NO_ERROR	((size_t) -1)
+
+typedef struct {
+	int	format;
+	const char	*lead;			/* once before the data: "0x", "CHAR(" */
+	const char	*prefix;		/* before every pair: "%", "0x" */
+	const char	*suffix;		/* after every pair: "h" */
+	int	trailer;			/* once after the data: ')' */
+
+	int	phase;				/* lead, body or trailer */
+	int	pos;				/* characters of the lead or of the current token matched */
+	int	hi;				/* value of the high digit of the current pair */
+	int	tokens;				/* pairs decoded so far, counted up to 2 */
+	int	gap;				/* separator characters since the last token */
+	char	sep[ENCODE_CELL_SIZE];		/* separator seen between the first two pairs */
+	int	seplen;
+
+	/* layout of one cell for the vector kernel, once the separator is known */
+	int	width;				/* 0 - no kernel */
+	unsigned char	tpl[16 * ENCODE_CELL_SIZE];	/* constant bytes of the cells */
+	unsigned char	hexpos[16 * ENCODE_CELL_SIZE];	/* 0xff where a digit is expected */
+	unsigned char	gather_h[16 * ENCODE_CELL_SIZE];	/* per input vector: shuffle picking the high digits */
+	unsigned char	gather_l[16 * ENCODE_CELL_SIZE];	/* per input vector: shuffle picking the low digits */
+
+	size_t	offset;				/* input characters consumed by previous chunks */
+	size_t	error;				/* offset of the first invalid character, DECODE_NO_ERROR if none */
+} hex_decode_state_t;
+
+void hex_decode_init(hex_decode_state_t *stat, int format);
+size_t hex_decode_into(hex_decode_state_t *stat, unsigned char *out, const unsigned char *in, size_t in_len, int mode);
+
+#endif
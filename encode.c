@@ -0,0 +1,892 @@
+/*
+ * encode.c
+ * This file is part of str2hex project.
+ *
+ * Copyright 2005 Dzmitry Plashchynski <plashchynski@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "encode.h"
+
+#define HEX_ROW(h)	#h"0" #h"1" #h"2" #h"3" #h"4" #h"5" #h"6" #h"7" \
+			#h"8" #h"9" #h"a" #h"b" #h"c" #h"d" #h"e" #h"f"
+
+const char hex_pairs[513] =
+	HEX_ROW(0) HEX_ROW(1) HEX_ROW(2) HEX_ROW(3) HEX_ROW(4) HEX_ROW(5) HEX_ROW(6) HEX_ROW(7)
+	HEX_ROW(8) HEX_ROW(9) HEX_ROW(a) HEX_ROW(b) HEX_ROW(c) HEX_ROW(d) HEX_ROW(e) HEX_ROW(f);
+
+/*
+ * Split the cell of a fixed-width mode into the text written before and
+ * after the hex pair. Returns 0 for modes with variable width output.
+ */
+static int mode_parts(int mode, int mode2, const char **before, const char **after, int *skip, const char **lead, const char **trail)
+{
+	*before = *after = *lead = *trail = "";
+	*skip = 0;
+
+	switch (mode)
+	{
+		/* Plain hex: 2f */
+		case 9:
+			break;
+
+		/* AT&T asm: , 0x2f */
+		case 1:
+			*before = (mode2 == 1) ? " 0x" : (mode2 == 2) ? "0x" : ", 0x";
+			*skip = (mode2 == 1) ? 1 : (mode2 == 2) ? 0 : 2;
+			break;
+
+		/* Microsoft asm: , 2fh */
+		case 2:
+			*before = (mode2 == 1) ? " " : (mode2 == 2) ? "" : ", ";
+			*after = "h";
+			*skip = strlen(*before);
+			break;
+
+		/* MySQL: 0x2f... or CHAR(2f,... */
+		case 3:
+			if (mode2 == 1)
+			{
+				*before = ",";
+				*skip = 1;
+				*lead = "CHAR(";
+				*trail = ")";
+			} else
+				*lead = "0x";
+			break;
+
+		/* URL: %2f */
+		case 4:
+			*before = "%";
+			break;
+
+		default:
+			return 0;
+	}
+
+	return strlen(*before) + 2 + strlen(*after);
+}
+
+/*
+ * The escape of one byte in the HTML and C modes, as sprintf() writes it
+ * into "s", which has room for 16 bytes. Returns its length.
+ */
+static int escape_cell(int mode, int mode2, unsigned char c, char *s)
+{
+	int	n;
+
+	switch(mode)
+	{
+		/* HTML Style char convertion */
+		case 5:
+			switch (mode2)
+			{
+				case 1: // as HTML escape codes: &iexcl;&#x78;&copy;...
+					switch (c)
+					{
+						case 0x20:
+							n = sprintf(s, "&nbsp;");
+							break;
+						case 0x22:
+							n = sprintf(s, "&quot;");
+							break;
+						case 0x26:
+							n = sprintf(s, "&amp;");
+							break;
+						case 0x2F:
+							n = sprintf(s, "&frasl;");
+							break;
+						case 0x3C:
+							n = sprintf(s, "&lt;");
+							break;
+						case 0x3E:
+							n = sprintf(s, "&qt;");
+							break;
+						case 0x89:
+							n = sprintf(s, "&permil;");
+							break;
+						case 0x8B:
+							n = sprintf(s, "&lsaquo;");
+							break;
+						case 0x96:
+							n = sprintf(s, "&ndash;");
+							break;
+						case 0x97:
+							n = sprintf(s, "&mdash;");
+							break;
+						case 0x99:
+							n = sprintf(s, "&trade;");
+							break;
+						case 0x9B:
+							n = sprintf(s, "&rsaquo;");
+							break;
+						case 0xA1:
+							n = sprintf(s, "&iexcl;");
+							break;
+						case 0xA2:
+							n = sprintf(s, "&cent;");
+							break;
+						case 0xA3:
+							n = sprintf(s, "&pound;");
+							break;
+						case 0xA4:
+							n = sprintf(s, "&curren;");
+							break;
+						case 0xA5:
+							n = sprintf(s, "&yen;");
+							break;
+						case 0xA6:
+							n = sprintf(s, "&brvbar;");
+							break;
+						case 0xA7:
+							n = sprintf(s, "&sect;");
+							break;
+						case 0xA8:
+							n = sprintf(s, "&uml;");
+							break;
+						case 0xA9:
+							n = sprintf(s, "&yen;");
+							break;
+						case 0xAA:
+							n = sprintf(s, "&ordf;");
+							break;
+						case 0xAB:
+							n = sprintf(s, "&laquo;");
+							break;
+						case 0xAC:
+							n = sprintf(s, "&not;");
+							break;
+						case 0xAD:
+							n = sprintf(s, "&shy;");
+							break;
+						case 0xAE:
+							n = sprintf(s, "&reg;");
+							break;
+						case 0xAF:
+							n = sprintf(s, "&macr;");
+							break;
+						case 0xB0:
+							n = sprintf(s, "&deg;");
+							break;
+						case 0xB1:
+							n = sprintf(s, "&plusmn;");
+							break;
+						case 0xB2:
+							n = sprintf(s, "&sup2;");
+							break;
+						case 0xB3:
+							n = sprintf(s, "&sup3;");
+							break;
+						case 0xB4:
+							n = sprintf(s, "&acute;");
+							break;
+						case 0xB5:
+							n = sprintf(s, "&micro;");
+							break;
+						case 0xB6:
+							n = sprintf(s, "&para;");
+							break;
+						case 0xB7:
+							n = sprintf(s, "&middot;");
+							break;
+						case 0xB8:
+							n = sprintf(s, "&cedil;");
+							break;
+						case 0xB9:
+							n = sprintf(s, "&sup1;");
+							break;
+						case 0xBA:
+							n = sprintf(s, "&ordm;");
+							break;
+						case 0xBB:
+							n = sprintf(s, "&raquo;");
+							break;
+						case 0xBC:
+							n = sprintf(s, "&frac14;");
+							break;
+						case 0xBD:
+							n = sprintf(s, "&frac12;");
+							break;
+						case 0xBE:
+							n = sprintf(s, "&frac34;");
+							break;
+						case 0xBF:
+							n = sprintf(s, "&iquest;");
+							break;
+						case 0xC0:
+							n = sprintf(s, "&agrave;");
+							break;
+						case 0xC1:
+							n = sprintf(s, "&Aacute;");
+							break;
+						case 0xC2:
+							n = sprintf(s, "&Acirc;");
+							break;
+						case 0xC3:
+							n = sprintf(s, "&Atilde;");
+							break;
+						case 0xC4:
+							n = sprintf(s, "&Auml;");
+							break;
+						case 0xC5:
+							n = sprintf(s, "&Aring;");
+							break;
+						case 0xC6:
+							n = sprintf(s, "&AElig;");
+							break;
+						case 0xC7:
+							n = sprintf(s, "&Ccedil;");
+							break;
+						case 0xC8:
+							n = sprintf(s, "&Egrave;");
+							break;
+						case 0xC9:
+							n = sprintf(s, "&Eacute;");
+							break;
+						case 0xCA:
+							n = sprintf(s, "&Ecirc;");
+							break;
+						case 0xCB:
+							n = sprintf(s, "&Euml;");
+							break;
+						case 0xCC:
+							n = sprintf(s, "&Igrave;");
+							break;
+						case 0xCD:
+							n = sprintf(s, "&Iacute;");
+							break;
+						case 0xCE:
+							n = sprintf(s, "&Icirc;");
+							break;
+						case 0xCF:
+							n = sprintf(s, "&Iuml;");
+							break;
+						case 0xD0:
+							n = sprintf(s, "&ETH;");
+							break;
+						case 0xD1:
+							n = sprintf(s, "&Ntilde;");
+							break;
+						case 0xD2:
+							n = sprintf(s, "&Ograve;");
+							break;
+						case 0xD3:
+							n = sprintf(s, "&Oacute;");
+							break;
+						case 0xD4:
+							n = sprintf(s, "&Ocirc;");
+							break;
+						case 0xD5:
+							n = sprintf(s, "&Otilde;");
+							break;
+						case 0xD6:
+							n = sprintf(s, "&Ouml;");
+							break;
+						case 0xD7:
+							n = sprintf(s, "&times;");
+							break;
+						case 0xD8:
+							n = sprintf(s, "&Oslash;");
+							break;
+						case 0xD9:
+							n = sprintf(s, "&Ugrave;");
+							break;
+						case 0xDA:
+							n = sprintf(s, "&Uacute;");
+							break;
+						case 0xDB:
+							n = sprintf(s, "&Ucirc;");
+							break;
+						case 0xDC:
+							n = sprintf(s, "&Uuml;");
+							break;
+						case 0xDD:
+							n = sprintf(s, "&Yacute;");
+							break;
+						case 0xDE:
+							n = sprintf(s, "&THORN;");
+							break;
+						case 0xDF:
+							n = sprintf(s, "&szlig;");
+							break;
+						case 0xE0:
+							n = sprintf(s, "&agrave;");
+							break;
+						case 0xE1:
+							n = sprintf(s, "&aacute;");
+							break;
+						case 0xE2:
+							n = sprintf(s, "&acirc;");
+							break;
+						case 0xE3:
+							n = sprintf(s, "&atilde;");
+							break;
+						case 0xE4:
+							n = sprintf(s, "&auml;");
+							break;
+						case 0xE5:
+							n = sprintf(s, "&aring;");
+							break;
+						case 0xE6:
+							n = sprintf(s, "&aelig;");
+							break;
+						case 0xE7:
+							n = sprintf(s, "&ccedil;");
+							break;
+						case 0xE8:
+							n = sprintf(s, "&egrave;");
+							break;
+						case 0xE9:
+							n = sprintf(s, "&eacute;");
+							break;
+						case 0xEA:
+							n = sprintf(s, "&ecirc;");
+							break;
+						case 0xEB:
+							n = sprintf(s, "&euml;");
+							break;
+						case 0xEC:
+							n = sprintf(s, "&igrave;");
+							break;
+						case 0xED:
+							n = sprintf(s, "&iacute;");
+							break;
+						case 0xEE:
+							n = sprintf(s, "&icirc;");
+							break;
+						case 0xEF:
+							n = sprintf(s, "&iuml;");
+							break;
+						case 0xF0:
+							n = sprintf(s, "&eth;");
+							break;
+						case 0xF1:
+							n = sprintf(s, "&ntilde;");
+							break;
+						case 0xF2:
+							n = sprintf(s, "&ograve;");
+							break;
+						case 0xF3:
+							n = sprintf(s, "&oacute;");
+							break;
+						case 0xF4:
+							n = sprintf(s, "&ocirc;");
+							break;
+						case 0xF5:
+							n = sprintf(s, "&otilde;");
+							break;
+						case 0xF6:
+							n = sprintf(s, "&ouml;");
+							break;
+						case 0xF7:
+							n = sprintf(s, "&divide;");
+							break;
+						case 0xF8:
+							n = sprintf(s, "&oslash;");
+							break;
+						case 0xF9:
+							n = sprintf(s, "&ugrave;");
+							break;
+						case 0xFA:
+							n = sprintf(s, "&uacute;");
+							break;
+						case 0xFB:
+							n = sprintf(s, "&ucirc;");
+							break;
+						case 0xFC:
+							n = sprintf(s, "&uuml;");
+							break;
+						case 0xFD:
+							n = sprintf(s, "&yacute;");
+							break;
+						case 0xFE:
+							n = sprintf(s, "&thorn;");
+							break;
+						case 0xFF:
+							n = sprintf(s, "&yuml;");
+							break;
+						default:
+							n = sprintf(s,"&#%d;",c);
+					}
+					break;
+				case 2:
+					n = sprintf(s,"&#%d",c); 
+					break;
+				default:
+					n = sprintf(s,"&#x%x",c); /* HTML hex-format */
+			}
+			break;
+
+
+		/* C-style char convertion */
+		case 8: 
+			switch (mode2)
+			{
+				case 1:
+				case 2:
+					switch (c)
+					{
+						case '\n':
+							n = sprintf(s, "\\n");
+							break;
+						case '"':
+							n = sprintf(s, "\\\"");
+							break;
+						case '\'':
+							n = sprintf(s, "\\\'");
+							break;
+						case '%':
+							n = sprintf(s, "%%");
+							break;
+						case '\\' :
+							n = sprintf(s, "\\\\");
+							break;
+						case '\t':
+							n = sprintf(s, "\\t");
+							break;
+						case '\v':
+							n = sprintf(s, "\\v");
+							break;
+						case '\b':
+							n = sprintf(s, "\\b");
+							break;
+						case '\r':
+							n = sprintf(s, "\\r");
+							break;
+						case '\f':
+							n = sprintf(s, "\\f");
+							break;
+						case '\a':
+							n = sprintf(s, "\\a");
+							break;
+						default:
+							if (mode2 == 1)
+								n = sprintf(s,"\\%o",c);
+							else
+								n = sprintf(s, "%c", c);
+					}
+					break;
+				case 3:
+					n = sprintf(s,"\\x%x",c);
+					break;
+				default:
+					n = sprintf(s,"\\%o",c);
+			}
+			break;
+		default:
+			n = sprintf(s,"%02x", c);
+	}
+
+	return n;
+}
+
+/* Escape table of the HTML and C modes: every escape and the bytes that stay as they are */
+static void escape_init(encode_table_t *table)
+{
+	char	s[16];
+	int	c, n;
+
+	table->escape = 1;
+
+	for (c = 0; c < 256; c++)
+	{
+		n = escape_cell(table->mode, table->mode2, c, s);
+
+		memcpy(table->cell[c], s, n);
+		table->len[c] = n;
+
+		if (n != 1 || (unsigned char) s[0] != c)
+			encode_class_add(&table->special, c);
+	}
+}
+
+/*
+ * Fill the table for a fixed-width mode.
+ * Returns 0 if the mode has variable width output and must be converted byte by byte.
+ */
+int encode_table_init(encode_table_t *table, int mode, int mode2)
+{
+	const char	*before, *after;
+	int	c;
+
+	memset(table, 0, sizeof(encode_table_t));
+	table->mode = mode;
+	table->mode2 = mode2;
+	table->width = mode_parts(mode, mode2, &before, &after, &table->skip, &table->lead, &table->trail);
+
+	if (!table->width)
+	{
+		if (mode == 5 || mode == 8)
+			escape_init(table);
+		return 0;
+	}
+
+	table->pair = strlen(before);
+
+	for (c = 0; c < 256; c++)
+	{
+		char	*cell = table->cell[c];
+
+		memcpy(cell, before, strlen(before));
+		cell += strlen(before);
+		memcpy(cell, HEX_PAIR(c), 2);
+		memcpy(cell + 2, after, strlen(after));
+	}
+
+	encode_simd_init(table);
+
+	return table->width;
+}
+
+/* Bytes written per input byte by a fixed-width mode, 0 for the modes of variable width */
+int encode_width(int mode, int mode2)
+{
+	const char	*before, *after, *lead, *trail;
+	int	skip;
+
+	return mode_parts(mode, mode2, &before, &after, &skip, &lead, &trail);
+}
+
+/* Worst-case number of output bytes produced by one input byte */
+size_t encode_max_width(int mode, int mode2)
+{
+	const char	*before, *after, *lead, *trail;
+	int	skip;
+	size_t	width;
+
+	switch (mode)
+	{
+		case 5:	/* &permil; */
+			width = 8;
+			break;
+		case 8:	/* \377 */
+			width = 4;
+			break;
+		default:
+			width = mode_parts(mode, mode2, &before, &after, &skip, &lead, &trail);
+	}
+
+	/* pass-through symbols and "\r\n" never take more than 2 bytes */
+	return (width > 2) ? width : 2;
+}
+
+/* First cell of the stream: the mode prefix and the cell without its leading separator */
+static char *encode_first(const encode_table_t *table, char *out, unsigned char c)
+{
+	size_t	lead_len = strlen(table->lead);
+
+	memcpy(out, table->lead, lead_len);
+	out += lead_len;
+	memcpy(out, table->cell[c] + table->skip, table->width - table->skip);
+
+	return out + table->width - table->skip;
+}
+
+/*
+ * Full cells for every byte, the bulk of the stream. Every cell is stored
+ * with one fixed 8 byte copy, so "out" must have len * width +
+ * ENCODE_SLACK bytes available. Returns the number of bytes written.
+ */
+size_t encode_cells(const encode_table_t *table, char *out, const unsigned char *in, size_t len)
+{
+	char	*p = out;
+	size_t	i;
+	const size_t	w = table->width;
+
+	i = encode_simd(table, p, in, len);
+	p += i * w;
+
+	for (; i + 4 <= len; i += 4)
+	{
+		memcpy(p, table->cell[in[i]], ENCODE_CELL_SIZE);
+		memcpy(p + w, table->cell[in[i+1]], ENCODE_CELL_SIZE);
+		memcpy(p + w*2, table->cell[in[i+2]], ENCODE_CELL_SIZE);
+		memcpy(p + w*3, table->cell[in[i+3]], ENCODE_CELL_SIZE);
+		p += w*4;
+	}
+
+	for (; i < len; i++)
+	{
+		memcpy(p, table->cell[in[i]], ENCODE_CELL_SIZE);
+		p += w;
+	}
+
+	return p - out;
+}
+
+/*
+ * Convert the next chunk of the stream with no include/exclude/new line
+ * filtering, or a run of bytes the filters let through to conversion,
+ * with room as for encode_cells(); *ide tells if the stream has
+ * begun. Wrapped lines are written as they go: the
+ * cells that fit on the line come from encode_cells(), only the cell
+ * crossing the end of the line is copied in two parts.
+ */
+size_t encode_fixed(const encode_table_t *table, char *out, const unsigned char *in, size_t len, int *ide, encode_wrap_t *wrap)
+{
+	char	*p = out, cell[2 * ENCODE_CELL_SIZE];
+	size_t	i = 0, n;
+	const size_t	w = table->width;
+
+	if (!len)
+		return 0;
+
+	if (!*ide)
+	{
+		if (wrap->width)
+			p = encode_wrap_put(wrap, p, cell, encode_first(table, cell, in[i++]) - cell);
+		else
+			p = encode_first(table, p, in[i++]);
+	}
+
+	if (!wrap->width)
+		p += encode_cells(table, p, in + i, len - i);
+
+	while (wrap->width && i < len)
+	{
+		/* fixed 2 byte store: a one character break is followed by its NUL, written over next */
+		if (wrap->col == wrap->width)
+		{
+			memcpy(p, wrap->eol, 2);
+			p += wrap->eol_len;
+			wrap->col = 0;
+		}
+
+		n = (wrap->width - wrap->col) / w;
+		if (n > len - i)
+			n = len - i;
+
+		if (n)
+		{
+			p += encode_cells(table, p, in + i, n);
+			wrap->col += n * w;
+			i += n;
+			continue;
+		}
+
+		/* the cell crossing the end of the line: head, break and tail with fixed size stores */
+		n = wrap->width - wrap->col;
+		if (w - n <= (size_t) wrap->width)
+		{
+			memcpy(cell, table->cell[in[i++]], ENCODE_CELL_SIZE);
+			memcpy(p, cell, ENCODE_CELL_SIZE);
+			memcpy(p + n, wrap->eol, 2);
+			memcpy(p + n + wrap->eol_len, cell + n, ENCODE_CELL_SIZE);
+			p += w + wrap->eol_len;
+			wrap->col = w - n;
+		} else
+			p = encode_wrap_put(wrap, p, table->cell[in[i++]], w);
+	}
+
+	*ide = 1;
+
+	return p - out;
+}
+
+/*
+ * End of the stream: the suffix of the mode, ")" of CHAR(..). As
+ * process() always did, it goes only after a last input byte that was
+ * converted and was not the first one; "close" tells that.
+ */
+char *encode_end(const encode_table_t *table, char *out, int close, encode_wrap_t *wrap)
+{
+	size_t	len = strlen(table->trail);
+
+	if (!close || !len)
+		return out;
+
+	if (wrap->width)
+		return encode_wrap_put(wrap, out, table->trail, len);
+
+	memcpy(out, table->trail, len);
+
+	return out + len;
+}
+
+/*
+ * Convert the next chunk of the HTML and C modes with no include/exclude/new
+ * line filtering, or a run the filters let through, with room as for encode_cells() at the widest escape.
+ * The runs of bytes that stay as they are (-cc) are found by
+ * encode_class_span() and copied whole, only the special bytes are looked
+ * up in the table. No escaping mode lets a new line through, so the lines
+ * are wrapped by counting alone.
+ */
+size_t encode_escapes(const encode_table_t *table, char *out, const unsigned char *in, size_t len, encode_wrap_t *wrap)
+{
+	char	*p = out;
+	size_t	i = 0, run;
+
+	while (i < len)
+	{
+		run = encode_class_span(&table->special, in + i, len - i);
+
+		if (wrap->width)
+			p = encode_wrap_put(wrap, p, (const char *) in + i, run);
+		else
+		{
+			memcpy(p, in + i, run);
+			p += run;
+		}
+
+		/* the special bytes come in clusters, in -xe and -cf they are all there is */
+		for (i += run; i < len && ENCODE_CLASS_HAS(&table->special, in[i]); i++)
+		{
+			if (wrap->width)
+				p = encode_wrap_put(wrap, p, table->cell[in[i]], table->len[in[i]]);
+			else
+			{
+				memcpy(p, table->cell[in[i]], ENCODE_CELL_SIZE);
+				p += table->len[in[i]];
+			}
+		}
+	}
+
+	return p - out;
+}
+
+/* Add the byte "c" to the set */
+void encode_class_add(encode_class_t *cls, unsigned char c)
+{
+	cls->bits[c >> 3] |= 1 << (c & 7);
+	cls->lo[c >> 7][c & 15] |= 1 << ((c >> 4) & 7);
+}
+
+/* Copy "s" to the output, breaking the line wherever it gets full */
+char *encode_wrap_put(encode_wrap_t *wrap, char *out, const char *s, size_t len)
+{
+	size_t	n;
+
+	while (len)
+	{
+		if (wrap->col == wrap->width)
+		{
+			memcpy(out, wrap->eol, wrap->eol_len);
+			out += wrap->eol_len;
+			wrap->col = 0;
+		}
+
+		n = wrap->width - wrap->col;
+		if (n > len)
+			n = len;
+
+		memcpy(out, s, n);
+		out += n;
+		s += n;
+		len -= n;
+		wrap->col += n;
+	}
+
+	return out;
+}
+
+/* encode_wrap_put() for text that may hold new lines, which start a line of their own */
+char *encode_wrap_text(encode_wrap_t *wrap, char *out, const char *s, size_t len)
+{
+	const char	*nl;
+
+	while ((nl = memchr(s, '\n', len)))
+	{
+		out = encode_wrap_put(wrap, out, s, nl + 1 - s);
+		wrap->col = 0;
+		len -= nl + 1 - s;
+		s = nl + 1;
+	}
+
+	return encode_wrap_put(wrap, out, s, len);
+}
+
+/*
+ * Breaks in a line of "m" characters begun at column "c0": the k-th
+ * character gets one before it when c0 + k is a positive multiple of the
+ * width.
+ */
+static size_t wrap_breaks(size_t width, size_t c0, size_t m)
+{
+	if (!m)
+		return 0;
+
+	return (c0 + m - 1) / width - (c0 ? (c0 - 1) / width : 0);
+}
+
+/*
+ * Break "len" characters already written at "s" in place, for output of
+ * no fixed width; there must be room for the breaks after them. New lines
+ * in the output start a line of their own. The breaks are counted line by
+ * line first, then every line is moved once to its place from the end
+ * back, a line length at a time. Returns the new length.
+ */
+size_t encode_wrap_fix(encode_wrap_t *wrap, char *s, size_t len)
+{
+	const size_t	w = wrap->width, e = wrap->eol_len, col = wrap->col;
+	size_t	start, end, c0, k, j, piece, total = 0;
+	const char	*nl;
+	char	*dst;
+
+	/* the breaks of every line, and the column the last one ends at */
+	for (start = 0; start < len; start = end)
+	{
+		nl = memchr(s + start, '\n', len - start);
+		end = nl ? (size_t) (nl - s) + 1 : len;
+		c0 = start ? 0 : col;
+		total += wrap_breaks(w, c0, end - start);
+		wrap->col = nl ? 0 : (c0 + end - start - 1) % w + 1;
+	}
+
+	if (!total)
+		return len;
+
+	/* from the last line back: the piece after every break, the break, and the piece before the first */
+	dst = s + len + total * e;
+
+	for (end = len; end; end = start)
+	{
+		for (start = end - 1; start && s[start - 1] != '\n'; start--);
+		c0 = start ? 0 : col;
+		piece = end - start;
+
+		for (j = (c0 + piece - 1) / w; j && j * w >= c0; j--)
+		{
+			k = j * w - c0;
+			dst -= piece - k;
+			memmove(dst, s + start + k, piece - k);
+			dst -= e;
+			memcpy(dst, wrap->eol, e);
+			piece = k;
+		}
+
+		dst -= piece;
+		memmove(dst, s + start, piece);
+	}
+
+	return len + total * e;
+}
+
+/* Convert the single byte "c" of the stream */
+char *encode_put(const encode_table_t *table, char *out, unsigned char c, int *ide)
+{
+	if (!*ide)
+		out = encode_first(table, out, c);
+	else
+	{
+		memcpy(out, table->cell[c], ENCODE_CELL_SIZE);
+		out += table->width;
+	}
+
+	*ide = 1;
+
+	return out;
+}
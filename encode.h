@@ -0,0 +1,85 @@
+#ifndef __ENCODE_H
+#define __ENCODE_H
+
+#include <stddef.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD
+#endif
+
+#define ENCODE_CELL_SIZE	8	/* every table cell is padded to 8 bytes */
+#define ENCODE_SLACK		16	/* extra output room for prefixes, suffixes and the 8-byte cell stores */
+
+/* "000102...feff": two lower-case hex digits for every byte value */
+extern const char hex_pairs[513];
+
+/* instruction sets of the vector kernels */
+#define ENCODE_SIMD_NONE	0
+#define ENCODE_SIMD_SSSE3	1
+#define ENCODE_SIMD_AVX2	2
+#define ENCODE_SIMD_AVX512	3
+
+#define HEX_PAIR(c)	(hex_pairs + ((unsigned char)(c) << 1))
+
+/* A set of byte values, with the nibble tables of its vector test */
+typedef struct {
+	unsigned char	bits[32];		/* bit c & 7 of bits[c >> 3]: c is in the set */
+	unsigned char	lo[2][16];		/* by low nibble: bit h & 7 for the high nibbles h of 0-7 ([0]) and 8-15 ([1]) */
+} encode_class_t;
+
+#define ENCODE_CLASS_HAS(cls, c)	((cls)->bits[(unsigned char)(c) >> 3] & (1 << ((c) & 7)))
+
+/* Precomputed output of one fixed-width or escaping convertion mode. */
+typedef struct {
+	int	mode;
+	int	mode2;
+	int	width;					/* bytes written per input byte (0 - variable width mode) */
+	int	skip;					/* separator bytes dropped from the first cell of the stream */
+	int	pair;					/* offset of the hex pair inside the cell */
+	const char	*lead;			/* written once before the very first cell */
+	const char	*trail;			/* written once after the last cell */
+	char	cell[256][ENCODE_CELL_SIZE];	/* output cell for every byte value */
+
+	int	escape;					/* HTML and C modes: "cell" holds the escape of every byte, "len" its length */
+	unsigned char	len[256];
+	encode_class_t	special;		/* the bytes not written as they are */
+
+	int	simd;					/* vector kernel in use, ENCODE_SIMD_* */
+	unsigned char	simd_h[16 * ENCODE_CELL_SIZE];	/* SSSE3/AVX2 shuffles of the high digits */
+	unsigned char	simd_l[16 * ENCODE_CELL_SIZE];	/* SSSE3/AVX2 shuffles of the low digits */
+	unsigned char	simd_idx[64 * ENCODE_CELL_SIZE];	/* AVX-512 VBMI two-source permutes */
+	char	simd_tpl[64 * ENCODE_CELL_SIZE];	/* constant bytes of the cells */
+	unsigned long long	simd_k[ENCODE_CELL_SIZE];	/* AVX-512 template blend masks */
+} encode_table_t;
+
+/* Line wrapping of the output: a break goes in after every "width" characters that more output follows */
+typedef struct {
+	int	width;					/* line length, 0 - no wrapping */
+	const char	*eol;				/* 1 or 2 characters */
+	int	eol_len;
+	int	col;					/* characters on the current line */
+} encode_wrap_t;
+
+int encode_table_init(encode_table_t *table, int mode, int mode2);
+int encode_width(int mode, int mode2);
+size_t encode_max_width(int mode, int mode2);
+
+size_t encode_fixed(const encode_table_t *table, char *out, const unsigned char *in, size_t len, int *ide, encode_wrap_t *wrap);
+size_t encode_cells(const encode_table_t *table, char *out, const unsigned char *in, size_t len);
+char *encode_put(const encode_table_t *table, char *out, unsigned char c, int *ide);
+char *encode_end(const encode_table_t *table, char *out, int close, encode_wrap_t *wrap);
+size_t encode_escapes(const encode_table_t *table, char *out, const unsigned char *in, size_t len, encode_wrap_t *wrap);
+
+void encode_class_add(encode_class_t *cls, unsigned char c);
+size_t encode_class_span(const encode_class_t *cls, const unsigned char *in, size_t len);
+
+int encode_simd_level(void);
+void encode_simd_limit(int level);
+void encode_simd_init(encode_table_t *table);
+size_t encode_simd(const encode_table_t *table, char *out, const unsigned char *in, size_t len);
+
+char *encode_wrap_put(encode_wrap_t *wrap, char *out, const char *s, size_t len);
+char *encode_wrap_text(encode_wrap_t *wrap, char *out, const char *s, size_t len);
+size_t encode_wrap_fix(encode_wrap_t *wrap, char *s, size_t len);
+
+#endif
@@ -0,0 +1,376 @@
+/*
+ * encode_simd.c
+ * This file is part of str2hex project.
+ *
+ * Copyright 2005 Dzmitry Plashchynski <plashchynski@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Vector kernels for the fixed-width modes.
+ *
+ * Every input byte is split into its high and low nibble and both are
+ * turned into hex digits with one shuffle over "0123456789abcdef". The
+ * output cells are then assembled with a second shuffle that picks the
+ * digits for each output position, and the constant bytes of the cell
+ * ("%", ", 0x", "h"...) are merged in from a template. The shuffle masks
+ * and the template depend only on the cell layout, so they are built once
+ * by encode_simd_init() and one kernel serves every fixed-width mode.
+ *
+ * The escaping modes use the class test at the end of the file to find
+ * the next byte that needs an escape.
+ */
+
+#include <string.h>
+#include "encode.h"
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+static int	simd_limit = ENCODE_SIMD_AVX512;
+
+/* Use no instruction set above "level" from now on, so the tests can run every kernel on one CPU */
+void encode_simd_limit(int level)
+{
+	simd_limit = level;
+}
+
+/* Best instruction set of this CPU, selected once at run time */
+int encode_simd_level(void)
+{
+#ifdef HAVE_X86_SIMD
+	static int	level = -1;
+
+	if (level < 0)
+	{
+		__builtin_cpu_init();
+
+		if (__builtin_cpu_supports("avx512vbmi") && __builtin_cpu_supports("avx512bw"))
+			level = ENCODE_SIMD_AVX512;
+		else if (__builtin_cpu_supports("avx2"))
+			level = ENCODE_SIMD_AVX2;
+		else if (__builtin_cpu_supports("ssse3"))
+			level = ENCODE_SIMD_SSSE3;
+		else
+			level = ENCODE_SIMD_NONE;
+	}
+
+	return (level < simd_limit) ? level : simd_limit;
+#else
+	return ENCODE_SIMD_NONE;
+#endif
+}
+
+/*
+ * Describe where every output byte of a 64 input byte block comes from.
+ * Output byte k belongs to input byte k / width; it is either the high
+ * digit, the low digit or a constant byte of the cell.
+ */
+void encode_simd_init(encode_table_t *table)
+{
+	int	k, w = table->width;
+	int	hi = table->pair;
+
+	table->simd = ENCODE_SIMD_NONE;
+
+	if (!w || w > ENCODE_CELL_SIZE)
+		return;
+
+	memset(table->simd_k, 0, sizeof(table->simd_k));
+
+	for (k = 0; k < 64 * w; k++)
+	{
+		int	n = k / w, r = k % w;
+
+		if (r == hi || r == hi + 1)
+		{
+			table->simd_tpl[k] = 0;
+			table->simd_idx[k] = (r == hi) ? n : 64 + n;
+		} else
+		{
+			table->simd_tpl[k] = table->cell[0][r];
+			table->simd_idx[k] = 0;
+			table->simd_k[k / 64] |= 1ULL << (k % 64);
+		}
+
+		if (k < 16 * w)
+		{
+			table->simd_h[k] = (r == hi) ? n : 0x80;
+			table->simd_l[k] = (r == hi + 1) ? n : 0x80;
+		}
+	}
+
+	table->simd = encode_simd_level();
+}
+
+#ifdef HAVE_X86_SIMD
+
+static const char	hex_digits[16] = "0123456789abcdef";
+
+__attribute__((target("ssse3")))
+static size_t encode_ssse3(const encode_table_t *table, char *out, const unsigned char *in, size_t len)
+{
+	const __m128i	digits = _mm_loadu_si128((const __m128i *) hex_digits);
+	const __m128i	nibble = _mm_set1_epi8(0x0f);
+	const int	w = table->width;
+	size_t	i;
+	int	v;
+
+	for (i = 0; i + 16 <= len; i += 16)
+	{
+		__m128i	x = _mm_loadu_si128((const __m128i *) (in + i));
+		__m128i	h = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(x, 4), nibble));
+		__m128i	l = _mm_shuffle_epi8(digits, _mm_and_si128(x, nibble));
+
+		if (w == 2)
+		{
+			_mm_storeu_si128((__m128i *) out, _mm_unpacklo_epi8(h, l));
+			_mm_storeu_si128((__m128i *) (out + 16), _mm_unpackhi_epi8(h, l));
+			out += 32;
+			continue;
+		}
+
+		for (v = 0; v < w; v++)
+		{
+			__m128i	o = _mm_or_si128(
+				_mm_shuffle_epi8(h, _mm_loadu_si128((const __m128i *) (table->simd_h + 16*v))),
+				_mm_shuffle_epi8(l, _mm_loadu_si128((const __m128i *) (table->simd_l + 16*v))));
+
+			o = _mm_or_si128(o, _mm_loadu_si128((const __m128i *) (table->simd_tpl + 16*v)));
+			_mm_storeu_si128((__m128i *) out, o);
+			out += 16;
+		}
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t encode_avx2(const encode_table_t *table, char *out, const unsigned char *in, size_t len)
+{
+	const __m256i	digits = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) hex_digits));
+	const __m256i	nibble = _mm256_set1_epi8(0x0f);
+	const int	w = table->width;
+	size_t	i = 0;
+	int	v;
+
+	/* plain pairs: 32 input bytes per iteration, the lane split is undone by the final permute */
+	if (w == 2)
+	{
+		for (; i + 32 <= len; i += 32)
+		{
+			__m256i	x = _mm256_loadu_si256((const __m256i *) (in + i));
+			__m256i	h = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble));
+			__m256i	l = _mm256_shuffle_epi8(digits, _mm256_and_si256(x, nibble));
+			__m256i	lo = _mm256_unpacklo_epi8(h, l), hi = _mm256_unpackhi_epi8(h, l);
+
+			_mm256_storeu_si256((__m256i *) out, _mm256_permute2x128_si256(lo, hi, 0x20));
+			_mm256_storeu_si256((__m256i *) (out + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+			out += 64;
+		}
+
+		return i;
+	}
+
+	/* wider cells: 16 input bytes in both lanes, so every shuffle can reach all of them */
+	for (; i + 16 <= len; i += 16)
+	{
+		__m256i	x = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) (in + i)));
+		__m256i	h = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble));
+		__m256i	l = _mm256_shuffle_epi8(digits, _mm256_and_si256(x, nibble));
+
+		for (v = 0; v + 2 <= w; v += 2)
+		{
+			__m256i	o = _mm256_or_si256(
+				_mm256_shuffle_epi8(h, _mm256_loadu_si256((const __m256i *) (table->simd_h + 16*v))),
+				_mm256_shuffle_epi8(l, _mm256_loadu_si256((const __m256i *) (table->simd_l + 16*v))));
+
+			o = _mm256_or_si256(o, _mm256_loadu_si256((const __m256i *) (table->simd_tpl + 16*v)));
+			_mm256_storeu_si256((__m256i *) out, o);
+			out += 32;
+		}
+
+		if (v < w)
+		{
+			__m128i	o = _mm_or_si128(
+				_mm_shuffle_epi8(_mm256_castsi256_si128(h), _mm_loadu_si128((const __m128i *) (table->simd_h + 16*v))),
+				_mm_shuffle_epi8(_mm256_castsi256_si128(l), _mm_loadu_si128((const __m128i *) (table->simd_l + 16*v))));
+
+			o = _mm_or_si128(o, _mm_loadu_si128((const __m128i *) (table->simd_tpl + 16*v)));
+			_mm_storeu_si128((__m128i *) out, o);
+			out += 16;
+		}
+	}
+
+	return i;
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+static size_t encode_avx512(const encode_table_t *table, char *out, const unsigned char *in, size_t len)
+{
+	const __m512i	digits = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *) hex_digits));
+	const __m512i	nibble = _mm512_set1_epi8(0x0f);
+	const int	w = table->width;
+	size_t	i;
+	int	v;
+
+	for (i = 0; i + 64 <= len; i += 64)
+	{
+		__m512i	x = _mm512_loadu_si512((const void *) (in + i));
+		__m512i	h = _mm512_shuffle_epi8(digits, _mm512_and_si512(_mm512_srli_epi16(x, 4), nibble));
+		__m512i	l = _mm512_shuffle_epi8(digits, _mm512_and_si512(x, nibble));
+
+		for (v = 0; v < w; v++)
+		{
+			__m512i	o = _mm512_permutex2var_epi8(h,
+				_mm512_loadu_si512((const void *) (table->simd_idx + 64*v)), l);
+
+			o = _mm512_mask_blend_epi8(table->simd_k[v], o,
+				_mm512_loadu_si512((const void *) (table->simd_tpl + 64*v)));
+			_mm512_storeu_si512((void *) out, o);
+			out += 64;
+		}
+	}
+
+	return i;
+}
+
+#endif
+
+/*
+ * Convert the longest prefix of "in" the vector unit can handle.
+ * Every input byte is written as one full cell (separator included).
+ * Returns the number of input bytes consumed.
+ */
+size_t encode_simd(const encode_table_t *table, char *out, const unsigned char *in, size_t len)
+{
+#ifdef HAVE_X86_SIMD
+	switch (table->simd)
+	{
+		case ENCODE_SIMD_AVX512:
+			return encode_avx512(table, out, in, len);
+		case ENCODE_SIMD_AVX2:
+			return encode_avx2(table, out, in, len);
+		case ENCODE_SIMD_SSSE3:
+			return encode_ssse3(table, out, in, len);
+	}
+#endif
+	return 0;
+}
+
+/*
+ * Class test for the sets of encode_class_t: byte x is in the set when the
+ * bit of its high nibble is set in the row of its low nibble. A shuffle
+ * with the top bit of the index set gives 0, so x picks its row from
+ * lo[0] and x ^ 0x80 from lo[1], and only one of them is not zero.
+ */
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("ssse3")))
+static size_t class_span_ssse3(const encode_class_t *cls, const unsigned char *in, size_t len)
+{
+	const __m128i	lo0 = _mm_loadu_si128((const __m128i *) cls->lo[0]);
+	const __m128i	lo1 = _mm_loadu_si128((const __m128i *) cls->lo[1]);
+	const __m128i	bit = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+	const __m128i	top = _mm_set1_epi8(-128), nibble = _mm_set1_epi8(0x0f);
+	size_t	i;
+
+	for (i = 0; i + 16 <= len; i += 16)
+	{
+		__m128i	x = _mm_loadu_si128((const __m128i *) (in + i));
+		__m128i	row = _mm_or_si128(_mm_shuffle_epi8(lo0, x), _mm_shuffle_epi8(lo1, _mm_xor_si128(x, top)));
+		__m128i	b = _mm_shuffle_epi8(bit, _mm_and_si128(_mm_srli_epi16(x, 4), nibble));
+		unsigned	m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(row, b), _mm_setzero_si128())) ^ 0xffff;
+
+		if (m)
+			return i + __builtin_ctz(m);
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t class_span_avx2(const encode_class_t *cls, const unsigned char *in, size_t len)
+{
+	const __m256i	lo0 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) cls->lo[0]));
+	const __m256i	lo1 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) cls->lo[1]));
+	const __m256i	bit = _mm256_broadcastsi128_si256(_mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128));
+	const __m256i	top = _mm256_set1_epi8(-128), nibble = _mm256_set1_epi8(0x0f);
+	size_t	i;
+
+	for (i = 0; i + 32 <= len; i += 32)
+	{
+		__m256i	x = _mm256_loadu_si256((const __m256i *) (in + i));
+		__m256i	row = _mm256_or_si256(_mm256_shuffle_epi8(lo0, x), _mm256_shuffle_epi8(lo1, _mm256_xor_si256(x, top)));
+		__m256i	b = _mm256_shuffle_epi8(bit, _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble));
+		unsigned	m = ~(unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(row, b), _mm256_setzero_si256()));
+
+		if (m)
+			return i + __builtin_ctz(m);
+	}
+
+	return i;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t class_span_avx512(const encode_class_t *cls, const unsigned char *in, size_t len)
+{
+	const __m512i	lo0 = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *) cls->lo[0]));
+	const __m512i	lo1 = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *) cls->lo[1]));
+	const __m512i	bit = _mm512_broadcast_i32x4(_mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128));
+	const __m512i	top = _mm512_set1_epi8(-128), nibble = _mm512_set1_epi8(0x0f);
+	size_t	i;
+
+	for (i = 0; i + 64 <= len; i += 64)
+	{
+		__m512i	x = _mm512_loadu_si512((const void *) (in + i));
+		__m512i	row = _mm512_or_si512(_mm512_shuffle_epi8(lo0, x), _mm512_shuffle_epi8(lo1, _mm512_xor_si512(x, top)));
+		__m512i	b = _mm512_shuffle_epi8(bit, _mm512_and_si512(_mm512_srli_epi16(x, 4), nibble));
+		unsigned long long	m = _mm512_test_epi8_mask(row, b);
+
+		if (m)
+			return i + __builtin_ctzll(m);
+	}
+
+	return i;
+}
+
+#endif
+
+/* Number of bytes before the first byte of "in" in the set "cls", "len" if there is none */
+size_t encode_class_span(const encode_class_t *cls, const unsigned char *in, size_t len)
+{
+	size_t	i = 0;
+
+#ifdef HAVE_X86_SIMD
+	switch (encode_simd_level())
+	{
+		case ENCODE_SIMD_AVX512:
+			i = class_span_avx512(cls, in, len);
+			break;
+		case ENCODE_SIMD_AVX2:
+			i = class_span_avx2(cls, in, len);
+			break;
+		case ENCODE_SIMD_SSSE3:
+			i = class_span_ssse3(cls, in, len);
+			break;
+	}
+#endif
+
+	while (i < len && !ENCODE_CLASS_HAS(cls, in[i]))
+		i++;
+
+	return i;
+}
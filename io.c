@@ -0,0 +1,514 @@
+/*
+ * io.c
+ * This file is part of str2hex project.
+ *
+ * Copyright 2005 Dzmitry Plashchynski <plashchynski@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Plain read()/writev() I/O.
+ *
+ * Small writes are collected in one buffer; a write that does not fit is
+ * sent together with the buffered bytes by a single writev(), so large
+ * encoder outputs are never copied.
+ *
+ * Encoders may also convert straight into the buffer: io_reserve() makes
+ * room for their worst case and io_commit() takes what they wrote.
+ *
+ * With -io uring the writer keeps IO_ASYNC buffers: one is being filled
+ * while the others are written by the kernel. Regular files get every
+ * buffer in flight at its own offset; pipes, terminals and O_APPEND
+ * files get one write at a time, so the order is kept.
+ */
+
+#ifndef WIN32
+#define _GNU_SOURCE			/* F_SETPIPE_SZ */
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef WIN32
+#include <unistd.h>
+#include <sys/uio.h>
+#else
+#include <io.h>
+struct iovec {
+	void	*iov_base;
+	size_t	iov_len;
+};
+#endif
+
+#include "main.h"
+#include "io.h"
+#include "uring.h"
+#include "pool.h"
+
+#ifdef HAVE_URING
+
+#define SLOT_FREE	0
+#define SLOT_FULL	1		/* waiting to be written */
+#define SLOT_BUSY	2		/* write in flight */
+
+typedef struct {
+	uring_t	ring;
+	char	*buf[IO_ASYNC];
+	size_t	len[IO_ASYNC];
+	size_t	done[IO_ASYNC];		/* bytes written so far */
+	unsigned long long	pos[IO_ASYNC];
+	int	state[IO_ASYNC];
+	int	cur;				/* slot being filled */
+	int	head;				/* oldest slot not yet written */
+	int	pending;			/* slots from head on handed to the kernel */
+	long long	offset;			/* file offset of the next buffer, -1 - write in order */
+} io_async_t;
+
+#endif
+
+void io_out_init(io_out_t *out, int fd, size_t bufsize)
+{
+	memset(out, 0, sizeof(io_out_t));
+	out->fd = fd;
+	out->size = bufsize;
+	out->buf = pool_get(out->size);
+}
+
+/*
+ * Switch the output to io_uring writes. Returns -1, leaving plain writes
+ * in place, if the kernel can't do it.
+ */
+int io_out_async(io_out_t *out)
+{
+#ifdef HAVE_URING
+	io_async_t	*a;
+	struct stat	st;
+	int	i;
+
+	if (out->fd < 0 || out->async || !(a = calloc(1, sizeof(io_async_t))))
+		return -1;
+
+	if (uring_init(&a->ring, 2 * IO_ASYNC))
+	{
+		free(a);
+		return -1;
+	}
+
+	/* positioned writes only where the position means something */
+	a->offset = -1;
+	if (!fstat(out->fd, &st) && S_ISREG(st.st_mode) && !(fcntl(out->fd, F_GETFL) & O_APPEND))
+		a->offset = lseek(out->fd, 0, SEEK_CUR);
+
+	a->buf[0] = out->buf;
+	for (i = 1; i < IO_ASYNC; i++)
+		a->buf[i] = pool_get(out->size);
+
+	out->async = a;
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+#ifdef HAVE_URING
+
+/* Queue writes for the full slots, submit, and collect what the kernel finished */
+static void io_async_pump(io_out_t *out, int wait)
+{
+	io_async_t	*a = out->async;
+	struct io_uring_cqe	cqe;
+	int	i, s, busy = 0;
+
+	for (i = 0; i < IO_ASYNC; i++)
+		busy += (a->state[i] == SLOT_BUSY);
+
+	/* oldest first; without positions one write at a time keeps the order */
+	for (i = 0; i < a->pending; i++)
+	{
+		s = (a->head + i) % IO_ASYNC;
+
+		if (a->state[s] != SLOT_FULL || (a->offset < 0 && busy))
+			continue;
+
+		/* the ring has room for a write of every slot */
+		if (!uring_sqe(&a->ring, IORING_OP_WRITE, out->fd, a->buf[s] + a->done[s], a->len[s] - a->done[s],
+			(a->offset < 0) ? (unsigned long long) -1 : a->pos[s] + a->done[s], s))
+		{
+			out->error = 1;
+			break;
+		}
+		a->state[s] = SLOT_BUSY;
+		busy++;
+	}
+
+	if (uring_submit(&a->ring, wait && busy) < 0)
+		out->error = 1;
+
+	while (uring_reap(&a->ring, &cqe))
+	{
+		s = cqe.user_data;
+
+		if (cqe.res < 0 && cqe.res != -EINTR && cqe.res != -EAGAIN)
+			out->error = 1;
+		else if (cqe.res > 0)
+			a->done[s] += cqe.res;
+
+		/* a short write goes again from where it stopped */
+		a->state[s] = (out->error || a->done[s] == a->len[s]) ? SLOT_FREE : SLOT_FULL;
+	}
+
+	while (a->pending && a->state[a->head] == SLOT_FREE)
+	{
+		a->head = (a->head + 1) % IO_ASYNC;
+		a->pending--;
+	}
+}
+
+/* Hand the filled buffer to the kernel and continue in the next free one */
+static void io_async_send(io_out_t *out)
+{
+	io_async_t	*a = out->async;
+	int	s = a->cur;
+
+	a->len[s] = out->len;
+	a->done[s] = 0;
+	a->state[s] = SLOT_FULL;
+
+	if (a->offset >= 0)
+	{
+		a->pos[s] = a->offset;
+		a->offset += out->len;
+	}
+
+	a->cur = (s + 1) % IO_ASYNC;
+	a->pending++;
+	io_async_pump(out, 0);
+
+	while (a->state[a->cur] != SLOT_FREE && !out->error)
+		io_async_pump(out, 1);
+
+	out->buf = a->buf[a->cur];
+	out->len = 0;
+}
+
+/* Let the kernel finish every buffer, then make all of them "size" bytes */
+static void io_async_grow(io_out_t *out, size_t size)
+{
+	io_async_t	*a = out->async;
+	int	i;
+
+	while (a->pending && !out->error)
+		io_async_pump(out, 1);
+
+	for (i = 0; i < IO_ASYNC; i++)
+		a->buf[i] = pool_grow(a->buf[i], 0, size);
+
+	out->buf = a->buf[a->cur];
+	out->size = size;
+}
+
+static void io_async_write(io_out_t *out, const char *data, size_t len)
+{
+	size_t	n;
+
+	while (len && !out->error)
+	{
+		n = out->size - out->len;
+		if (n > len)
+			n = len;
+
+		memcpy(out->buf + out->len, data, n);
+		out->len += n;
+		data += n;
+		len -= n;
+
+		if (out->len == out->size)
+			io_async_send(out);
+	}
+}
+
+#endif
+
+/* Write every iovec completely */
+static int io_writev_all(int fd, struct iovec *iov, int cnt)
+{
+	long	n;
+
+	while (cnt)
+	{
+#ifndef WIN32
+		n = writev(fd, iov, cnt);
+#else
+		n = write(fd, iov->iov_base, iov->iov_len);
+#endif
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		while (cnt && (size_t) n >= iov->iov_len)
+		{
+			n -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+
+		if (cnt)
+		{
+			iov->iov_base = (char *) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	return 0;
+}
+
+/* Make room for "len" more bytes in memory mode */
+static void io_grow(io_out_t *out, size_t len)
+{
+	if (out->len + len <= out->size)
+		return;
+
+	while (out->len + len > out->size)
+		out->size *= 2;
+
+	out->buf = pool_grow(out->buf, out->len, out->size);
+	out->size = pool_size(out->buf);
+}
+
+void io_write(io_out_t *out, const char *data, size_t len)
+{
+	struct iovec	iov[2];
+
+	if (!len || out->error)
+		return;
+
+#ifdef HAVE_URING
+	if (out->async)
+	{
+		io_async_write(out, data, len);
+		return;
+	}
+#endif
+
+	if (out->fd < 0)
+		io_grow(out, len);
+
+	if (out->len + len <= out->size)
+	{
+		memcpy(out->buf + out->len, data, len);
+		out->len += len;
+		return;
+	}
+
+	iov[0].iov_base = out->buf;
+	iov[0].iov_len = out->len;
+	iov[1].iov_base = (char *) data;
+	iov[1].iov_len = len;
+
+	if (io_writev_all(out->fd, iov, 2))
+		out->error = 1;
+
+	out->len = 0;
+}
+
+void io_puts(io_out_t *out, const char *s)
+{
+	io_write(out, s, strlen(s));
+}
+
+/*
+ * Room for "len" bytes at the end of the buffer, for an encoder to write
+ * into directly. The buffered bytes are sent first when they leave too
+ * little room, and the buffer grows if it is smaller than "len".
+ */
+char *io_reserve(io_out_t *out, size_t len)
+{
+	if (out->len + len <= out->size)
+		return out->buf + out->len;
+
+	if (out->fd < 0)
+	{
+		io_grow(out, len);
+		return out->buf + out->len;
+	}
+
+#ifdef HAVE_URING
+	if (out->async)
+	{
+		if (out->len)
+			io_async_send(out);
+		if (len > out->size)
+			io_async_grow(out, len);
+		return out->buf;
+	}
+#endif
+
+	io_flush(out);
+
+	if (len > out->size)
+	{
+		out->buf = pool_grow(out->buf, 0, len);
+		out->size = len;
+	}
+
+	return out->buf;
+}
+
+/* Take "len" bytes written at io_reserve() */
+void io_commit(io_out_t *out, size_t len)
+{
+	if (!out->error)
+		out->len += len;
+
+#ifdef HAVE_URING
+	if (out->async && out->len == out->size)
+		io_async_send(out);
+#endif
+}
+
+/* Send the buffered bytes. Returns -1 if any write failed. */
+int io_flush(io_out_t *out)
+{
+	struct iovec	iov;
+
+#ifdef HAVE_URING
+	if (out->async)
+	{
+		io_async_t	*a = out->async;
+
+		if (out->len && !out->error)
+			io_async_send(out);
+
+		while (a->pending && !out->error)
+			io_async_pump(out, 1);
+
+		/* the file position was never moved by the positioned writes */
+		if (a->offset >= 0)
+			lseek(out->fd, a->offset, SEEK_SET);
+
+		return out->error ? -1 : 0;
+	}
+#endif
+
+	if (out->fd >= 0 && out->len && !out->error)
+	{
+		iov.iov_base = out->buf;
+		iov.iov_len = out->len;
+
+		if (io_writev_all(out->fd, &iov, 1))
+			out->error = 1;
+	}
+
+	if (out->fd >= 0)
+		out->len = 0;
+
+	return out->error ? -1 : 0;
+}
+
+/* Memory mode: hand the collected output over to the caller, who gives it back with pool_put() */
+char *io_release(io_out_t *out, size_t *len)
+{
+	char	*buf = out->buf;
+
+	*len = out->len;
+	out->buf = NULL;
+	out->len = out->size = 0;
+
+	return buf;
+}
+
+void io_out_free(io_out_t *out)
+{
+#ifdef HAVE_URING
+	if (out->async)
+	{
+		io_async_t	*a = out->async;
+		int	i;
+
+		for (i = 0; i < IO_ASYNC; i++)
+			pool_put(a->buf[i]);
+
+		uring_exit(&a->ring);
+		free(a);
+		out->async = NULL;
+		out->buf = NULL;
+		return;
+	}
+#endif
+
+	pool_put(out->buf);
+	out->buf = NULL;
+}
+
+/* read() that retries on signals. Returns 0 at the end of the input, -1 on error. */
+long io_read(int fd, void *buf, size_t len)
+{
+	long	n;
+
+	do
+		n = read(fd, buf, len);
+	while (n < 0 && errno == EINTR);
+
+	return n;
+}
+
+/* Let a pipe hold a whole buffer, so both ends move in large steps */
+void io_pipe_size(int fd, size_t size)
+{
+#ifdef F_SETPIPE_SZ
+	struct stat	st;
+
+	if (!fstat(fd, &st) && S_ISFIFO(st.st_mode) && fcntl(fd, F_GETPIPE_SZ) < (long) size)
+		fcntl(fd, F_SETPIPE_SZ, (int) size);	/* limited by /proc/sys/fs/pipe-max-size, best effort */
+#endif
+}
+
+/* "4096", "64k", "4M", "1G". Returns 0 on a bad value. */
+size_t io_parse_size(const char *s)
+{
+	char	*end;
+	unsigned long long	n = strtoull(s, &end, 10);
+
+	/* every step checks for the overflow first: 99999999999G must not wrap to a small size */
+	switch (*end)
+	{
+		case 'g': case 'G':
+			if (n > ((size_t) -1 >> 10))
+				return 0;
+			n <<= 10;
+			/* fall through */
+		case 'm': case 'M':
+			if (n > ((size_t) -1 >> 10))
+				return 0;
+			n <<= 10;
+			/* fall through */
+		case 'k': case 'K':
+			if (n > ((size_t) -1 >> 10))
+				return 0;
+			n <<= 10;
+			end++;
+	}
+
+	if (*end || n > ((size_t) -1 >> 1))
+		return 0;
+
+	return n;
+}
@@ -0,0 +1,46 @@
+#ifndef __IO_H
+#define __IO_H
+
+#include <stddef.h>
+
+#define IO_DEF_BUFSIZE	(256 * 1024)	/* read and write buffer size */
+#define IO_ASYNC	4		/* buffers in flight on the io_uring reader and writer */
+
+/* input backends, -io */
+#define IO_AUTO		0		/* mmap for regular files, read() for the rest */
+#define IO_READ		1
+#define IO_MMAP		2
+#define IO_URING	3
+#define IO_PIPELINE	4		/* read() on reader, encoder and writer threads */
+
+#ifdef WIN32
+#define IO_EOL	"\r\n"
+#else
+#define IO_EOL	"\n"
+#endif
+
+/* Buffered output to a file descriptor, or into memory when fd is -1 */
+typedef struct {
+	int	fd;
+	char	*buf;
+	size_t	len;				/* bytes waiting in buf */
+	size_t	size;				/* capacity of buf */
+	int	error;				/* a write failed, the rest is dropped */
+	void	*async;				/* io_uring writer, NULL for plain writes */
+} io_out_t;
+
+void io_out_init(io_out_t *out, int fd, size_t bufsize);
+int io_out_async(io_out_t *out);
+void io_write(io_out_t *out, const char *data, size_t len);
+void io_puts(io_out_t *out, const char *s);
+char *io_reserve(io_out_t *out, size_t len);
+void io_commit(io_out_t *out, size_t len);
+int io_flush(io_out_t *out);
+char *io_release(io_out_t *out, size_t *len);
+void io_out_free(io_out_t *out);
+
+long io_read(int fd, void *buf, size_t len);
+void io_pipe_size(int fd, size_t size);
+size_t io_parse_size(const char *s);
+
+#endif
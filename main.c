@@ -23,30 +23,51 @@
 #include <string.h>
 #include <ctype.h>
 #include <getopt.h>
+#include <fcntl.h>
 
 #ifndef WIN32
 #include <unistd.h>
+#else
+#include <io.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY	0
 #endif
 
 #include "main.h"
 #include "version.h"
 #include "process.h"
 #include "b64.h"
+#include "batch.h"
+#include "io.h"
+#include "convert.h"
+#include "pipeline.h"
+#include "pool.h"
 
 
 static void print_version(void);	/* print version, copyright information and exit. */
 static void usage(void);					/* print usage */
 static void set_mode(int majour_mode, int minour_mode, struct _config *config);
-static void split_fwrite(char *out_buffer, int sz, int out_buffer_size, FILE *out_file,  int linesz);
 static void config_init(struct _config *config);
+static void config_output(struct _config *output, struct _config *config);
 
 static void usage(void)
 {
 	printf( "Usage: str2hex [params] <string>\n" \
 		"   or: str2hex [params] \'<string>\'\n\n" \
 		"Params:\n" \
-		"   -f <file>	Read input from the file (Default is STDIN).\n" \
+		"   -f <file>	Read input from the file, '-' is STDIN (Default is STDIN).\n" \
+		"   -f <file> <file>...	Convert every file, one result per line in the given order.\n" \
+		"   -fl <file>	Read names of the input files, one per line, from the file ('-' for STDIN).\n" \
+		"   -j <n>	Convert that many files at once (Default is the number of CPUs).\n" \
+		"   -tag 	Prefix every result with its file name; MD5 is written as \"MD5 (file) = hash\".\n" \
+		"   -bufsize <n>[k|M|G]	Size of the read and write buffers (Default is 256k).\n" \
+		"   -io <read|mmap|uring|pipeline>	Input backend; uring also writes asynchronously, pipeline reads,\n" \
+		"		converts and writes on separate threads (Default is mmap for files, pipeline for pipes with -j > 1).\n" \
+		"   -thp 	Back buffers of 2M and more with transparent huge pages.\n" \
 		"   -o <file>	Output to the file (Default is STDOU).\n" \
+		"		A mode after the -o of another one is one more output of the same input.\n" \
 		"   -q 		Ignore \"new line\" symbols.\n" \
 		"   -h 		This help.\n" \
 		"   -v   	Version.\n" \
@@ -55,7 +76,10 @@ static void usage(void)
 		"Conversion params:\n" \
 		"   -p 		Convert to \"plain\" hex format: 2f6574632f706173737764...\n" \
 		"   -n 		Convert 10-base numbers to 16-base (hex) numbers: 6323A37B327F...\n" \
+		"		Every number of any length is converted, one per line; a negative one keeps\n" \
+		"		its sign (-123 -> -7b) and an input without any number gives 0.\n" \
 		"   -no 		Convert 10-base numbers to 8-base (oct) numbers: 384636424...\n" \
+		"   -dn 		Convert 16-base (hex) numbers back to 10-base numbers: 0x7b -> 123\n" \
 		"   -m 		Convert to MySQL format: 0x2f6574632f706173737764... (Default)\n" \
 		"   -mc 		Output as MySQL CHAR format: CHAR(2f,65,74,63,2f,70)...\n" \
 		"   -c 		Convert to C-style oct-chars format: \\3\\94\\94\\574\\545...\n" \
@@ -74,28 +98,43 @@ static void usage(void)
 		"   -xw  	*  HTML escape codes, without semicolons: &#108&#111...\n" \
 		"   -b (-base64[=linesize] | -b64[=linesize] )		Output in Base64: YmZnYmRiZ2Q=\n" \
 		"   -bn  	Convert to Base64, but without newline formating.\n" \
-		"   -md5 	Calculate MD5 (RFC 1321) hash: 929ae467fe43191eff23b9a0e1471d04\n\n" \
+		"   -wrap <n|mime|pem>	Break the output into lines of n characters; mime is 76 with CRLF, pem is 64.\n" \
+		"   -crlf	End the output lines with CRLF.\n" \
+		"   -db64	Decode Base64 back to binary, line breaks are skipped.\n" \
+		"   -dp  	Decode \"plain\" hex back to binary: 2f6574632f...\n" \
+		"   -dm  	*  MySQL format: 0x2f6574632f...\n" \
+		"   -dmc 	*  MySQL CHAR format: CHAR(2f,65,74,63,2f)...\n" \
+		"   -du  	*  URL format: %%2f%%65%%74..., line breaks are skipped.\n" \
+		"   -dt  	*  AT&T assembler format: 0x2f, 0x65 or 0x2f 0x65 or 0x2f0x65...\n" \
+		"   -da  	*  Microsoft-Assembler format: 2fh, 65h or 2fh 65h or 2fh65h...\n" \
+		"   -md5 	Calculate MD5 (RFC 1321) hash: 929ae467fe43191eff23b9a0e1471d04\n" \
+		"   -md5l	MD5 of every line, one hash per line.\n" \
+		"   -md5z	MD5 of every NUL terminated record, one hash per line.\n" \
+		"   -sha256	Calculate SHA-256 (FIPS 180-4) hash: a9a66978f378456c818fb8a3e7c6ad3d...\n\n" \
 		"Exemples:\n" \
 		"   str2hex \'Lorem ipsum\'\n" \
 		"   str2hex -u \'Lorem ipsum\'\n" \
 		"   str2hex -b64 -f /etc/passwd\n" \
+		"   str2hex -md5 -f /etc/passwd /etc/group\n" \
+		"   str2hex -b64 -o data.b64 -md5 -o data.md5 -sha256 -o data.sha256 -f data\n" \
 		"   str2hex -i 1,2,3,4,5,6,7,8,9,0 12345678910\n" \
 		"   str2hex -a -e 1234567890abcde bsedtskdwnshc\n\n" );
 }
 
 int main(int argc, char **argv)
 {
-	int	i, i2;
+	int	i, i2, failed = 0;
 
 	struct _config config;
 
 	config_init(&config);
 
-	FILE 		* in_file, * out_file;
-	in_file = stdin;
-	out_file = stdout;
-	
+	int	in_fd = 0, k, count;
+	struct _config	**outputs;
+	io_out_t	*out;
+
 	unsigned char	*in = NULL;	/* input buffer */
+	FILE	*list_file;
 
 	if (argc == 1)	/* few args - print usage and exit */
 	{
@@ -117,6 +156,7 @@ int main(int argc, char **argv)
 		{"p",0,0,'p'},
 		{"n",0,0,'n'},
 		{"no",0,0,2},
+		{"dn",0,0,32},
 		{"m",0,0,'m'},
 		{"mc",0,0,7},
 		{"c",0,0,'c'},
@@ -136,7 +176,25 @@ int main(int argc, char **argv)
 		{"b64",2,0,'b'},
 		{"base64",2,0,'b'},
 		{"bn",0,0,14},
+		{"db64",0,0,15},
+		{"dp",0,0,16},
+		{"dm",0,0,17},
+		{"dmc",0,0,18},
+		{"du",0,0,19},
+		{"dt",0,0,20},
+		{"da",0,0,21},
 		{"md5",0,0,13},
+		{"md5l",0,0,29},
+		{"md5z",0,0,30},
+		{"sha256",0,0,31},
+		{"fl",1,0,22},
+		{"j",1,0,'j'},
+		{"tag",0,0,23},
+		{"bufsize",1,0,24},
+		{"io",1,0,25},
+		{"thp",0,0,26},
+		{"wrap",1,0,27},
+		{"crlf",0,0,28},
 		{0, 0, 0, 0}
 	};
 
@@ -149,15 +207,77 @@ int main(int argc, char **argv)
 		{
 			/* read input from file */
 			case 'f':
-				if (config.from == 2)
-					exit_error("Too many \'-f\' arguments!");
+				if (config.from == 1)
+					exit_error("You can't use both \'-f\' and string as the command line argument.");
 
 				config.from = 2;
+				add_file(&config, optarg);
+				break;
 
-				/* open input file */
-				if (optarg)
-					if ((in_file = fopen(optarg,"rb")) == NULL)
-						exit_error("Can\'t open the input file.");
+			/* read the names of the input files */
+			case 22:
+				if (config.from == 1)
+					exit_error("You can't use both \'-fl\' and string as the command line argument.");
+
+				if (!strcmp(optarg, "-"))
+					list_file = stdin;
+				else if ((list_file = fopen(optarg,"r")) == NULL)
+					exit_error("Can\'t open the file list.");
+
+				config.from = 2;
+				config.batch = 1;
+				batch_read_list(&config, list_file);
+
+				if (list_file != stdin)
+					fclose(list_file);
+				break;
+
+			case 'j':
+				if ((config.threads = atoi(optarg)) < 1)
+					exit_error("The number of threads must be positive.");
+				break;
+
+			case 23:
+				config.tag = 1;
+				break;
+
+			case 24:
+				if (!(config.bufsize = io_parse_size(optarg)))
+					exit_error("Bad buffer size.");
+				break;
+
+			case 25:
+				if (!strcmp(optarg, "read"))
+					config.io = IO_READ;
+				else if (!strcmp(optarg, "mmap"))
+					config.io = IO_MMAP;
+				else if (!strcmp(optarg, "uring"))
+					config.io = IO_URING;
+				else if (!strcmp(optarg, "pipeline"))
+					config.io = IO_PIPELINE;
+				else
+					exit_error("Unknown I/O backend.");
+				break;
+
+			/* large buffers on transparent huge pages */
+			case 26:
+				pool_huge(1);
+				break;
+
+			/* output lines: MIME bodies are 76 characters with CRLF, PEM is 64 */
+			case 27:
+				if (!strcmp(optarg, "mime"))
+				{
+					config.wrap = 76;
+					config.eol = "\r\n";
+				} else if (!strcmp(optarg, "pem"))
+					config.wrap = 64;
+				else if ((config.wrap = atoi(optarg)) < 0)
+					exit_error("Bad line length.");
+				break;
+
+			case 28:
+				config.eol = "\r\n";
 				break;
 
 			/* write output to file */
@@ -167,7 +287,7 @@ int main(int argc, char **argv)
 		
 				config.out = 1;
 		
-				if ((out_file = fopen(optarg,"w")) == NULL)
+				if ((config.out_fd = open(optarg, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666)) < 0)
 					exit_error("Can\'t open output file!");
 				break;
 
@@ -215,6 +335,10 @@ int main(int argc, char **argv)
 				set_mode(10,1,&config);
 				break;
 
+			case 32: /* hex numbers back to decimal */
+				set_mode(10,2,&config);
+				break;
+
 			case 't':	/* for output in AT&T assembler hex-char format: 0xF5, 0xF3, 0xE9... */
 				set_mode(1,0,&config);
 				break;
@@ -292,10 +416,50 @@ int main(int argc, char **argv)
 				set_mode(11,0,&config);
 				break;
 			
+			case 29: /* MD5 of every line */
+				set_mode(11,1,&config);
+				break;
+
+			case 30: /* MD5 of every NUL terminated record */
+				set_mode(11,2,&config);
+				break;
+
+			case 31:
+				set_mode(13,0,&config);
+				break;
+
 			case 14:
 				set_mode(7,1,&config);
 				break;
 
+			case 15:
+				set_mode(12,0,&config);
+				break;
+
+			case 16: /* plain hex back to binary */
+				set_mode(12,1,&config);
+				break;
+
+			case 17:
+				set_mode(12,2,&config);
+				break;
+
+			case 18:
+				set_mode(12,3,&config);
+				break;
+
+			case 19:
+				set_mode(12,4,&config);
+				break;
+
+			case 20:
+				set_mode(12,5,&config);
+				break;
+
+			case 21:
+				set_mode(12,6,&config);
+				break;
+
 			case '?':
 #if defined(BSD) || defined(__MACH__)
 					fprintf(stderr, "Unknow option.\n");
@@ -307,16 +471,20 @@ int main(int argc, char **argv)
 				break;
 
 			case 1:
+				/* more files after -f */
+				if (config.from == 2)
+				{
+					add_file(&config, optarg);
+					break;
+				}
+
 				if (in && config.from == 1)
 					exit_error("Please wrap the string in quotes: str2hex \"a few word string\".");
 
-				if (config.from == 2)
-					exit_error("You can't use both \'-f\' and string as the command line argument.");
-
 				if (!config.from)
 					config.from = 1;
 
-				in = malloc(strlen(optarg) * sizeof(char));
+				in = malloc((strlen(optarg) + 1) * sizeof(char));
 				strcpy((char*)in, optarg);
 				break;
 		}
@@ -324,65 +492,104 @@ int main(int argc, char **argv)
 	if (!config.from)
 		exit_error("You didn't provide any data to convert");
 
-	if (!config.mode)
-		config.mode = 3;
+	if (config.from == 2 && (config.files_count > 1 || config.tag))
+		config.batch = 1;
+
+	if (!config.threads)
+	{
+#ifndef WIN32
+		config.threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (config.threads < 1)
+#endif
+			config.threads = 1;
+	}
+
+	/* whole pages, which keeps the read buffers and the pipeline blocks page aligned in size */
+	if (!config.bufsize)
+		config.bufsize = IO_DEF_BUFSIZE;
+	config.bufsize = (config.bufsize + convert_chunk_size() - 1) / convert_chunk_size() * convert_chunk_size();
+
+	/* every mode given is an output of its own, the last one is "config" itself */
+	count = config.more_count + 1;
+	outputs = malloc(count * sizeof(struct _config *));
+	out = malloc(count * sizeof(io_out_t));
+	if (!outputs || !out)
+		exit_error("Not enough memory.");
+
+	for (k = 0; k < config.more_count; k++)
+		outputs[k] = config.more[k];
+	outputs[k] = &config;
+
+	if (count > 1 && config.batch)
+		exit_error("Several outputs can only be made from one input.");
+
+	for (k = 0; k < count; k++)
+	{
+		config_output(outputs[k], &config);
+
+		io_out_init(&out[k], outputs[k]->out_fd, config.bufsize);
+		io_pipe_size(outputs[k]->out_fd, config.bufsize);
+
+		/* without kernel support the plain writes stay */
+		if (config.io == IO_URING)
+			io_out_async(&out[k]);
+	}
 
 	/* Processing */
-	if (config.from == 2)
+	if (config.batch)
 	{
-		#ifndef WIN32
-			int page_size = sysconf(_SC_PAGESIZE);
-			if (page_size == -1)
-				page_size = 4096;
-		#else
-			int page_size = 4096;
-		#endif
-		
-		size_t	in_buffer_size = page_size, out_buffer_size = 0, readsiz = 0;
-		unsigned char	*in_buffer = malloc(in_buffer_size * sizeof(char));
-		char	*out_buffer = NULL;
-	
-		while (!feof(in_file) && !ferror(in_file) && !ferror(out_file))
+		failed = batch_run(&config, out);
+	} else if (config.from == 2)
+	{
+		if (!strcmp(config.files[0], "-"))
+			in_fd = 0;
+		else if ((in_fd = open(config.files[0], O_RDONLY | O_BINARY)) < 0)
+			exit_error("Can\'t open the input file.");
+
+		io_pipe_size(in_fd, config.bufsize);
+
+		/* several outputs share one pass over the input */
+		if (count > 1)
+			convert_outputs(outputs, out, count, in_fd);
+
+		/* a large file is cut into segments converted on all threads */
+		else if ((failed = batch_split(&config, in_fd, out)) < 0)
 		{
-			readsiz = fread(in_buffer, sizeof(char), in_buffer_size, in_file);
-			
-			if (!feof(in_file))
-				out_buffer = process(in_buffer, &out_buffer_size, readsiz, &config, 0);
-			else
-				out_buffer = process(in_buffer, &out_buffer_size, readsiz, &config, 1);
-			
-			
-			if (out_buffer_size)
-			{
-				if (config.mode == 7 && config.mode2 != 1)
-					split_fwrite(out_buffer, sizeof(char), out_buffer_size, out_file, config.linesize);
-				else
-					fwrite(out_buffer, sizeof(char), out_buffer_size, out_file);
-			}
-			free(out_buffer);
+			failed = 0;
+
+			/* pipes don't split, but reading, converting and writing can overlap */
+			if (pipeline_run(&config, in_fd, out) < 0)
+				convert_stream(&config, in_fd, out);
 		}
 
+		close(in_fd);
 	} else
 	{
 		size_t len = strlen((char*)in);
-		size_t out_buffer_size = 0;
+		encoder_t	enc;
 
-		char *out_buffer = process(in, &out_buffer_size, len, &config, 1);
-		
-		if (out_buffer_size)
-				fwrite(out_buffer, sizeof(char), out_buffer_size, out_file);	
+		/* the string is the whole stream: one call, converted straight into the output buffer */
+		for (k = 0; k < count; k++)
+		{
+			encoder_init(&enc, outputs[k]);
+			io_commit(&out[k], encoder_convert_into(&enc, io_reserve(&out[k], encoder_bound(&enc, len, 1)), in, len, 1));
+		}
 	}
 
-#ifdef WIN32
-	fputs("\r\n",out_file);
-#else
-	fputc('\n',out_file);
-#endif
+	for (k = 0; k < count; k++)
+	{
+		/* decoded data is binary, don't touch it; digest lines end themselves */
+		if (outputs[k]->mode != 12 && !config.batch && !(outputs[k]->mode == 11 && outputs[k]->mode2))
+			io_puts(&out[k], outputs[k]->eol);
+
+		if (io_flush(&out[k]))
+			exit_error("Can\'t write the output.");
 
-	fclose(in_file);
-	fclose(out_file);
+		io_out_free(&out[k]);
+		close(outputs[k]->out_fd);
+	}
 
-	return(0);
+	return(failed ? EXIT_FAILURE : 0);
 }
 
 
@@ -396,57 +603,57 @@ static void print_version(void)
 	exit(EXIT_SUCCESS);
 }
 
-void set_mode(int majour_mode, int minour_mode, struct _config *config)
+void add_file(struct _config *config, const char *name)
 {
-	if (config->mode != 0)
-		exit_error("Too many convertion modes!");
+	config->files = realloc(config->files, (config->files_count + 1) * sizeof(char *));
+	if (!config->files || !(config->files[config->files_count] = strdup(name)))
+		exit_error("Not enough memory.");
 
-	config->mode = majour_mode;
-	config->mode2 = minour_mode;
+	config->files_count++;
 }
 
-void exit_error(char *message)
+/*
+ * A mode after the -o of the mode before (-b64 -o a.b64 -md5 -o a.md5)
+ * starts one more output of the same input: the settings so far are kept
+ * for the earlier mode and carried on to the new one.
+ */
+static void add_output(struct _config *config)
 {
-	fprintf(stderr,"ERROR: %s\n",message);
-	exit(EXIT_FAILURE);
-}
+	struct _config	*done = malloc(sizeof(struct _config));
 
-static void split_fwrite(char *out_buffer, int sz, int out_buffer_size, FILE *out_file, int linesz)
-{
-	int i;
-	char	*buffer = out_buffer;
-	static	int rem_size = 0;
+	config->more = realloc(config->more, (config->more_count + 1) * sizeof(struct _config *));
+	if (!done || !config->more)
+		exit_error("Not enough memory.");
 
-	if (rem_size)
-	{
-#ifdef WIN32
-		fputs("\r\n",out_file);
-#else
-	 	fputc('\n',out_file);
-#endif
+	*done = *config;
+	done->more = NULL;
+	done->more_count = 0;
+	config->more[config->more_count++] = done;
 
-		buffer += rem_size;
-	}
+	config->mode = 0;
+	config->mode2 = 0;
+	config->out = 0;
+	config->out_fd = 1;
+}
 
-	for (i = out_buffer_size; i >= linesz; i -= linesz)
+void set_mode(int majour_mode, int minour_mode, struct _config *config)
+{
+	if (config->mode != 0)
 	{
-		fwrite(buffer, sz, linesz, out_file);
-
-#ifdef WIN32
-		fputs("\r\n",out_file);
-#else
-	 	fputc('\n',out_file);
-#endif
+		if (!config->out)
+			exit_error("Too many convertion modes!");
 
-		buffer += linesz;
+		add_output(config);
 	}
-	
-	if (i > 0)
-	{
-		rem_size = linesz-i;
 
-		fwrite(buffer, sz, i, out_file);
-	}
+	config->mode = majour_mode;
+	config->mode2 = minour_mode;
+}
+
+void exit_error(char *message)
+{
+	fprintf(stderr,"ERROR: %s\n",message);
+	exit(EXIT_FAILURE);
 }
 
 static void config_init(struct _config *config)
@@ -457,5 +664,35 @@ static void config_init(struct _config *config)
 	config->exclude_symbols_size = 0;
 	config->from = 0;
 	config->mode = 0;
+	config->wrap = -1;
+	config->out_fd = 1;
+}
+
+/* Settings of one output: the defaults of its mode, the input side from "config" */
+static void config_output(struct _config *output, struct _config *config)
+{
+	if (output != config)
+	{
+		output->from = config->from;
+		output->files = config->files;
+		output->files_count = config->files_count;
+		output->batch = config->batch;
+		output->threads = config->threads;
+		output->bufsize = config->bufsize;
+		output->io = config->io;
+	}
+
+	if (!output->mode)
+		output->mode = 3;
+
+	/* Base64 read from files is wrapped unless -bn was given, strings never were */
+	if (output->wrap < 0)
+		output->wrap = (output->mode == 7 && output->mode2 != 1 && output->from == 2 && output->linesize > 0) ? output->linesize : 0;
+
+	if (output->wrap && output->mode == 12)
+		exit_error("Decoded data can\'t be wrapped.");
+
+	if (!output->eol)
+		output->eol = IO_EOL;
 }
 
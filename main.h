@@ -1,6 +1,8 @@
 #ifndef __MAIN_H
 #define __MAIN_H
 
+#include <stddef.h>
+
 struct _config {
 	int	from; 					// 1 - read from command argument string.
 		           				// 2 - read from file.
@@ -13,8 +15,21 @@ struct _config {
 	int	mode;						// convertion major mode
 	int	mode2;					// convertion minor mode
 	int	linesize;				// line size for base64
+	char	**files;				// input files given by -f and -fl
+	int	files_count;
+	int	batch;					// 1 - several files, one result per file.
+	int	threads;				// worker threads for the batch mode
+	int	tag;					// 1 - prefix every result with its file name.
+	size_t	bufsize;				// read and write buffer size
+	int	io;					// input backend, IO_*
+	int	wrap;					// output line length, 0 - no wrapping
+	const char	*eol;				// line break of the output
+	int	out_fd;					// output given by -o, STDOUT by default
+	struct _config	**more;				// outputs of the modes before the last one (-b64 -o a -md5 -o b)
+	int	more_count;
 };
 
 void exit_error(char *message); // print error message and exit.
+void add_file(struct _config *config, const char *name);	// append a file to the input list.
 
 #endif
@@ -37,6 +37,11 @@
   <ghost@aladdin.com>.  Other authors are noted in the change history
   that follows (in reverse chronological order):
 
+  str2hex Byte order from the compiler; little-endian words read in
+	place; md5_process() takes several blocks; md5_append() takes a
+	size_t; shorter F and G dependency chains.
+  str2hex Added md5_many(), which hashes many messages at once in SIMD
+	lanes; this is not part of the original package.
   2002-04-13 lpd Clarified derivation from RFC 1321; now handles byte order
 	either statically or dynamically; added missing #include <string.h>
 	in library.
@@ -54,6 +59,11 @@
 #include "md5.h"
 #include <string.h>
 
+/* the compiler knows the byte order, so the run-time test is rarely needed (str2hex) */
+#if !defined(ARCH_IS_BIG_ENDIAN) && defined(__BYTE_ORDER__)
+#  define ARCH_IS_BIG_ENDIAN (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#endif
+
 #undef BYTE_ORDER	/* 1 = big-endian, -1 = little-endian, 0 = unknown */
 #ifdef ARCH_IS_BIG_ENDIAN
 #  define BYTE_ORDER (ARCH_IS_BIG_ENDIAN ? 1 : -1)
@@ -128,21 +138,42 @@
 #define T64 /* 0xeb86d391 */ (T_MASK ^ 0x14792c6e)
 
 
-static void md5_process(md5_state_t *pms, const md5_byte_t *data /*[64]*/)
+#if BYTE_ORDER < 0
+/* A little-endian message word, read in place whether aligned or not. */
+static inline md5_word_t md5_word(const md5_byte_t *p)
+{
+    md5_word_t w;
+
+    memcpy(&w, p, 4);
+    return w;
+}
+#  define XK(k) md5_word(data + ((k) << 2))
+#else
+#  define XK(k) X[k]
+#endif
+
+static void md5_process(md5_state_t *pms, const md5_byte_t *data /*[64]*/,
+			size_t blocks)
 {
     md5_word_t
-	a = pms->abcd[0], b = pms->abcd[1],
-	c = pms->abcd[2], d = pms->abcd[3];
+	A = pms->abcd[0], B = pms->abcd[1],
+	C = pms->abcd[2], D = pms->abcd[3];
+    md5_word_t a, b, c, d;
     md5_word_t t;
 #if BYTE_ORDER > 0
     /* Define storage only for big-endian CPUs. */
     md5_word_t X[16];
-#else
+#elif BYTE_ORDER == 0
     /* Define storage for little-endian or both types of CPUs. */
     md5_word_t xbuf[16];
     const md5_word_t *X;
 #endif
 
+    /* The state stays in registers from block to block (str2hex). */
+    for (; blocks; --blocks, data += 64) {
+    a = A; b = B; c = C; d = D;
+
+#if BYTE_ORDER >= 0
     {
 #if BYTE_ORDER == 0
 	/*
@@ -154,7 +185,7 @@ static void md5_process(md5_state_t *pms, const md5_byte_t *data /*[64]*/)
 
 	if (*((const md5_byte_t *)&w)) /* dynamic little-endian */
 #endif
-#if BYTE_ORDER <= 0		/* little-endian */
+#if BYTE_ORDER == 0		/* little-endian */
 	{
 	    /*
 	     * On little-endian machines, we can process properly aligned
@@ -192,15 +223,17 @@ static void md5_process(md5_state_t *pms, const md5_byte_t *data /*[64]*/)
 	}
 #endif
     }
+#endif
 
 #define ROTATE_LEFT(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
 
     /* Round 1. */
     /* Let [abcd k s i] denote the operation
        a = b + ((a + F(b,c,d) + X[k] + T[i]) <<< s). */
-#define F(x, y, z) (((x) & (y)) | (~(x) & (z)))
+/* (x & y) | (~x & z), one operation less (str2hex) */
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
 #define SET(a, b, c, d, k, s, Ti)\
-  t = a + F(b,c,d) + X[k] + Ti;\
+  t = a + XK(k) + Ti + F(b,c,d);\
   a = ROTATE_LEFT(t, s) + b
     /* Do the following 16 operations. */
     SET(a, b, c, d,  0,  7,  T1);
@@ -225,8 +258,10 @@ static void md5_process(md5_state_t *pms, const md5_byte_t *data /*[64]*/)
      /* Let [abcd k s i] denote the operation
           a = b + ((a + G(b,c,d) + X[k] + T[i]) <<< s). */
 #define G(x, y, z) (((x) & (z)) | ((y) & ~(z)))
+    /* The two halves of G never share a bit, so they can be added, the
+       one without b before b is known (str2hex). */
 #define SET(a, b, c, d, k, s, Ti)\
-  t = a + G(b,c,d) + X[k] + Ti;\
+  t = a + XK(k) + Ti + ((c) & ~(d)) + ((b) & (d));\
   a = ROTATE_LEFT(t, s) + b
      /* Do the following 16 operations. */
     SET(a, b, c, d,  1,  5, T17);
@@ -250,9 +285,9 @@ static void md5_process(md5_state_t *pms, const md5_byte_t *data /*[64]*/)
      /* Round 3. */
      /* Let [abcd k s t] denote the operation
           a = b + ((a + H(b,c,d) + X[k] + T[i]) <<< s). */
-#define H(x, y, z) ((x) ^ (y) ^ (z))
+#define H(x, y, z) ((x) ^ ((y) ^ (z)))
 #define SET(a, b, c, d, k, s, Ti)\
-  t = a + H(b,c,d) + X[k] + Ti;\
+  t = a + XK(k) + Ti + H(b,c,d);\
   a = ROTATE_LEFT(t, s) + b
      /* Do the following 16 operations. */
     SET(a, b, c, d,  5,  4, T33);
@@ -278,7 +313,7 @@ static void md5_process(md5_state_t *pms, const md5_byte_t *data /*[64]*/)
           a = b + ((a + I(b,c,d) + X[k] + T[i]) <<< s). */
 #define I(x, y, z) ((y) ^ ((x) | ~(z)))
 #define SET(a, b, c, d, k, s, Ti)\
-  t = a + I(b,c,d) + X[k] + Ti;\
+  t = a + XK(k) + Ti + I(b,c,d);\
   a = ROTATE_LEFT(t, s) + b
      /* Do the following 16 operations. */
     SET(a, b, c, d,  0,  6, T49);
@@ -302,10 +337,16 @@ static void md5_process(md5_state_t *pms, const md5_byte_t *data /*[64]*/)
      /* Then perform the following additions. (That is increment each
         of the four registers by the value it had before this block
         was started.) */
-    pms->abcd[0] += a;
-    pms->abcd[1] += b;
-    pms->abcd[2] += c;
-    pms->abcd[3] += d;
+    A += a;
+    B += b;
+    C += c;
+    D += d;
+    }
+
+    pms->abcd[0] = A;
+    pms->abcd[1] = B;
+    pms->abcd[2] = C;
+    pms->abcd[3] = D;
 }
 
 void md5_init(md5_state_t *pms)
@@ -317,37 +358,40 @@ void md5_init(md5_state_t *pms)
     pms->abcd[3] = 0x10325476;
 }
 
-void md5_append(md5_state_t *pms, const md5_byte_t *data, int nbytes)
+void md5_append(md5_state_t *pms, const md5_byte_t *data, size_t nbytes)
 {
     const md5_byte_t *p = data;
-    int left = nbytes;
-    int offset = (pms->count[0] >> 3) & 63;
+    size_t left = nbytes;
+    size_t offset = (pms->count[0] >> 3) & 63;
     md5_word_t nbits = (md5_word_t)(nbytes << 3);
 
-    if (nbytes <= 0)
+    if (!nbytes)
 	return;
 
     /* Update the message length. */
-    pms->count[1] += nbytes >> 29;
+    pms->count[1] += (md5_word_t)(nbytes >> 29);
     pms->count[0] += nbits;
     if (pms->count[0] < nbits)
 	pms->count[1]++;
 
     /* Process an initial partial block. */
     if (offset) {
-	int copy = (offset + nbytes > 64 ? 64 - offset : nbytes);
+	size_t copy = (offset + nbytes > 64 ? 64 - offset : nbytes);
 
 	memcpy(pms->buf + offset, p, copy);
 	if (offset + copy < 64)
 	    return;
 	p += copy;
 	left -= copy;
-	md5_process(pms, pms->buf);
+	md5_process(pms, pms->buf, 1);
     }
 
-    /* Process full blocks. */
-    for (; left >= 64; p += 64, left -= 64)
-	md5_process(pms, p);
+    /* Process full blocks, straight from the caller's buffer. */
+    if (left >= 64) {
+	md5_process(pms, p, left >> 6);
+	p += left & ~(size_t)63;
+	left &= 63;
+    }
 
     /* Process a final partial block. */
     if (left)
@@ -375,3 +419,241 @@ void md5_finish(md5_state_t *pms, md5_byte_t digest[16])
     for (i = 0; i < 16; ++i)
 	digest[i] = (md5_byte_t)(pms->abcd[i >> 2] >> ((i & 3) << 3));
 }
+
+/*
+ * Multi-buffer MD5 (str2hex).
+ *
+ * MD5_LANES independent messages are hashed side by side: word k of
+ * every lane's block goes into one vector, so each step of the rounds
+ * above runs on all lanes with one instruction. A lane that finishes
+ * its message takes the next one, so long and short messages mix.
+ * The vector code is built for AVX-512, AVX2 and the baseline (SSE2
+ * on x86-64) and picked at run time; 16 lanes are two AVX2 or four SSE2
+ * registers, which also hides the latency of the dependent steps.
+ */
+
+typedef md5_word_t md5_lanes_t __attribute__((vector_size(4 * MD5_LANES)));
+
+static inline __attribute__((always_inline))
+void md5_lanes_body(md5_lanes_t abcd[4], const md5_lanes_t X[16])
+{
+    md5_lanes_t
+	a = abcd[0], b = abcd[1],
+	c = abcd[2], d = abcd[3];
+    md5_lanes_t t;
+
+#define SET(f, a, b, c, d, k, s, Ti)\
+  t = a + f(b,c,d) + X[k] + (md5_word_t)(Ti);\
+  a = ROTATE_LEFT(t, s) + b
+    SET(F, a, b, c, d,  0,  7,  T1);
+    SET(F, d, a, b, c,  1, 12,  T2);
+    SET(F, c, d, a, b,  2, 17,  T3);
+    SET(F, b, c, d, a,  3, 22,  T4);
+    SET(F, a, b, c, d,  4,  7,  T5);
+    SET(F, d, a, b, c,  5, 12,  T6);
+    SET(F, c, d, a, b,  6, 17,  T7);
+    SET(F, b, c, d, a,  7, 22,  T8);
+    SET(F, a, b, c, d,  8,  7,  T9);
+    SET(F, d, a, b, c,  9, 12, T10);
+    SET(F, c, d, a, b, 10, 17, T11);
+    SET(F, b, c, d, a, 11, 22, T12);
+    SET(F, a, b, c, d, 12,  7, T13);
+    SET(F, d, a, b, c, 13, 12, T14);
+    SET(F, c, d, a, b, 14, 17, T15);
+    SET(F, b, c, d, a, 15, 22, T16);
+
+    SET(G, a, b, c, d,  1,  5, T17);
+    SET(G, d, a, b, c,  6,  9, T18);
+    SET(G, c, d, a, b, 11, 14, T19);
+    SET(G, b, c, d, a,  0, 20, T20);
+    SET(G, a, b, c, d,  5,  5, T21);
+    SET(G, d, a, b, c, 10,  9, T22);
+    SET(G, c, d, a, b, 15, 14, T23);
+    SET(G, b, c, d, a,  4, 20, T24);
+    SET(G, a, b, c, d,  9,  5, T25);
+    SET(G, d, a, b, c, 14,  9, T26);
+    SET(G, c, d, a, b,  3, 14, T27);
+    SET(G, b, c, d, a,  8, 20, T28);
+    SET(G, a, b, c, d, 13,  5, T29);
+    SET(G, d, a, b, c,  2,  9, T30);
+    SET(G, c, d, a, b,  7, 14, T31);
+    SET(G, b, c, d, a, 12, 20, T32);
+
+    SET(H, a, b, c, d,  5,  4, T33);
+    SET(H, d, a, b, c,  8, 11, T34);
+    SET(H, c, d, a, b, 11, 16, T35);
+    SET(H, b, c, d, a, 14, 23, T36);
+    SET(H, a, b, c, d,  1,  4, T37);
+    SET(H, d, a, b, c,  4, 11, T38);
+    SET(H, c, d, a, b,  7, 16, T39);
+    SET(H, b, c, d, a, 10, 23, T40);
+    SET(H, a, b, c, d, 13,  4, T41);
+    SET(H, d, a, b, c,  0, 11, T42);
+    SET(H, c, d, a, b,  3, 16, T43);
+    SET(H, b, c, d, a,  6, 23, T44);
+    SET(H, a, b, c, d,  9,  4, T45);
+    SET(H, d, a, b, c, 12, 11, T46);
+    SET(H, c, d, a, b, 15, 16, T47);
+    SET(H, b, c, d, a,  2, 23, T48);
+
+    SET(I, a, b, c, d,  0,  6, T49);
+    SET(I, d, a, b, c,  7, 10, T50);
+    SET(I, c, d, a, b, 14, 15, T51);
+    SET(I, b, c, d, a,  5, 21, T52);
+    SET(I, a, b, c, d, 12,  6, T53);
+    SET(I, d, a, b, c,  3, 10, T54);
+    SET(I, c, d, a, b, 10, 15, T55);
+    SET(I, b, c, d, a,  1, 21, T56);
+    SET(I, a, b, c, d,  8,  6, T57);
+    SET(I, d, a, b, c, 15, 10, T58);
+    SET(I, c, d, a, b,  6, 15, T59);
+    SET(I, b, c, d, a, 13, 21, T60);
+    SET(I, a, b, c, d,  4,  6, T61);
+    SET(I, d, a, b, c, 11, 10, T62);
+    SET(I, c, d, a, b,  2, 15, T63);
+    SET(I, b, c, d, a,  9, 21, T64);
+#undef SET
+
+    abcd[0] += a;
+    abcd[1] += b;
+    abcd[2] += c;
+    abcd[3] += d;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define MD5_X86
+#endif
+
+#ifdef MD5_X86
+__attribute__((target("avx512f")))
+static void md5_lanes_avx512(md5_lanes_t abcd[4], const md5_lanes_t X[16])
+{
+    md5_lanes_body(abcd, X);
+}
+
+__attribute__((target("avx2")))
+static void md5_lanes_avx2(md5_lanes_t abcd[4], const md5_lanes_t X[16])
+{
+    md5_lanes_body(abcd, X);
+}
+#endif
+
+static void md5_lanes_base(md5_lanes_t abcd[4], const md5_lanes_t X[16])
+{
+    md5_lanes_body(abcd, X);
+}
+
+typedef void (*md5_lanes_fn)(md5_lanes_t abcd[4], const md5_lanes_t X[16]);
+
+static md5_lanes_fn md5_lanes;
+static int md5_bits = 512;	/* the widest kernel allowed */
+
+/*
+ * Select the widest vector unit of this CPU. Done once, by the first
+ * md5_many() or before the worker threads start, which then only read
+ * the choice.
+ */
+void md5_dispatch(void)
+{
+    if (md5_lanes)
+	return;
+
+    md5_lanes = md5_lanes_base;
+#ifdef MD5_X86
+    __builtin_cpu_init();
+
+    if (md5_bits >= 512 && __builtin_cpu_supports("avx512f"))
+	md5_lanes = md5_lanes_avx512;
+    else if (md5_bits >= 256 && __builtin_cpu_supports("avx2"))
+	md5_lanes = md5_lanes_avx2;
+#endif
+}
+
+/* Select again with no kernel wider than "bits", so the tests can run every kernel on one CPU */
+void md5_limit(int bits)
+{
+    md5_bits = bits;
+    md5_lanes = NULL;
+    md5_dispatch();
+}
+
+/* Message of one lane: whole blocks straight from the data, the padded end from "tail" */
+typedef struct md5_lane_s {
+    const md5_byte_t *data;
+    size_t blocks;		/* whole data blocks */
+    size_t total;		/* blocks with the padding */
+    size_t next;		/* block to process */
+    int msg;			/* index of the message, -1 - idle */
+    md5_byte_t tail[128];
+} md5_lane_t;
+
+static void md5_lane_load(md5_lane_t *lane, const md5_byte_t *data, size_t nbytes, int msg)
+{
+    size_t rest = nbytes & 63;
+    unsigned long long nbits = (unsigned long long)nbytes << 3;
+    int i;
+
+    lane->data = data;
+    lane->blocks = nbytes >> 6;
+    lane->total = lane->blocks + (rest < 56 ? 1 : 2);
+    lane->next = 0;
+    lane->msg = msg;
+
+    memset(lane->tail, 0, sizeof(lane->tail));
+    memcpy(lane->tail, data + (lane->blocks << 6), rest);
+    lane->tail[rest] = 0x80;
+    for (i = 0; i < 8; ++i)
+	lane->tail[((lane->total - lane->blocks) << 6) - 8 + i] = (md5_byte_t)(nbits >> (i << 3));
+}
+
+void md5_many(const md5_byte_t *const data[], const size_t nbytes[], int count,
+	      md5_byte_t digest[][16])
+{
+    md5_lanes_t abcd[4], X[16];
+    md5_lane_t lane[MD5_LANES];
+    int busy = 0, next = 0, l, k, i;
+
+    md5_dispatch();
+
+    for (l = 0; l < MD5_LANES; ++l) {
+	lane[l].msg = -1;
+	lane[l].blocks = lane[l].next = 0;
+	memset(lane[l].tail, 0, 64);
+    }
+
+    while (next < count || busy) {
+	/* idle lanes take the next messages and start from the initial state */
+	for (l = 0; l < MD5_LANES && next < count; ++l) {
+	    if (lane[l].msg >= 0)
+		continue;
+	    md5_lane_load(&lane[l], data[next], nbytes[next], next);
+	    next++;
+	    busy++;
+	    abcd[0][l] = 0x67452301;
+	    abcd[1][l] = /*0xefcdab89*/ T_MASK ^ 0x10325476;
+	    abcd[2][l] = /*0x98badcfe*/ T_MASK ^ 0x67452301;
+	    abcd[3][l] = 0x10325476;
+	}
+
+	/* word k of every lane's block in vector k; idle lanes hash their old tail */
+	for (l = 0; l < MD5_LANES; ++l) {
+	    md5_lane_t *ln = &lane[l];
+	    const md5_byte_t *xp = (ln->next < ln->blocks) ? ln->data + (ln->next << 6) :
+		ln->tail + ((ln->msg >= 0 ? ln->next - ln->blocks : 0) << 6);
+
+	    for (k = 0; k < 16; ++k, xp += 4)
+		X[k][l] = xp[0] + (xp[1] << 8) + (xp[2] << 16) + ((md5_word_t)xp[3] << 24);
+	}
+
+	md5_lanes(abcd, X);
+
+	for (l = 0; l < MD5_LANES; ++l) {
+	    if (lane[l].msg < 0 || ++lane[l].next < lane[l].total)
+		continue;
+	    for (i = 0; i < 16; ++i)
+		digest[lane[l].msg][i] = (md5_byte_t)(abcd[i >> 2][l] >> ((i & 3) << 3));
+	    lane[l].msg = -1;
+	    busy--;
+	}
+    }
+}
@@ -50,6 +50,8 @@
 #ifndef md5_INCLUDED
 #  define md5_INCLUDED
 
+#include <stddef.h>
+
 /*
  * This package supports both compile-time and run-time determination of CPU
  * byte order.  If ARCH_IS_BIG_ENDIAN is defined as 0, the code will be
@@ -63,6 +65,9 @@
 typedef unsigned char md5_byte_t; /* 8-bit byte */
 typedef unsigned int md5_word_t; /* 32-bit word */
 
+/* Messages hashed side by side by md5_many(). */
+#define MD5_LANES 16
+
 /* Define the state of the MD5 Algorithm. */
 typedef struct md5_state_s {
     md5_word_t count[2];	/* message length in bits, lsw first */
@@ -79,11 +84,21 @@ extern "C"
 void md5_init(md5_state_t *pms);
 
 /* Append a string to the message. */
-void md5_append(md5_state_t *pms, const md5_byte_t *data, int nbytes);
+void md5_append(md5_state_t *pms, const md5_byte_t *data, size_t nbytes);
 
 /* Finish the message and return the digest. */
 void md5_finish(md5_state_t *pms, md5_byte_t digest[16]);
 
+/* Select the md5_many() kernel for this CPU; call before starting threads. */
+void md5_dispatch(void);
+
+/* Use no md5_many() kernel wider than "bits" (0 is the portable one); not with threads running. */
+void md5_limit(int bits);
+
+/* Hash "count" independent messages at once, MD5_LANES at a time. */
+void md5_many(const md5_byte_t *const data[], const size_t nbytes[], int count,
+	      md5_byte_t digest[][16]);
+
 #ifdef __cplusplus
 }  /* end extern "C" */
 #endif
@@ -0,0 +1,929 @@
+/*
+ * number.c
+ * This file is part of str2hex project.
+ *
+ * Copyright 2005 Dzmitry Plashchynski <plashchynski@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Base conversion of the numbers in a stream.
+ *
+ * Every run of decimal digits (hex digits for -dn, after an optional
+ * "0x") is one number, a '-' right before it makes it negative, anything
+ * else separates the numbers. One value is written per number, the values
+ * are separated by new lines; a negative value keeps its sign, an input
+ * with no number gives 0. The runs of digits are found 16 characters
+ * at a time and parsed 8 digits at a time; a number may be cut anywhere
+ * between two chunks.
+ *
+ * Numbers of up to 19 decimal or 16 hex digits are kept in 64 bits. The
+ * digits of longer ones are kept as text and converted at the end of the
+ * number in 32-bit limbs. Decimal to binary splits the digits in halves
+ * and joins them as hi * 10^k + lo, binary to decimal divides by 10^k with
+ * a precomputed reciprocal (Barrett), where 10^k is a square of 10^9 and
+ * the reciprocal comes from Newton's iteration. With Karatsuba
+ * multiplication both directions are subquadratic.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "main.h"
+#include "number.h"
+#include "encode.h"
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+typedef uint32_t	limb_t;
+
+#define LIMB_BITS	32
+#define DEC_GROUP	1000000000	/* 10^9, the largest power of 10 in a limb */
+#define DEC_GROUP_DIGITS	9
+
+#define KARATSUBA_LIMBS	32		/* multiplications below this are done by the schoolbook */
+#define DEC_BASE_DIGITS	(DEC_GROUP_DIGITS * 64)	/* shorter decimal strings are converted group by group */
+#define DEC_BASE_LIMBS	64		/* smaller binary numbers are divided by 10^9 limb by limb */
+
+static const char	number_digits[] = "0123456789abcdef";
+
+static void *number_alloc(size_t size)
+{
+	void	*p = malloc(size ? size : 1);
+
+	if (!p)
+		exit_error("Not enough memory.");
+
+	return p;
+}
+
+static limb_t *limbs_alloc(size_t n)
+{
+	return number_alloc(n * sizeof(limb_t));
+}
+
+/* Value of a digit character, -1 for anything else */
+static int number_digit(unsigned char c, int hex)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+
+	if (hex)
+	{
+		c |= 0x20;
+		if (c >= 'a' && c <= 'f')
+			return c - 'a' + 10;
+	}
+
+	return -1;
+}
+
+#ifdef HAVE_X86_SIMD
+/* Digits at the start of "in", 16 characters per step; stops at the last whole vector */
+__attribute__((target("sse2")))
+static size_t number_run_sse2(const unsigned char *in, size_t len, int hex)
+{
+	size_t	i;
+	unsigned	mask;
+
+	for (i = 0; i + 16 <= len; i += 16)
+	{
+		__m128i	c = _mm_loadu_si128((const __m128i *) (in + i));
+		__m128i	ok = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), c));
+
+		if (hex)
+		{
+			__m128i	lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+
+			ok = _mm_or_si128(ok, _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+				_mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), lower)));
+		}
+
+		if ((mask = ~_mm_movemask_epi8(ok) & 0xffff))
+			return i + __builtin_ctz(mask);
+	}
+
+	return i;
+}
+#endif
+
+/* Length of the run of digits at the start of "in" */
+static size_t number_run(const unsigned char *in, size_t len, int hex)
+{
+	size_t	i = 0;
+
+#ifdef HAVE_X86_SIMD
+	if (encode_simd_level() != ENCODE_SIMD_NONE)
+	{
+		i = number_run_sse2(in, len, hex);
+		if (i + 16 <= len)
+			return i;
+	}
+#endif
+
+	while (i < len && number_digit(in[i], hex) >= 0)
+		i++;
+
+	return i;
+}
+
+/* Value of 8 decimal digits */
+static uint32_t number_eight(const char *s)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	uint64_t	v;
+
+	/* the first digit is in the lowest byte: pairs, then quads, then all 8 */
+	memcpy(&v, s, 8);
+	v = ((v & 0x0f0f0f0f0f0f0f0fULL) * 2561) >> 8;
+	v = ((v & 0x00ff00ff00ff00ffULL) * 6553601) >> 16;
+
+	return (uint32_t) (((v & 0x0000ffff0000ffffULL) * 42949672960001ULL) >> 32);
+#else
+	uint32_t	v = 0;
+	int	i;
+
+	for (i = 0; i < 8; i++)
+		v = v * 10 + (s[i] - '0');
+
+	return v;
+#endif
+}
+
+/* Value of "n" decimal digits, n <= 9 */
+static limb_t number_group(const char *s, size_t n)
+{
+	limb_t	v = 0;
+
+	if (n >= 8)
+	{
+		v = number_eight(s);
+		s += 8;
+		n -= 8;
+	}
+
+	while (n--)
+		v = v * 10 + (*s++ - '0');
+
+	return v;
+}
+
+/* Limbs without the leading zero ones */
+static size_t limbs_norm(const limb_t *a, size_t n)
+{
+	while (n && !a[n-1])
+		n--;
+
+	return n;
+}
+
+static int limbs_cmp(const limb_t *a, size_t an, const limb_t *b, size_t bn)
+{
+	an = limbs_norm(a, an);
+	bn = limbs_norm(b, bn);
+
+	if (an != bn)
+		return (an < bn) ? -1 : 1;
+
+	while (an--)
+		if (a[an] != b[an])
+			return (a[an] < b[an]) ? -1 : 1;
+
+	return 0;
+}
+
+/* r += a, with an <= rn; returns the carry out of r */
+static limb_t limbs_add(limb_t *r, size_t rn, const limb_t *a, size_t an)
+{
+	uint64_t	t = 0;
+	size_t	i;
+
+	for (i = 0; i < an; i++)
+	{
+		t += (uint64_t) r[i] + a[i];
+		r[i] = (limb_t) t;
+		t >>= LIMB_BITS;
+	}
+
+	for (; t && i < rn; i++)
+	{
+		t += r[i];
+		r[i] = (limb_t) t;
+		t >>= LIMB_BITS;
+	}
+
+	return (limb_t) t;
+}
+
+/* r -= a, with an <= rn; returns the borrow out of r */
+static limb_t limbs_sub(limb_t *r, size_t rn, const limb_t *a, size_t an)
+{
+	uint64_t	t;
+	limb_t	borrow = 0;
+	size_t	i;
+
+	for (i = 0; i < an; i++)
+	{
+		t = (uint64_t) r[i] - a[i] - borrow;
+		r[i] = (limb_t) t;
+		borrow = (t >> LIMB_BITS) & 1;
+	}
+
+	for (; borrow && i < rn; i++)
+		borrow = (r[i]-- == 0);
+
+	return borrow;
+}
+
+/* r = r * m + add over n limbs; returns the limb carried out */
+static limb_t limbs_mul_1(limb_t *r, size_t n, limb_t m, limb_t add)
+{
+	uint64_t	t = add;
+	size_t	i;
+
+	for (i = 0; i < n; i++)
+	{
+		t += (uint64_t) r[i] * m;
+		r[i] = (limb_t) t;
+		t >>= LIMB_BITS;
+	}
+
+	return (limb_t) t;
+}
+
+/* r += a * m over n limbs; returns the limb carried out */
+static limb_t limbs_mul_1_add(limb_t *r, const limb_t *a, size_t n, limb_t m)
+{
+	uint64_t	t = 0;
+	size_t	i;
+
+	for (i = 0; i < n; i++)
+	{
+		t += (uint64_t) a[i] * m + r[i];
+		r[i] = (limb_t) t;
+		t >>= LIMB_BITS;
+	}
+
+	return (limb_t) t;
+}
+
+/* r = r / d over n limbs; returns the remainder */
+static limb_t limbs_div_1(limb_t *r, size_t n, limb_t d)
+{
+	uint64_t	t = 0;
+
+	while (n--)
+	{
+		t = (t << LIMB_BITS) | r[n];
+		r[n] = (limb_t) (t / d);
+		t %= d;
+	}
+
+	return (limb_t) t;
+}
+
+/*
+ * r = a * b in an + bn limbs, r apart from a and b. Karatsuba on balanced
+ * operands, a long one is multiplied piece by piece.
+ */
+static void limbs_mul(limb_t *r, const limb_t *a, size_t an, const limb_t *b, size_t bn)
+{
+	limb_t	*t, *sa, *sb, *z1;
+	size_t	h, i, off, n, zn;
+
+	if (an < bn)
+	{
+		const limb_t	*x = a;
+
+		a = b;
+		b = x;
+		n = an;
+		an = bn;
+		bn = n;
+	}
+
+	memset(r, 0, (an + bn) * sizeof(limb_t));
+
+	if (!bn)
+		return;
+
+	if (bn < KARATSUBA_LIMBS)
+	{
+		for (i = 0; i < bn; i++)
+			r[an + i] = limbs_mul_1_add(r + i, a, an, b[i]);
+		return;
+	}
+
+	h = (an + 1) / 2;
+
+	/* unbalanced: one bn x bn product per piece of a */
+	if (bn <= h)
+	{
+		t = limbs_alloc(2 * bn);
+
+		for (off = 0; off < an; off += bn)
+		{
+			n = (an - off < bn) ? an - off : bn;
+			limbs_mul(t, a + off, n, b, bn);
+			limbs_add(r + off, an + bn - off, t, n + bn);
+		}
+
+		free(t);
+		return;
+	}
+
+	/* a = a1 * B^h + a0, b = b1 * B^h + b0; z1 = (a0 + a1)(b0 + b1) - z0 - z2 */
+	t = limbs_alloc(4 * h + 4);
+	sa = t;
+	sb = t + h + 1;
+	z1 = sb + h + 1;
+
+	memcpy(sa, a, h * sizeof(limb_t));
+	sa[h] = limbs_add(sa, h, a + h, an - h);
+	memcpy(sb, b, h * sizeof(limb_t));
+	sb[h] = limbs_add(sb, h, b + h, bn - h);
+
+	limbs_mul(z1, sa, h + 1, sb, h + 1);
+	limbs_mul(r, a, h, b, h);
+	limbs_mul(r + 2*h, a + h, an - h, b + h, bn - h);
+
+	limbs_sub(z1, 2*h + 2, r, 2*h);
+	limbs_sub(z1, 2*h + 2, r + 2*h, an + bn - 2*h);
+
+	zn = limbs_norm(z1, 2*h + 2);
+	limbs_add(r + h, an + bn - h, z1, zn);
+
+	free(t);
+}
+
+/* 10^(9*2^j) for every power up to j */
+static void number_powers(number_state_t *stat, int j)
+{
+	int	k;
+
+	if (j >= NUMBER_POWERS)
+		exit_error("The number is too long.");
+
+	for (k = 0; k <= j; k++)
+	{
+		if (stat->pow[k])
+			continue;
+
+		if (!k)
+		{
+			stat->pow[0] = limbs_alloc(1);
+			stat->pow[0][0] = DEC_GROUP;
+			stat->pow_len[0] = 1;
+			continue;
+		}
+
+		stat->pow[k] = limbs_alloc(2 * stat->pow_len[k-1]);
+		limbs_mul(stat->pow[k], stat->pow[k-1], stat->pow_len[k-1], stat->pow[k-1], stat->pow_len[k-1]);
+		stat->pow_len[k] = limbs_norm(stat->pow[k], 2 * stat->pow_len[k-1]);
+	}
+}
+
+/*
+ * floor(B^(2m) / d) for "d" of m limbs, in m + 2 limbs. The inverse of the
+ * top half of d, shifted into place, is correct to about half the limbs;
+ * one step of Newton's iteration x += x * (B^(2m) - d * x) / B^(2m)
+ * doubles that, and the last units are made exact one at a time.
+ */
+static limb_t *limbs_inverse(const limb_t *d, size_t m)
+{
+	size_t	xn = m + 2, pn = m + xn, h, en;
+	size_t	k;
+	limb_t	*x, *xh, *p, *e, *t, one = 1;
+	int	below;
+
+	x = limbs_alloc(xn);
+	p = limbs_alloc(pn + 1);
+	e = limbs_alloc(pn + 1);
+	memset(x, 0, xn * sizeof(limb_t));
+
+	if (m == 1)
+	{
+		uint64_t	q = UINT64_MAX / d[0];
+
+		if (UINT64_MAX % d[0] == d[0] - 1)
+			q++;
+		x[0] = (limb_t) q;
+		x[1] = (limb_t) (q >> LIMB_BITS);
+	} else if (m <= 4)
+	{
+		/* B^4 / (the top two limbs), at most 96 bits, is the top of x */
+		double	v = ldexp(1.0, 4 * LIMB_BITS) / ((double) d[m-1] * 4294967296.0 + d[m-2]);
+
+		x[m] = (limb_t) ldexp(v, -2 * LIMB_BITS);
+		v -= ldexp(x[m], 2 * LIMB_BITS);
+		x[m-1] = (limb_t) ldexp(v, -LIMB_BITS);
+		v -= ldexp(x[m-1], LIMB_BITS);
+		x[m-2] = (limb_t) v;
+	} else
+	{
+		h = m / 2 + 2;
+		xh = limbs_inverse(d + m - h, h);
+		memcpy(x + m - h, xh, (h + 2) * sizeof(limb_t));
+		free(xh);
+	}
+
+	/* Newton steps, e = |B^(2m) - d * x|: 64 correct bits from the estimate, the half from the inverse of the top */
+	for (k = (m <= 4) ? 2 * m : 1; k && m > 1; k /= 2)
+	{
+		limbs_mul(p, d, m, x, xn);
+		p[pn] = 0;
+		memset(e, 0, (pn + 1) * sizeof(limb_t));
+		e[2*m] = 1;
+		below = (limbs_cmp(p, pn + 1, e, pn + 1) <= 0);
+		if (below)
+			limbs_sub(e, pn + 1, p, pn + 1);
+		else
+		{
+			limbs_sub(p, pn + 1, e, pn + 1);
+			memcpy(e, p, (pn + 1) * sizeof(limb_t));
+		}
+
+		if ((en = limbs_norm(e, pn + 1)))
+		{
+			/* x +- x * e / B^(2m) */
+			t = limbs_alloc(xn + en);
+			limbs_mul(t, x, xn, e, en);
+			if (xn + en > 2*m)
+			{
+				if (below)
+					limbs_add(x, xn, t + 2*m, limbs_norm(t + 2*m, xn + en - 2*m));
+				else
+					limbs_sub(x, xn, t + 2*m, limbs_norm(t + 2*m, xn + en - 2*m));
+			}
+			free(t);
+		}
+	}
+
+	/* the last units: d * x <= B^(2m) < d * (x + 1) */
+	limbs_mul(p, d, m, x, xn);
+	p[pn] = 0;
+	memset(e, 0, (pn + 1) * sizeof(limb_t));
+	e[2*m] = 1;
+
+	while (limbs_cmp(p, pn + 1, e, pn + 1) > 0)
+	{
+		limbs_sub(p, pn + 1, d, m);
+		limbs_sub(x, xn, &one, 1);
+	}
+
+	limbs_sub(e, pn + 1, p, pn + 1);
+	while (limbs_cmp(e, pn + 1, d, m) >= 0)
+	{
+		limbs_sub(e, pn + 1, d, m);
+		limbs_add(x, xn, &one, 1);
+	}
+
+	free(p);
+	free(e);
+
+	return x;
+}
+
+/* inv[j], the inverse of 10^(9*2^j) for number_divmod() */
+static void number_inverse(number_state_t *stat, int j)
+{
+	if (stat->inv[j])
+		return;
+
+	stat->inv[j] = limbs_inverse(stat->pow[j], stat->pow_len[j]);
+	stat->inv_len[j] = limbs_norm(stat->inv[j], stat->pow_len[j] + 2);
+}
+
+/*
+ * Decimal digits to binary in (len + 8) / 9 limbs at "r", all of them
+ * written; returns the limbs without the leading zero ones. Long strings
+ * are split in halves, the low half 9*2^j digits: r = hi * 10^(9*2^j) + lo.
+ */
+static size_t number_from_dec(number_state_t *stat, limb_t *r, const char *s, size_t len)
+{
+	size_t	cap = (len + DEC_GROUP_DIGITS - 1) / DEC_GROUP_DIGITS, n = 0, g, lo_len, hn, pn;
+	limb_t	*hi, *prod, carry;
+	int	j;
+
+	if (len <= DEC_BASE_DIGITS)
+	{
+		memset(r, 0, cap * sizeof(limb_t));
+
+		/* the first group takes the digits over whole groups */
+		g = len % DEC_GROUP_DIGITS ? len % DEC_GROUP_DIGITS : DEC_GROUP_DIGITS;
+		for (; len; s += g, len -= g, g = DEC_GROUP_DIGITS)
+			if ((carry = limbs_mul_1(r, n, DEC_GROUP, number_group(s, g))))
+				r[n++] = carry;
+
+		return n;
+	}
+
+	for (j = 0; ((size_t) DEC_GROUP_DIGITS << (j + 1)) < len; j++);
+	lo_len = (size_t) DEC_GROUP_DIGITS << j;
+	number_powers(stat, j);
+
+	hi = limbs_alloc((len - lo_len + DEC_GROUP_DIGITS - 1) / DEC_GROUP_DIGITS);
+	hn = number_from_dec(stat, hi, s, len - lo_len);
+	prod = limbs_alloc(hn + stat->pow_len[j]);
+	limbs_mul(prod, hi, hn, stat->pow[j], stat->pow_len[j]);
+	pn = limbs_norm(prod, hn + stat->pow_len[j]);
+
+	number_from_dec(stat, r, s + len - lo_len, lo_len);
+	memset(r + ((size_t) 1 << j), 0, (cap - ((size_t) 1 << j)) * sizeof(limb_t));
+	limbs_add(r, cap, prod, pn);
+
+	free(hi);
+	free(prod);
+
+	return limbs_norm(r, cap);
+}
+
+/*
+ * q = a / 10^(9*2^j) and r = the remainder, for "a" of at most twice the
+ * limbs of the divisor d (Barrett): q' = (a / B^(m-1)) * inv / B^(m+1) is
+ * at most 2 short of q. "q" takes an - m + 3 limbs, "r" m limbs.
+ */
+static void number_divmod(number_state_t *stat, int j, const limb_t *a, size_t an, limb_t *q, size_t *qn, limb_t *r, size_t *rn)
+{
+	const limb_t	*d = stat->pow[j], *inv = stat->inv[j];
+	size_t	m = stat->pow_len[j], vn = stat->inv_len[j], tn, n;
+	limb_t	*t, *rem, one = 1;
+
+	t = limbs_alloc(an + vn + m + 3);
+	rem = limbs_alloc(an);
+
+	/* q' */
+	n = an - (m - 1);
+	limbs_mul(t, a + m - 1, n, inv, vn);
+	tn = n + vn;
+	*qn = (tn > m + 1) ? tn - (m + 1) : 0;
+	memcpy(q, t + m + 1, *qn * sizeof(limb_t));
+	q[*qn] = q[*qn + 1] = 0;
+	*qn = limbs_norm(q, *qn);
+
+	/* a - q' * d, then the last steps */
+	limbs_mul(t, q, *qn, d, m);
+	memcpy(rem, a, an * sizeof(limb_t));
+	limbs_sub(rem, an, t, limbs_norm(t, *qn + m));
+
+	while (limbs_cmp(rem, an, d, m) >= 0)
+	{
+		limbs_sub(rem, an, d, m);
+		limbs_add(q, *qn + 2, &one, 1);
+	}
+
+	*qn = limbs_norm(q, *qn + 2);
+	*rn = limbs_norm(rem, an);
+	memcpy(r, rem, *rn * sizeof(limb_t));
+
+	free(t);
+	free(rem);
+}
+
+/*
+ * Binary to exactly "width" decimal digits with leading zeros, a < 10^width;
+ * "a" is used up. Large numbers are split by 10^(9*2^j) of about half
+ * their size and both parts converted on their own.
+ */
+static void number_to_dec(number_state_t *stat, char *out, limb_t *a, size_t an, size_t width)
+{
+	limb_t	*q, *r, g;
+	size_t	qn, rn, lo_len;
+	char	*p;
+	int	j, k;
+
+	an = limbs_norm(a, an);
+
+	if (an <= DEC_BASE_LIMBS)
+	{
+		for (p = out + width; an; an = limbs_norm(a, an))
+		{
+			g = limbs_div_1(a, an, DEC_GROUP);
+			for (k = 0; k < DEC_GROUP_DIGITS && p > out; k++, g /= 10)
+				*--p = '0' + g % 10;
+		}
+		memset(out, '0', p - out);
+		return;
+	}
+
+	/* the smallest power of at least half the limbs, which is below a */
+	for (j = 0; ; j++)
+	{
+		number_powers(stat, j);
+		if (2 * stat->pow_len[j] >= an)
+			break;
+	}
+	number_inverse(stat, j);
+
+	q = limbs_alloc(an - stat->pow_len[j] + 3);
+	r = limbs_alloc(stat->pow_len[j]);
+	number_divmod(stat, j, a, an, q, &qn, r, &rn);
+
+	lo_len = (size_t) DEC_GROUP_DIGITS << j;
+	number_to_dec(stat, out, q, qn, width - lo_len);
+	number_to_dec(stat, out + width - lo_len, r, rn, lo_len);
+
+	free(q);
+	free(r);
+}
+
+/* Digits of "bits" bits each, 4 - hex, 3 - octal, of a binary number */
+static char *number_put_bits(char *out, const limb_t *a, size_t an, int bits)
+{
+	size_t	total, k, bit;
+	uint64_t	w;
+
+	if (!(an = limbs_norm(a, an)))
+	{
+		*out++ = '0';
+		return out;
+	}
+
+	total = an * LIMB_BITS - __builtin_clz(a[an-1]);
+
+	for (k = (total + bits - 1) / bits; k-- > 0; )
+	{
+		bit = k * bits;
+		w = a[bit / LIMB_BITS];
+		if (bit / LIMB_BITS + 1 < an)
+			w |= (uint64_t) a[bit / LIMB_BITS + 1] << LIMB_BITS;
+		*out++ = number_digits[(w >> (bit % LIMB_BITS)) & ((1 << bits) - 1)];
+	}
+
+	return out;
+}
+
+/* A number of 64 bits in hex or octal */
+static char *number_put_word(char *out, uint64_t v, int bits)
+{
+	int	n = v ? (64 - __builtin_clzll(v) + bits - 1) / bits : 1;
+	char	*p = out + n;
+
+	while (p > out)
+	{
+		*--p = number_digits[v & ((1 << bits) - 1)];
+		v >>= bits;
+	}
+
+	return out + n;
+}
+
+/* A number of 64 bits in decimal */
+static char *number_put_decimal(char *out, uint64_t v)
+{
+	char	buf[20], *p = buf + sizeof(buf);
+	size_t	n;
+
+	do
+	{
+		*--p = '0' + v % 10;
+		v /= 10;
+	} while (v);
+
+	n = buf + sizeof(buf) - p;
+	memcpy(out, p, n);
+
+	return out + n;
+}
+
+/* A number kept as text, converted in limbs */
+static char *number_put_big(number_state_t *stat, char *out)
+{
+	size_t	an, i, k, width;
+	limb_t	*a, v;
+	char	*dec, *p;
+
+	if (stat->format != NUMBER_DEC)
+	{
+		a = limbs_alloc((stat->big_len + DEC_GROUP_DIGITS - 1) / DEC_GROUP_DIGITS);
+		an = number_from_dec(stat, a, stat->big, stat->big_len);
+		out = number_put_bits(out, a, an, (stat->format == NUMBER_OCT) ? 3 : 4);
+		free(a);
+		return out;
+	}
+
+	/* 8 hex digits per limb, from the lowest */
+	an = (stat->big_len + 7) / 8;
+	a = limbs_alloc(an);
+	for (i = 0; i < an; i++)
+	{
+		p = stat->big + stat->big_len - 8*i;
+		for (v = 0, k = (8*i + 8 <= stat->big_len) ? 8 : stat->big_len - 8*i; k; k--)
+			v = (v << 4) | number_digit(*(p - k), 1);
+		a[i] = v;
+	}
+
+	/* 32 bits take less than 10 decimal digits */
+	width = an * 10;
+	dec = number_alloc(width);
+	number_to_dec(stat, dec, a, an, width);
+	for (p = dec; p < dec + width - 1 && *p == '0'; p++);
+	memcpy(out, p, dec + width - p);
+	out += dec + width - p;
+
+	free(dec);
+	free(a);
+
+	return out;
+}
+
+/* Keep the digits of the number beyond 64 bits as text */
+static void number_keep(number_state_t *stat, const unsigned char *s, size_t n)
+{
+	if (stat->big_len + n > stat->big_size)
+	{
+		stat->big_size = (stat->big_len + n) * 2;
+		if (!(stat->big = realloc(stat->big, stat->big_size)))
+			exit_error("Not enough memory.");
+	}
+
+	memcpy(stat->big + stat->big_len, s, n);
+	stat->big_len += n;
+}
+
+/* The next "n" digits of the number */
+static void number_take(number_state_t *stat, const unsigned char *s, size_t n)
+{
+	const int	hex = (stat->format == NUMBER_DEC);
+	char	word[20];
+	uint64_t	v;
+
+	if (n && stat->chars < 2)
+		stat->chars += (n > 1) ? 2 : 1;
+
+	/* leading zeros add nothing */
+	if (!stat->digits && !stat->big_len)
+		while (n && *s == '0')
+			s++, n--;
+
+	if (!n)
+		return;
+
+	if (stat->big_len)
+	{
+		number_keep(stat, s, n);
+		return;
+	}
+
+	/* longer than 64 bits: the digits so far go to the text */
+	if (stat->digits + n > (hex ? 16 : 19))
+	{
+		char	*end = hex ? number_put_word(word, stat->value, 4) : number_put_decimal(word, stat->value);
+
+		if (stat->digits)
+			number_keep(stat, (unsigned char *) word, end - word);
+		number_keep(stat, s, n);
+		return;
+	}
+
+	stat->digits += n;
+	v = stat->value;
+
+	if (hex)
+	{
+		while (n--)
+			v = (v << 4) | number_digit(*s++, 1);
+	} else
+	{
+		for (; n >= 8; s += 8, n -= 8)
+			v = v * 100000000 + number_eight((const char *) s);
+		while (n--)
+			v = v * 10 + (*s++ - '0');
+	}
+
+	stat->value = v;
+}
+
+/* The value of the number just ended */
+static char *number_put(number_state_t *stat, char *out)
+{
+	if (stat->written)
+	{
+		memcpy(out, stat->eol, stat->eol_len);
+		out += stat->eol_len;
+	}
+	stat->written = 1;
+
+	if (stat->neg && (stat->value || stat->big_len))
+		*out++ = '-';
+
+	if (stat->big_len)
+		out = number_put_big(stat, out);
+	else if (stat->format == NUMBER_DEC)
+		out = number_put_decimal(out, stat->value);
+	else
+		out = number_put_word(out, stat->value, (stat->format == NUMBER_OCT) ? 3 : 4);
+
+	stat->in_token = 0;
+	stat->minus = 0;
+
+	return out;
+}
+
+static void number_free(number_state_t *stat)
+{
+	int	j;
+
+	for (j = 0; j < NUMBER_POWERS; j++)
+	{
+		free(stat->pow[j]);
+		free(stat->inv[j]);
+		stat->pow[j] = stat->inv[j] = NULL;
+	}
+
+	free(stat->big);
+	stat->big = NULL;
+	stat->big_size = 0;
+}
+
+void number_init(number_state_t *stat, int format, const char *eol)
+{
+	memset(stat, 0, sizeof(number_state_t));
+	stat->format = format;
+	stat->eol = eol ? eol : "\n";
+	stat->eol_len = strlen(stat->eol);
+}
+
+/*
+ * Most bytes number_convert() writes for the next "len" input bytes: a
+ * number of d digits takes at most 2d digits in any base, its sign and a
+ * new line, and needs d input bytes and a separator.
+ */
+size_t number_bound(const number_state_t *stat, size_t len)
+{
+	size_t	pending = !stat->in_token ? 0 : stat->big_len ? stat->big_len : (size_t) stat->digits + 1;
+
+	return (pending + len + 1) * (3 + stat->eol_len);
+}
+
+/*
+ * Convert the numbers in the next chunk of the stream into "out", which
+ * must hold number_bound() bytes; mode != 0 marks the last chunk.
+ * Returns the number of bytes written.
+ */
+size_t number_convert(number_state_t *stat, char *out, const unsigned char *in, size_t len, int mode)
+{
+	const int	hex = (stat->format == NUMBER_DEC);
+	const unsigned char	*end = in + len;
+	char	*p = out;
+	size_t	n;
+
+	while (in < end)
+	{
+		if (!stat->in_token)
+		{
+			for (; in < end && number_digit(*in, hex) < 0; in++)
+				stat->minus = (*in == '-');
+
+			if (in == end)
+				break;
+
+			stat->in_token = 1;
+			stat->neg = stat->minus;
+			stat->chars = stat->digits = 0;
+			stat->value = 0;
+			stat->big_len = 0;
+		}
+
+		n = number_run(in, end - in, hex);
+		number_take(stat, in, n);
+		in += n;
+
+		if (in == end)
+			break;
+
+		/* "0x" before hex digits */
+		if (hex && stat->chars == 1 && !stat->value && (*in | 0x20) == 'x')
+		{
+			stat->chars = 2;
+			in++;
+			continue;
+		}
+
+		p = number_put(stat, p);
+	}
+
+	if (mode)
+	{
+		if (stat->in_token)
+			p = number_put(stat, p);
+		else if (!stat->written)
+			p = number_put(stat, p);	/* no number at all is 0, as atoi() made it */
+		number_free(stat);
+	}
+
+	return p - out;
+}
@@ -0,0 +1,40 @@
+#ifndef __NUMBER_H
+#define __NUMBER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* number minor modes (major mode 10) */
+#define NUMBER_HEX	0	/* -n: decimal numbers to hex */
+#define NUMBER_OCT	1	/* -no: decimal numbers to octal */
+#define NUMBER_DEC	2	/* -dn: hex numbers back to decimal */
+
+#define NUMBER_POWERS	48	/* 10^(9*2^j) kept for the big numbers, j < NUMBER_POWERS */
+
+typedef struct {
+	int	format;
+	const char	*eol;			/* written between the values */
+	size_t	eol_len;
+	int	written;			/* a value has been written */
+
+	int	in_token;			/* the digits of a number are being read */
+	int	minus;				/* the last character was '-' */
+	int	neg;				/* the number has a minus sign */
+	int	chars;				/* digit characters of the number, counted up to 2 */
+	uint64_t	value;			/* the number while it fits in 64 bits */
+	int	digits;				/* significant digits in "value" */
+	char	*big;				/* all the significant digits of a longer number */
+	size_t	big_len;			/* 0 - the number is in "value" */
+	size_t	big_size;
+
+	uint32_t	*pow[NUMBER_POWERS];	/* 10^(9*2^j), squared from 10^9 when first needed */
+	size_t	pow_len[NUMBER_POWERS];
+	uint32_t	*inv[NUMBER_POWERS];	/* floor(2^(64*pow_len[j]) / pow[j]), for the divisions of -dn */
+	size_t	inv_len[NUMBER_POWERS];
+} number_state_t;
+
+void number_init(number_state_t *stat, int format, const char *eol);
+size_t number_bound(const number_state_t *stat, size_t len);
+size_t number_convert(number_state_t *stat, char *out, const unsigned char *in, size_t len, int mode);
+
+#endif
@@ -0,0 +1,347 @@
+/*
+ * pipeline.c
+ * This file is part of str2hex project.
+ *
+ * Copyright 2005 Dzmitry Plashchynski <plashchynski@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Reader -> encoders -> writer pipeline for inputs that can't be mapped.
+ *
+ * Every encoder owns PIPE_BLOCKS blocks (an input buffer and an output
+ * buffer) that travel in a circle through three single-producer
+ * single-consumer rings: "work" from the reader to the encoder, "done"
+ * from the encoder to the writer and "free" from the writer back to the
+ * reader. The reader and the writer visit the encoders in the same
+ * round-robin order, so the output comes out in input order without any
+ * lock. Every ring has room for all the blocks of its encoder, so a push
+ * never waits; only an empty ring makes its consumer wait.
+ *
+ * Modes that can be cut (encoder_align()) get one encoder per thread and
+ * full blocks aligned for the mode, converted like the segments of a
+ * large file. The rest get one encoder that keeps its state from block
+ * to block; reading and writing still overlap with the conversion.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifndef WIN32
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "main.h"
+#include "pipeline.h"
+#include "process.h"
+#include "convert.h"
+#include "encode.h"
+#include "io.h"
+#include "pool.h"
+
+#define PIPE_BLOCKS	4	/* blocks circulating per encoder */
+#define PIPE_RING	8	/* ring slots, a power of 2 not smaller than PIPE_BLOCKS */
+
+typedef struct {
+	unsigned char	*in;
+	size_t	len;
+	unsigned long long	offset;		/* position of the block in the input */
+	int	last;				/* the end of the input */
+	io_out_t	out;			/* converted data, kept in memory */
+} pipe_block_t;
+
+/* head and tail on their own cache lines, so producer and consumer don't share one */
+typedef struct {
+	unsigned	head;
+	char	pad1[64 - sizeof(unsigned)];
+	unsigned	tail;
+	char	pad2[64 - sizeof(unsigned)];
+	pipe_block_t	*slot[PIPE_RING];
+#ifndef WIN32
+	int	sleeping;			/* the consumer waits on "wake" */
+	pthread_mutex_t	lock;
+	pthread_cond_t	wake;
+#endif
+} pipe_ring_t;
+
+typedef struct {
+	struct _config	*config;
+	io_out_t	*out;
+	int	encoders;
+	int	stateful;			/* one encoder keeping its state */
+	size_t	block_size;
+	pipe_ring_t	*work, *done, *free;	/* one of each per encoder */
+	pipe_block_t	*blocks;
+} pipeline_t;
+
+typedef struct {
+	pipeline_t	*pl;
+	int	k;
+} pipe_worker_t;
+
+#ifndef WIN32
+
+static void ring_init(pipe_ring_t *ring)
+{
+	pthread_mutex_init(&ring->lock, NULL);
+	pthread_cond_init(&ring->wake, NULL);
+}
+
+static void ring_destroy(pipe_ring_t *ring)
+{
+	pthread_mutex_destroy(&ring->lock);
+	pthread_cond_destroy(&ring->wake);
+}
+
+static void ring_push(pipe_ring_t *ring, pipe_block_t *block)
+{
+	unsigned	tail = ring->tail;
+
+	ring->slot[tail & (PIPE_RING - 1)] = block;
+
+	/* sequentially consistent with the "sleeping" of ring_pop(): one of the two sees the other */
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&ring->sleeping, __ATOMIC_SEQ_CST))
+	{
+		pthread_mutex_lock(&ring->lock);
+		pthread_cond_signal(&ring->wake);
+		pthread_mutex_unlock(&ring->lock);
+	}
+}
+
+/* Spin a little, then give the CPU away, then block until ring_push(): an idle stage must not burn a core */
+static pipe_block_t *ring_pop(pipe_ring_t *ring)
+{
+	unsigned	head = ring->head;
+	pipe_block_t	*block;
+	int	spins = 0;
+
+	while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head)
+	{
+		if (++spins < 64)
+		{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+			__builtin_ia32_pause();
+#endif
+		} else if (spins < 256)
+			sched_yield();
+		else
+		{
+			pthread_mutex_lock(&ring->lock);
+			__atomic_store_n(&ring->sleeping, 1, __ATOMIC_SEQ_CST);
+
+			while (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == head)
+				pthread_cond_wait(&ring->wake, &ring->lock);
+
+			__atomic_store_n(&ring->sleeping, 0, __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&ring->lock);
+		}
+	}
+
+	block = ring->slot[head & (PIPE_RING - 1)];
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	return block;
+}
+
+static void *pipe_encoder(void *arg)
+{
+	pipeline_t	*pl = ((pipe_worker_t *) arg)->pl;
+	int	k = ((pipe_worker_t *) arg)->k;
+	pipe_block_t	*block;
+	encoder_t	enc;
+	int	last;
+
+	if (pl->stateful)
+		encoder_init(&enc, pl->config);
+
+	do
+	{
+		block = ring_pop(&pl->work[k]);
+		last = block->last;
+
+		if (pl->stateful)
+		{
+			convert_span(&enc, block->in, block->len, &block->out);
+			if (last)
+				convert_finish(&enc, &block->out);
+		} else if (block->len || last)
+			convert_memory(pl->config, block->in, block->len, &block->out, block->offset, last);
+
+		ring_push(&pl->done[k], block);
+	} while (!last);
+
+	return NULL;
+}
+
+static void *pipe_writer(void *arg)
+{
+	pipeline_t	*pl = arg;
+	pipe_block_t	*block;
+	int	k, last;
+
+	for (k = 0; ; k = (k + 1) % pl->encoders)
+	{
+		block = ring_pop(&pl->done[k]);
+		last = block->last;
+
+		io_write(pl->out, block->out.buf, block->out.len);
+		block->out.len = 0;
+
+		/* the end markers of the other encoders are never written */
+		if (last)
+			return NULL;
+
+		ring_push(&pl->free[k], block);
+	}
+}
+
+/* The reader: fill blocks in round-robin order until the end of the input */
+static void pipe_read(pipeline_t *pl, int in_fd)
+{
+	unsigned long long	offset = 0;
+	pipe_block_t	*block;
+	long	n = 1;
+	int	i, k;
+
+	for (k = 0; n > 0; k = (k + 1) % pl->encoders)
+	{
+		block = ring_pop(&pl->free[k]);
+
+		/* full blocks keep the chunks and segments of a sequential run */
+		for (block->len = 0; block->len < pl->block_size; block->len += n)
+			if ((n = io_read(in_fd, block->in + block->len, pl->block_size - block->len)) <= 0)
+				break;
+
+		if (n < 0)
+			exit_error("Can\'t read the input file.");
+
+		block->offset = offset;
+		block->last = (n == 0);
+		offset += block->len;
+
+		ring_push(&pl->work[k], block);
+	}
+
+	/* every other encoder gets an empty last block to stop on, k is already past the end of the data */
+	for (i = 1; i < pl->encoders; i++, k = (k + 1) % pl->encoders)
+	{
+		block = ring_pop(&pl->free[k]);
+		block->len = 0;
+		block->last = 1;
+		ring_push(&pl->work[k], block);
+	}
+}
+
+#endif
+
+int pipeline_run(struct _config *config, int in_fd, io_out_t *out)
+{
+#ifndef WIN32
+	pipeline_t	pl;
+	pipe_worker_t	*workers;
+	pthread_t	*tid, writer;
+	struct stat	st;
+	size_t	align = encoder_align(config);
+	int	i, k, count;
+
+	/* by default only where nothing better exists: pipes and terminals on several cores */
+	if (config->io != IO_PIPELINE && (config->io != IO_AUTO || config->threads < 2 ||
+		fstat(in_fd, &st) || S_ISREG(st.st_mode)))
+			return -1;
+
+	memset(&pl, 0, sizeof(pl));
+	pl.config = config;
+	pl.out = out;
+	pl.stateful = !align;
+	pl.encoders = align ? config->threads : 1;
+	pl.block_size = config->bufsize * (align ? align : 1);
+	count = pl.encoders * PIPE_BLOCKS;
+
+	pl.work = calloc(pl.encoders, sizeof(pipe_ring_t));
+	pl.done = calloc(pl.encoders, sizeof(pipe_ring_t));
+	pl.free = calloc(pl.encoders, sizeof(pipe_ring_t));
+	pl.blocks = calloc(count, sizeof(pipe_block_t));
+	workers = calloc(pl.encoders, sizeof(pipe_worker_t));
+	tid = calloc(pl.encoders, sizeof(pthread_t));
+
+	if (!pl.work || !pl.done || !pl.free || !pl.blocks || !workers || !tid)
+		exit_error("Not enough memory.");
+
+	for (k = 0; k < pl.encoders; k++)
+	{
+		ring_init(&pl.work[k]);
+		ring_init(&pl.done[k]);
+		ring_init(&pl.free[k]);
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		pipe_block_t	*block = &pl.blocks[i];
+
+		block->in = pool_get(pl.block_size);
+
+		io_out_init(&block->out, -1, convert_output_size(config, pl.block_size, NULL) + CONVERT_SLACK);
+		ring_push(&pl.free[i % pl.encoders], block);
+	}
+
+	/* settle the CPU dispatch before the encoders race for it */
+	encoder_dispatch();
+
+	for (k = 0; k < pl.encoders; k++)
+	{
+		workers[k].pl = &pl;
+		workers[k].k = k;
+
+		if (pthread_create(&tid[k], NULL, pipe_encoder, &workers[k]))
+			exit_error("Can\'t start a worker thread.");
+	}
+
+	if (pthread_create(&writer, NULL, pipe_writer, &pl))
+		exit_error("Can\'t start a worker thread.");
+
+	pipe_read(&pl, in_fd);
+
+	pthread_join(writer, NULL);
+	for (k = 0; k < pl.encoders; k++)
+		pthread_join(tid[k], NULL);
+
+	for (i = 0; i < count; i++)
+	{
+		pool_put(pl.blocks[i].in);
+		io_out_free(&pl.blocks[i].out);
+	}
+
+	for (k = 0; k < pl.encoders; k++)
+	{
+		ring_destroy(&pl.work[k]);
+		ring_destroy(&pl.done[k]);
+		ring_destroy(&pl.free[k]);
+	}
+
+	free(pl.work);
+	free(pl.done);
+	free(pl.free);
+	free(pl.blocks);
+	free(workers);
+	free(tid);
+
+	return 0;
+#else
+	return -1;
+#endif
+}
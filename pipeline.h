@@ -0,0 +1,11 @@
+#ifndef __PIPELINE_H
+#define __PIPELINE_H
+
+#include "main.h"
+#include "io.h"
+
+/* Convert "in_fd" on reader, encoder and writer threads.
+ * Returns -1 when the pipeline isn't wanted for this input, 0 when done. */
+int pipeline_run(struct _config *config, int in_fd, io_out_t *out);
+
+#endif
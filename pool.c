@@ -0,0 +1,222 @@
+/*
+ * pool.c
+ * This file is part of str2hex project.
+ *
+ * Copyright 2005 Dzmitry Plashchynski <plashchynski@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Buffer pool.
+ *
+ * Read buffers and output buffers are recycled instead of going back to
+ * the allocator, so a run over many files or segments works in the
+ * buffers of the earlier ones, which are already faulted in. Buffers come
+ * in POOL_STEPS sizes from every power of 2 to the next (64k, 80k, 96k,
+ * 112k, 128k, 160k...), so one is at most a quarter larger than asked
+ * for, with one free list per size, shared by all threads: a worker takes
+ * an output buffer and the writer gives it back.
+ *
+ * With -thp the buffers of POOL_HUGE bytes and more are mapped on a huge
+ * page boundary and advised as transparent huge pages, which takes the
+ * page faults and TLB misses of the large buffers down by a factor of 512.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <pthread.h>
+#include <sys/mman.h>
+#endif
+
+#include "main.h"
+#include "pool.h"
+
+#define POOL_SHIFT	16		/* POOL_MIN is 1 << POOL_SHIFT */
+#define POOL_STEP_SHIFT	2
+#define POOL_STEPS	(1 << POOL_STEP_SHIFT)	/* sizes per power of 2 */
+#define POOL_CLASSES	(32 * POOL_STEPS)	/* buffers below 2^48 bytes */
+#define POOL_HEADER	64		/* keeps the data cache line aligned */
+
+typedef struct pool_buf {
+	size_t	size;				/* capacity after the header */
+	void	*map;				/* start of the mapping, NULL - from malloc() */
+	size_t	map_size;
+	struct pool_buf	*next;			/* free list link */
+} pool_buf_t;
+
+static pool_buf_t	*pool_free[POOL_CLASSES];
+static size_t	pool_cached;			/* bytes in the free lists */
+static int	pool_thp;
+
+#ifndef WIN32
+static pthread_mutex_t	pool_lock = PTHREAD_MUTEX_INITIALIZER;
+#define POOL_LOCK()	pthread_mutex_lock(&pool_lock)
+#define POOL_UNLOCK()	pthread_mutex_unlock(&pool_lock)
+#else
+#define POOL_LOCK()
+#define POOL_UNLOCK()
+#endif
+
+#define POOL_BUF(data)	((pool_buf_t *) ((char *) (data) - POOL_HEADER))
+#define POOL_DATA(b)	((char *) (b) + POOL_HEADER)
+
+void pool_huge(int enable)
+{
+	pool_thp = enable;
+}
+
+/* Capacity of the buffers of class "c": POOL_MIN * (1 + (c % POOL_STEPS) / POOL_STEPS) * 2^(c / POOL_STEPS) */
+static size_t pool_class_size(int c)
+{
+	return (size_t) (POOL_STEPS + c % POOL_STEPS) << (POOL_SHIFT + c / POOL_STEPS - POOL_STEP_SHIFT);
+}
+
+/* Free list holding the smallest buffers of at least "size" bytes */
+static int pool_class(size_t size)
+{
+	int	k = POOL_SHIFT, c;
+
+	if (size <= POOL_MIN)
+		return 0;
+
+	/* 2^k < size <= 2^(k+1), taken in steps of 2^k / POOL_STEPS */
+	while (((size_t) 2 << k) < size)
+		if (++k + 1 >= (int) (8 * sizeof(size_t)))
+			exit_error("Not enough memory.");
+
+	c = (k - POOL_SHIFT) * POOL_STEPS + (int) ((size - ((size_t) 1 << k) - 1) >> (k - POOL_STEP_SHIFT)) + 1;
+
+	if (c >= POOL_CLASSES)
+		exit_error("Not enough memory.");
+
+	return c;
+}
+
+static pool_buf_t *pool_alloc(size_t size)
+{
+	pool_buf_t	*b = NULL;
+
+#if !defined(WIN32) && defined(MADV_HUGEPAGE)
+	if (pool_thp && size >= POOL_HUGE)
+	{
+		/* one huge page more, so the data can start on a huge page boundary */
+		size_t	map_size = POOL_HEADER + size + POOL_HUGE;
+		char	*map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (map != MAP_FAILED)
+		{
+			char	*data = (char *) (((unsigned long) map + POOL_HEADER + POOL_HUGE - 1) & ~((unsigned long) POOL_HUGE - 1));
+
+			madvise(data, size, MADV_HUGEPAGE);
+
+			b = POOL_BUF(data);
+			b->map = map;
+			b->map_size = map_size;
+		}
+	}
+#endif
+
+	if (!b)
+	{
+		if (!(b = malloc(POOL_HEADER + size)))
+			exit_error("Not enough memory.");
+		b->map = NULL;
+	}
+
+	b->size = size;
+	b->next = NULL;
+
+	return b;
+}
+
+static void pool_release(pool_buf_t *b)
+{
+#ifndef WIN32
+	if (b->map)
+	{
+		munmap(b->map, b->map_size);
+		return;
+	}
+#endif
+	free(b);
+}
+
+void *pool_get(size_t size)
+{
+	int	c = pool_class(size);
+	pool_buf_t	*b;
+
+	POOL_LOCK();
+	if ((b = pool_free[c]))
+	{
+		pool_free[c] = b->next;
+		pool_cached -= b->size;
+	}
+	POOL_UNLOCK();
+
+	if (!b)
+		b = pool_alloc(pool_class_size(c));
+
+	return POOL_DATA(b);
+}
+
+size_t pool_size(void *buf)
+{
+	return POOL_BUF(buf)->size;
+}
+
+void *pool_grow(void *buf, size_t used, size_t size)
+{
+	void	*grown;
+
+	if (!buf)
+		return pool_get(size);
+
+	if (pool_size(buf) >= size)
+		return buf;
+
+	grown = pool_get(size);
+	memcpy(grown, buf, used);
+	pool_put(buf);
+
+	return grown;
+}
+
+void pool_put(void *buf)
+{
+	pool_buf_t	*b;
+	int	c;
+
+	if (!buf)
+		return;
+
+	b = POOL_BUF(buf);
+	c = pool_class(b->size);
+
+	POOL_LOCK();
+	if (pool_cached + b->size <= POOL_CACHE)
+	{
+		b->next = pool_free[c];
+		pool_free[c] = b;
+		pool_cached += b->size;
+		b = NULL;
+	}
+	POOL_UNLOCK();
+
+	/* the free lists are full */
+	if (b)
+		pool_release(b);
+}
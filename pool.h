@@ -0,0 +1,25 @@
+#ifndef __POOL_H
+#define __POOL_H
+
+#include <stddef.h>
+
+#define POOL_MIN	(64 * 1024)		/* smallest buffer handed out */
+#define POOL_HUGE	(2 * 1024 * 1024)	/* huge page size; buffers this large may be backed by them */
+#define POOL_CACHE	(512 * 1024 * 1024)	/* most memory kept in the free lists */
+
+/* Back large buffers with transparent huge pages from now on */
+void pool_huge(int enable);
+
+/* A buffer of at least "size" bytes; exits when out of memory */
+void *pool_get(size_t size);
+
+/* Capacity of a buffer from pool_get() */
+size_t pool_size(void *buf);
+
+/* A larger buffer keeping the first "used" bytes, like realloc() */
+void *pool_grow(void *buf, size_t used, size_t size);
+
+/* Give a buffer back for reuse; NULL is ignored */
+void pool_put(void *buf);
+
+#endif
@@ -25,618 +25,662 @@
 #include "process.h"
 #include "md5.h"
 #include "b64.h"
+#include "encode.h"
+#include "decode.h"
 
 
-char *process(unsigned char *buf, size_t *out_size, size_t len, struct _config *config, int mode)
+/* what the -i, -e and -q filters make of a byte */
+#define FILTER_COPY	0	/* written as it is */
+#define FILTER_DROP	1	/* -e: left out */
+#define FILTER_ENCODE	2
+#define FILTER_NEWLINE	3	/* -q on WIN32: CR or LF, a line break when the next byte completes a CRLF or LFCR pair */
+
+/*
+ * Compile the -i/-e/-q sets into what becomes of every byte value, in the
+ * order the filters apply, and the classes of the bytes that end a run of
+ * copied and of converted bytes, so that the filters cost nothing per byte.
+ */
+static void encoder_filter_init(encoder_t *enc)
 {
-	static	int	gcount	= 0;
-	register  int	i = 0;
-	char	*out_buffer = NULL;
-	static int ide=0;
+	struct _config	*config = enc->config;
+	int	c, act;
 
-	gcount++;
+	for (c = 0; c < 256; c++)
+	{
+		if (config->exclude_symbols_size && memchr(config->exclude_symbols, c, config->exclude_symbols_size))
+			act = FILTER_DROP;
+		else if (config->include_symbols_size && !memchr(config->include_symbols, c, config->include_symbols_size))
+			act = FILTER_COPY;
+#ifdef WIN32
+		else if (config->nlign && (c == '\n' || c == '\r'))
+			act = FILTER_NEWLINE;
+#else
+		else if (config->nlign && c == '\n')
+			act = FILTER_COPY;
+#endif
+		else if (enc->table.escape && !ENCODE_CLASS_HAS(&enc->table.special, c))
+			act = FILTER_COPY;
+		else
+			act = FILTER_ENCODE;
 
-	/* Base64 */
-	if (config->mode == 7)
+		enc->filter[c] = act;
+
+		if (act != FILTER_COPY)
+			encode_class_add(&enc->stop, c);
+		if (act != FILTER_ENCODE)
+			encode_class_add(&enc->pass, c);
+	}
+}
+
+/* Set up a fresh conversion stream for the mode selected in "config" */
+void encoder_init(encoder_t *enc, struct _config *config)
+{
+	memset(enc, 0, sizeof(encoder_t));
+	enc->config = config;
+
+	switch (config->mode)
 	{
-		static base64_state_t	b64_state;
-		
-		if (gcount == 1)
-			base64_init(&b64_state);
-		
-		if (mode)
-			out_buffer = base64_append(&b64_state, (char*) buf, len, out_size, 1);
+		case 7:
+			base64_init(&enc->b64_state);
+			break;
+
+		case 11:
+#ifdef md5_INCLUDED
+			md5_init(&enc->md5_state);
+#endif
+			break;
+
+		case 13:
+			sha256_init(&enc->sha256_state);
+			break;
+
+		case 10:
+			number_init(&enc->num_state, config->mode2, config->eol);
+			break;
+
+		case 12:
+			if (config->mode2 == DECODE_BASE64)
+				base64_decode_init(&enc->b64d_state);
+			else
+				hex_decode_init(&enc->hexd_state, config->mode2);
+			break;
+
+		default:
+			encode_table_init(&enc->table, config->mode, config->mode2);
+
+			if (config->exclude_symbols_size || config->include_symbols_size || config->nlign)
+				encoder_filter_init(enc);
+	}
+
+	enc->wrap.width = config->wrap;
+	enc->wrap.eol = config->eol;
+	enc->wrap.eol_len = config->eol ? strlen(config->eol) : 0;
+}
+
+/*
+ * Input alignment a stream must be cut at so that the parts can be
+ * converted independently and joined: 3 for Base64, 1 for the modes
+ * without state, 0 when the output depends on everything before. Wrapped
+ * parts have to know their column, so wrapped output of no fixed width
+ * can't be cut.
+ */
+size_t encoder_align(struct _config *config)
+{
+	switch (config->mode)
+	{
+		case 7:
+			return 3;
+
+		case 10:	/* one number */
+		case 11:	/* MD5 */
+		case 13:	/* SHA-256 */
+		case 12:	/* decoders keep partial tokens */
+			return 0;
+
+		case 3:
+			/* the first converted byte gets the prefix, wherever filtering puts it */
+			if (config->exclude_symbols_size || config->include_symbols_size || config->nlign)
+				return 0;
+			return 1;
+
+		default:
+#ifdef WIN32
+			/* the line break of -q looks at the next byte */
+			if (config->nlign)
+				return 0;
+#endif
+			if (config->wrap && (config->exclude_symbols_size || config->include_symbols_size ||
+				config->nlign || !encode_width(config->mode, config->mode2)))
+					return 0;
+			return 1;
+	}
+}
+
+/*
+ * Select the kernels of every mode for this CPU once, before threads that
+ * convert at the same time start
+ */
+void encoder_dispatch(void)
+{
+	encode_simd_level();
+	md5_dispatch();
+	sha256_dispatch();
+}
+
+/*
+ * Continue the stream at byte "offset" of the input, after "written"
+ * characters of output without line breaks; offset must be a multiple of
+ * encoder_align()
+ */
+void encoder_seek(encoder_t *enc, unsigned long long offset, unsigned long long written)
+{
+	if (!offset)
+		return;
+
+	enc->ide = 1;
+	enc->tail = (offset > 1);
+
+	/* characters already on the current line */
+	if (enc->wrap.width && written)
+		enc->wrap.col = (written - 1) % enc->wrap.width + 1;
+}
+
+/*
+ * Worst-case number of bytes encoder_convert_into() writes for the next
+ * "len" input bytes, counting what the stream keeps back from the chunks
+ * before; mode != 0 marks the last chunk. Exact for Base64 and the digests.
+ */
+size_t encoder_bound(encoder_t *enc, size_t len, int mode)
+{
+	struct _config	*config = enc->config;
+	size_t	total;
+
+	switch (config->mode)
+	{
+		case 7:
+			total = enc->b64_state.remlen + len;
+			total = mode ? BASE64_LENGTH(total) : total / 3 * 4;
+			break;
+
+		case 10:
+			total = number_bound(&enc->num_state, len);
+			break;
+
+		case 11:	/* -md5l, -md5z: a digest line for every record, an empty one at worst */
+			if (config->mode2)
+				total = (len + 1) * (32 + enc->wrap.eol_len);
+			else
+				total = mode ? 32 : 0;
+			break;
+
+		case 13:
+			total = mode ? SHA256_DIGEST_SIZE * 2 : 0;
+			break;
+
+		case 12:
+			if (config->mode2 == DECODE_BASE64)
+				return BASE64_DECODED_LENGTH(enc->b64d_state.remlen + len) + B64_DEC_SLACK;
+			return len;
+
+		default:
+#ifdef WIN32
+			/* the CR or LF held back from the chunk before */
+			if (enc->nl)
+				len++;
+#endif
+			total = len * encode_max_width(config->mode, config->mode2) + ENCODE_SLACK;
+	}
+
+	/* one break more than whole lines, for the line left open before */
+	if (enc->wrap.width)
+		total += (total / enc->wrap.width + 1) * enc->wrap.eol_len;
+
+	return total;
+}
+
+/* Wrap the output of one input byte, written from "start" on */
+static size_t encoder_wrap_piece(encoder_t *enc, char *out, size_t start, size_t end)
+{
+	if (!enc->wrap.width)
+		return end;
+
+	return start + encode_wrap_fix(&enc->wrap, out + start, end - start);
+}
+
+#ifdef WIN32
+/* The CR or LF held back at the end of a chunk, when the next byte isn't its pair */
+static char *encoder_held_byte(encoder_t *enc, char *p)
+{
+	unsigned char	c = enc->nl;
+
+	enc->nl = 0;
+	enc->ide = enc->nl_ide;
+
+	if (enc->table.width)
+		return p + encode_fixed(&enc->table, p, &c, 1, &enc->ide, &enc->wrap);
+	return p + encode_escapes(&enc->table, p, &c, 1, &enc->wrap);
+}
+
+static char *encoder_line_break(encoder_t *enc, char *p)
+{
+	if (enc->wrap.width)
+		return encode_wrap_text(&enc->wrap, p, "\r\n", 2);
+
+	memcpy(p, "\r\n", 2);
+	return p + 2;
+}
+#endif
+
+/*
+ * Convert a chunk through the -i/-e/-q filters. The runs of bytes copied
+ * as they are and the runs of bytes converted are found by
+ * encode_class_span() and go out whole, with the kernels of the unfiltered
+ * stream; only the bytes dropped and the line breaks of WIN32 are looked
+ * at one by one.
+ */
+static size_t encoder_filtered(encoder_t *enc, char *out, const unsigned char *in, size_t len)
+{
+	encode_wrap_t	*wrap = &enc->wrap;
+	char	*p = out;
+	size_t	i = 0, run;
+	unsigned char	c;
+	int	by_offset = !*enc->table.lead;	/* -t and -a: only the byte at the start of the input goes without a separator */
+
+	if (len)
+		enc->tail = 0;
+
+#ifdef WIN32
+	/* the pair of a CR or LF that ended the chunk before */
+	if (len && enc->nl)
+	{
+		if (in[0] == (enc->nl ^ ('\r' ^ '\n')))
+		{
+			enc->nl = 0;
+			p = encoder_line_break(enc, p);
+		} else
+			p = encoder_held_byte(enc, p);
+	}
+#endif
+
+	while (i < len)
+	{
+		run = encode_class_span(&enc->stop, in + i, len - i);
+
+		if (wrap->width)
+			p = encode_wrap_text(wrap, p, (const char *) in + i, run);
 		else
-			out_buffer = base64_append(&b64_state, (char*) buf, len, out_size, 0);
+		{
+			memcpy(p, in + i, run);
+			p += run;
+		}
+		i += run;
+
+		if ((run = encode_class_span(&enc->pass, in + i, len - i)))
+		{
+			if (i && by_offset)
+				enc->ide = 1;
+			if (i + run == len)
+				enc->tail = enc->ide || run > 1;
 
-		return out_buffer;	
+			if (enc->table.width)
+				p += encode_fixed(&enc->table, p, in + i, run, &enc->ide, wrap);
+			else
+				p += encode_escapes(&enc->table, p, in + i, run, wrap);
+			i += run;
+		}
+
+		/* the bytes -e drops and the line breaks of -q on WIN32 */
+		for (; i < len && (c = enc->filter[in[i]]) != FILTER_COPY && c != FILTER_ENCODE; i++)
+		{
+#ifdef WIN32
+			/*
+			 * A CR or LF is a line break when the next byte makes a CRLF or
+			 * LFCR pair of it; that byte is looked at on its own after it.
+			 * One that ends the chunk waits for the next one.
+			 */
+			if (c == FILTER_NEWLINE)
+			{
+				if (i && by_offset)
+					enc->ide = 1;
+
+				if (i + 1 == len)
+				{
+					enc->nl = in[i];
+					enc->nl_ide = enc->ide;
+				} else if (in[i + 1] == (in[i] ^ ('\r' ^ '\n')))
+					p = encoder_line_break(enc, p);
+				else
+				{
+					enc->nl = in[i];
+					enc->nl_ide = enc->ide;
+					p = encoder_held_byte(enc, p);
+				}
+			}
+#endif
+		}
 	}
 
-	/* Base10 number to Base16 numbers */
-	if (config->mode == 10) /* -n and -no options */
+	if (len && by_offset)
+		enc->ide = 1;
+
+	return p - out;
+}
+
+/*
+ * Base64 in wrapped lines: the groups that fit on the line are encoded
+ * straight into the output, only the group crossing the end of the line
+ * goes through a copy.
+ */
+static size_t encoder_base64_lines(encoder_t *enc, char *out, unsigned char *in, size_t len, int mode)
+{
+	base64_state_t	*b64 = &enc->b64_state;
+	encode_wrap_t	*wrap = &enc->wrap;
+	char	group[4], *p = out;
+	size_t	n, k;
+
+	while (b64->remlen + len >= 3)
 	{
-		int num = atoi((char*)buf);
-		switch (config->mode2)
+		if (wrap->col == wrap->width)
 		{
-			case 1: /* -n and -no options */
-				out_buffer = malloc(strlen((char*)buf) * 2); /* -no options */
-				*out_size += sprintf(out_buffer+*out_size,"%o", num);
-				break;
-			default:
-				out_buffer = malloc(strlen((char*)buf) * 2); /* -n options */
-				*out_size += sprintf(out_buffer+*out_size,"%x", num);
+			memcpy(p, wrap->eol, wrap->eol_len);
+			p += wrap->eol_len;
+			wrap->col = 0;
+		}
+
+		/* whole groups, the bytes kept from the chunk before included */
+		k = (wrap->width - wrap->col) / 4;
+		if (k > (b64->remlen + len) / 3)
+			k = (b64->remlen + len) / 3;
+
+		if (k)
+		{
+			n = k * 3 - b64->remlen;
+			p += base64_encode_into(b64, p, in, n, 0);
+			wrap->col += k * 4;
+		} else
+		{
+			n = 3 - b64->remlen;
+			p = encode_wrap_put(wrap, p, group, base64_encode_into(b64, group, in, n, 0));
+		}
+
+		in += n;
+		len -= n;
+	}
+
+	/* under a group: kept for the next chunk, or padded at the end */
+	n = base64_encode_into(b64, group, in, len, mode);
+	p = encode_wrap_put(wrap, p, group, n);
+
+	return p - out;
+}
+
+#ifdef md5_INCLUDED
+/* Records hashed with one md5_many() call */
+#define MD5_BATCH	(MD5_LANES * 4)
+
+/* One digest line of -md5l and -md5z */
+static char *encoder_md5_line(encoder_t *enc, char *out, const md5_byte_t digest[16])
+{
+	int	i;
+
+	for (i = 0; i < 16; i++, out += 2)
+		memcpy(out, HEX_PAIR(digest[i]), 2);
+
+	memcpy(out, enc->wrap.eol, enc->wrap.eol_len);
+
+	return out + enc->wrap.eol_len;
+}
+
+/*
+ * MD5 of every line (-md5l) or NUL terminated record (-md5z), without the
+ * separator. The whole records of the chunk are hashed side by side by
+ * md5_many(); the record still open at the end of the chunk goes on in
+ * the stream state.
+ */
+static size_t encoder_md5_records(encoder_t *enc, char *out, unsigned char *buf, size_t len, int mode)
+{
+	int	sep = (enc->config->mode2 == 1) ? '\n' : '\0';
+	const md5_byte_t	*data[MD5_BATCH];
+	size_t	nbytes[MD5_BATCH];
+	md5_byte_t	digest[MD5_BATCH][16];
+	unsigned char	*end = buf + len, *p;
+	char	*o = out;
+	int	n = 0, i;
+
+	/* the record left open by the chunk before */
+	if (enc->md5_open)
+	{
+		p = len ? memchr(buf, sep, len) : NULL;
+		md5_append(&enc->md5_state, buf, (p ? p : end) - buf);
+
+		if (!p && !mode)
+			return 0;
+
+		md5_finish(&enc->md5_state, digest[0]);
+		o = encoder_md5_line(enc, o, digest[0]);
+
+		md5_init(&enc->md5_state);
+		enc->md5_open = 0;
+		buf = p ? p + 1 : end;
+	}
+
+	while (buf < end)
+	{
+		if (!(p = memchr(buf, sep, end - buf)))
+		{
+			/* the rest of the record comes with the next chunk */
+			if (!mode)
+			{
+				md5_append(&enc->md5_state, buf, end - buf);
+				enc->md5_open = 1;
 				break;
+			}
+			p = end;
+		}
+
+		data[n] = buf;
+		nbytes[n++] = p - buf;
+		buf = (p < end) ? p + 1 : end;
+
+		if (n == MD5_BATCH)
+		{
+			md5_many(data, nbytes, n, digest);
+			for (i = 0; i < n; i++)
+				o = encoder_md5_line(enc, o, digest[i]);
+			n = 0;
 		}
-		return out_buffer;
 	}
 
+	if (n)
+	{
+		md5_many(data, nbytes, n, digest);
+		for (i = 0; i < n; i++)
+			o = encoder_md5_line(enc, o, digest[i]);
+	}
+
+	return o - out;
+}
+#endif
+
+/* Convert the next chunk of the stream into "out", which must hold encoder_bound(enc, len, 0) bytes */
+size_t encoder_update(encoder_t *enc, char *out, unsigned char *buf, size_t len)
+{
+	return encoder_convert_into(enc, out, buf, len, 0);
+}
+
+/* End of the stream: flush what the mode keeps back (Base64 remainder, digest) */
+size_t encoder_finish(encoder_t *enc, char *out)
+{
+	return encoder_convert_into(enc, out, NULL, 0, 1);
+}
+
+/*
+ * Single stream compatibility wrapper: the stream is set up on the first
+ * call, mode != 0 marks the last chunk.
+ */
+char *process(unsigned char *buf, size_t *out_size, size_t len, struct _config *config, int mode)
+{
+	static encoder_t	enc;
+	static int	ready = 0;
+
+	if (!ready)
+	{
+		encoder_init(&enc, config);
+		ready = 1;
+	}
+
+	return encoder_convert(&enc, buf, len, out_size, mode);
+}
+
+/* Convert "len" bytes of "buf" into a new buffer; mode != 0 marks the last chunk of the stream */
+char *encoder_convert(encoder_t *enc, unsigned char *buf, size_t len, size_t *out_size, int mode)
+{
+	char	*out_buffer = malloc(encoder_bound(enc, len, mode) + 1);
+
+	if (!out_buffer)
+		exit_error("Not enough memory.");
+
+	*out_size = encoder_convert_into(enc, out_buffer, buf, len, mode);
+
+	return out_buffer;
+}
+
+/*
+ * Convert "len" bytes of "buf" into "out_buffer", which must hold
+ * encoder_bound() bytes; mode != 0 marks the last chunk of the stream.
+ * Returns the number of bytes written.
+ */
+size_t encoder_convert_into(encoder_t *enc, char *out_buffer, unsigned char *buf, size_t len, int mode)
+{
+	struct _config	*config = enc->config;
+	register  int	i = 0;
+	size_t	out_size = 0;
+
+	/* Base64 */
+	if (config->mode == 7)
+	{
+		if (enc->wrap.width)
+			return encoder_base64_lines(enc, out_buffer, buf, len, mode);
+		return base64_encode_into(&enc->b64_state, out_buffer, buf, len, mode);
+	}
+
+	/* Base64 and hex decoding */
+	if (config->mode == 12)
+	{
+		char	message[64];
+
+		if (config->mode2 == DECODE_BASE64)
+		{
+			out_size = base64_decode_into(&enc->b64d_state, (unsigned char*) out_buffer, buf, len, mode);
+
+			if (enc->b64d_state.error != B64_NO_ERROR)
+			{
+				sprintf(message, "Invalid Base64 input at offset %lu.", (unsigned long) enc->b64d_state.error);
+				exit_error(message);
+			}
+		} else
+		{
+			out_size = hex_decode_into(&enc->hexd_state, (unsigned char*) out_buffer, buf, len, mode);
+
+			if (enc->hexd_state.error != DECODE_NO_ERROR)
+			{
+				sprintf(message, "Invalid hex input at offset %lu.", (unsigned long) enc->hexd_state.error);
+				exit_error(message);
+			}
+		}
+
+		return out_size;
+	}
+
+	/* Base10 numbers to Base16 or Base8 numbers and back */
+	if (config->mode == 10) /* -n, -no and -dn options */
+		return encoder_wrap_piece(enc, out_buffer, 0, number_convert(&enc->num_state, out_buffer, buf, len, mode));
+
 #ifdef md5_INCLUDED
 	/* MD5 */
 	if (config->mode == 11)
 	{
-		// MD5 state structure
-		static md5_state_t	md5_state;
-		static int md5_mode = 0;
-		static md5_byte_t	digest[16];
-		
-		
-		if (!md5_mode)	/* first time true */
-		{
-			md5_init(&md5_state);
-			mode = 1;
-		}
+		md5_byte_t	digest[16];
 
-		md5_append(&md5_state, (unsigned char*) buf, len);
+		if (config->mode2)
+			return encoder_wrap_piece(enc, out_buffer, 0, encoder_md5_records(enc, out_buffer, buf, len, mode));
+
+		md5_append(&enc->md5_state, (unsigned char*) buf, len);
 
 		if (mode)	/* true at the end of computation */
 		{
-			out_buffer = malloc(sizeof(digest)*2+sizeof(char));
-		
-			md5_finish(&md5_state, digest);
-
-			int	wrote=0;
+			md5_finish(&enc->md5_state, digest);
 
 			/* write binary hash in hex format */
 			for (i = 0; i < 16; ++i)
-				wrote += sprintf(out_buffer+wrote,"%02x", digest[i]);
+				memcpy(out_buffer + i*2, HEX_PAIR(digest[i]), 2);
 
 			/* size of the result */
-			*out_size = wrote;
-			
-			return out_buffer;
+			return encoder_wrap_piece(enc, out_buffer, 0, sizeof(digest)*2);
 		}
 
-		return NULL;
+		return 0;
 	}
 #else
 	if (config->mode == 11)
 	{
 		exit_error("MD5 encoding has been disabled on compilation time.");
-		return NULL;
+		return 0;
 	}
 #endif
 
-	int	alloc_size = len;
-	int	calc_alloc = 0;
-	out_buffer = malloc(alloc_size *= 2);
-	calc_alloc = alloc_size / 5 * 4;	/* 4/5 of the allocated memspace */
-
-	/* char convertion alhoritm */
-	for (i=0; i < len; i++)
+	/* SHA-256 */
+	if (config->mode == 13)
 	{
-		if (*out_size > calc_alloc)	/* if used 4/5 of the allocated memspace */
-		{
-			alloc_size += calc_alloc/4;	/* increase 1/5 of the allocated memspace */
-			out_buffer = realloc(out_buffer, alloc_size);
-			calc_alloc = alloc_size / 5 * 4;	/* 4/5 of the allocated memspace */
-		}
-	
-		/* include and exclude chars */
-		if (config->exclude_symbols_size)
-			if (memchr(config->exclude_symbols, buf[i],
-				config->exclude_symbols_size))
-					continue;
-
-		if (config->include_symbols_size)
-			if (!memchr(config->include_symbols, buf[i],
-				config->include_symbols_size))
-					{
-						*out_size += sprintf(out_buffer+*out_size, "%c", buf[i]);
-						continue;
-					}
-
-		/* Sort by CR. */
-		if (config->nlign)
-		{
-#ifdef WIN32
-			if ((buf[i] == '\n' && buf[i+1] == '\r') || (buf[i] == '\r' && buf[i+1] == '\n')	)
-#else
-			if (buf[i] == '\n')
-#endif
-			{
-#ifdef WIN32
-				*out_size+=sprintf(out_buffer+*out_size,"\r\n");
-#else
-				*out_size+=sprintf(out_buffer+*out_size,"\n");
-#endif
-				continue;
-			}
-		}
+		unsigned char	digest[SHA256_DIGEST_SIZE];
 
-		/* Primary convertion method analys */
-		switch(config->mode)
-		{
-			/* Plain hex style convertion */
-			case 9:
-				*out_size += sprintf(out_buffer+*out_size,"%02x",buf[i]);
-				break;
+		if (len)
+			sha256_append(&enc->sha256_state, buf, len);
 
-			/* AT&T asm style convertion */
-			case 1:
-				if (i)
-					switch (config->mode2)
-					{
-						case 1:
-							*out_size += sprintf(out_buffer+*out_size," 0x%02x", buf[i]);
-							break;
-						case 2:
-							*out_size += sprintf(out_buffer+*out_size,"0x%02x", buf[i]);
-							break;
-						default:
-							*out_size += sprintf(out_buffer+*out_size,", 0x%02x", buf[i]);
-					}
-				else
-					*out_size += sprintf(out_buffer+*out_size,"0x%02x", buf[i]);
-				break;
+		if (!mode)
+			return 0;
 
-			/* Microsoft assembler hex style */
-			case 2:
-				if (i)
-					switch (config->mode2)
-					{
-						case 1:
-							*out_size += sprintf(out_buffer+*out_size," %02xh", buf[i]);
-							break;
-						case 2:
-							*out_size += sprintf(out_buffer+*out_size,"%02xh", buf[i]);
-							break;
-						default:
-							*out_size += sprintf(out_buffer+*out_size,", %02xh", buf[i]);
-					}
-				else
-					*out_size += sprintf(out_buffer+*out_size,"%02xh", buf[i]);
-				break;
+		sha256_finish(&enc->sha256_state, digest);
 
-			/* MySQL Style convertion */
-			case 3:
-				switch(config->mode2)
-				{
-					case 1:
-						if (ide)
-						{
-							if (i == len-1)
-								*out_size += sprintf(out_buffer+*out_size,",%02x)", buf[i]);
-							else
-								*out_size += sprintf(out_buffer+*out_size,",%02x", buf[i]);
-						} else
-							*out_size += sprintf(out_buffer+*out_size,"CHAR(%02x", buf[i]);
-						ide++;
-					break;
-					default:
-						if (ide)
-							*out_size += sprintf(out_buffer+*out_size,"%02x", buf[i]);
-						else
-							*out_size += sprintf(out_buffer+*out_size,"0x%02x", buf[i]);
-						ide++;
-				}
-				break;
+		for (i = 0; i < SHA256_DIGEST_SIZE; ++i)
+			memcpy(out_buffer + i*2, HEX_PAIR(digest[i]), 2);
 
+		return encoder_wrap_piece(enc, out_buffer, 0, sizeof(digest)*2);
+	}
 
-			/* URL format */
-			case 4:
-				*out_size += sprintf(out_buffer+*out_size,"%%%02x",buf[i]);
-				break;
+	/* fixed-width modes without filtering are converted in one pass over the table */
+	if (enc->table.width && !config->exclude_symbols_size && !config->include_symbols_size && !config->nlign)
+	{
+		if (len)
+			enc->tail = enc->ide || len > 1;
 
-			/* HTML Style char convertion */
-			case 5:
-				switch (config->mode2)
-				{
-					case 1: // as HTML escape codes: &iexcl;&#x78;&copy;...
-						switch (buf[i])
-						{
-							case 0x20:
-								*out_size += sprintf(out_buffer+*out_size, "&nbsp;");
-								break;
-							case 0x22:
-								*out_size += sprintf(out_buffer+*out_size, "&quot;");
-								break;
-							case 0x26:
-								*out_size += sprintf(out_buffer+*out_size, "&amp;");
-								break;
-							case 0x2F:
-								*out_size += sprintf(out_buffer+*out_size, "&frasl;");
-								break;
-							case 0x3C:
-								*out_size += sprintf(out_buffer+*out_size, "&lt;");
-								break;
-							case 0x3E:
-								*out_size += sprintf(out_buffer+*out_size, "&qt;");
-								break;
-							case 0x89:
-								*out_size += sprintf(out_buffer+*out_size, "&permil;");
-								break;
-							case 0x8B:
-								*out_size += sprintf(out_buffer+*out_size, "&lsaquo;");
-								break;
-							case 0x96:
-								*out_size += sprintf(out_buffer+*out_size, "&ndash;");
-								break;
-							case 0x97:
-								*out_size += sprintf(out_buffer+*out_size, "&mdash;");
-								break;
-							case 0x99:
-								*out_size += sprintf(out_buffer+*out_size, "&trade;");
-								break;
-							case 0x9B:
-								*out_size += sprintf(out_buffer+*out_size, "&rsaquo;");
-								break;
-							case 0xA1:
-								*out_size += sprintf(out_buffer+*out_size, "&iexcl;");
-								break;
-							case 0xA2:
-								*out_size += sprintf(out_buffer+*out_size, "&cent;");
-								break;
-							case 0xA3:
-								*out_size += sprintf(out_buffer+*out_size, "&pound;");
-								break;
-							case 0xA4:
-								*out_size += sprintf(out_buffer+*out_size, "&curren;");
-								break;
-							case 0xA5:
-								*out_size += sprintf(out_buffer+*out_size, "&yen;");
-								break;
-							case 0xA6:
-								*out_size += sprintf(out_buffer+*out_size, "&brvbar;");
-								break;
-							case 0xA7:
-								*out_size += sprintf(out_buffer+*out_size, "&sect;");
-								break;
-							case 0xA8:
-								*out_size += sprintf(out_buffer+*out_size, "&uml;");
-								break;
-							case 0xA9:
-								*out_size += sprintf(out_buffer+*out_size, "&yen;");
-								break;
-							case 0xAA:
-								*out_size += sprintf(out_buffer+*out_size, "&ordf;");
-								break;
-							case 0xAB:
-								*out_size += sprintf(out_buffer+*out_size, "&laquo;");
-								break;
-							case 0xAC:
-								*out_size += sprintf(out_buffer+*out_size, "&not;");
-								break;
-							case 0xAD:
-								*out_size += sprintf(out_buffer+*out_size, "&shy;");
-								break;
-							case 0xAE:
-								*out_size += sprintf(out_buffer+*out_size, "&reg;");
-								break;
-							case 0xAF:
-								*out_size += sprintf(out_buffer+*out_size, "&macr;");
-								break;
-							case 0xB0:
-								*out_size += sprintf(out_buffer+*out_size, "&deg;");
-								break;
-							case 0xB1:
-								*out_size += sprintf(out_buffer+*out_size, "&plusmn;");
-								break;
-							case 0xB2:
-								*out_size += sprintf(out_buffer+*out_size, "&sup2;");
-								break;
-							case 0xB3:
-								*out_size += sprintf(out_buffer+*out_size, "&sup3;");
-								break;
-							case 0xB4:
-								*out_size += sprintf(out_buffer+*out_size, "&acute;");
-								break;
-							case 0xB5:
-								*out_size += sprintf(out_buffer+*out_size, "&micro;");
-								break;
-							case 0xB6:
-								*out_size += sprintf(out_buffer+*out_size, "&para;");
-								break;
-							case 0xB7:
-								*out_size += sprintf(out_buffer+*out_size, "&middot;");
-								break;
-							case 0xB8:
-								*out_size += sprintf(out_buffer+*out_size, "&cedil;");
-								break;
-							case 0xB9:
-								*out_size += sprintf(out_buffer+*out_size, "&sup1;");
-								break;
-							case 0xBA:
-								*out_size += sprintf(out_buffer+*out_size, "&ordm;");
-								break;
-							case 0xBB:
-								*out_size += sprintf(out_buffer+*out_size, "&raquo;");
-								break;
-							case 0xBC:
-								*out_size += sprintf(out_buffer+*out_size, "&frac14;");
-								break;
-							case 0xBD:
-								*out_size += sprintf(out_buffer+*out_size, "&frac12;");
-								break;
-							case 0xBE:
-								*out_size += sprintf(out_buffer+*out_size, "&frac34;");
-								break;
-							case 0xBF:
-								*out_size += sprintf(out_buffer+*out_size, "&iquest;");
-								break;
-							case 0xC0:
-								*out_size += sprintf(out_buffer+*out_size, "&agrave;");
-								break;
-							case 0xC1:
-								*out_size += sprintf(out_buffer+*out_size, "&Aacute;");
-								break;
-							case 0xC2:
-								*out_size += sprintf(out_buffer+*out_size, "&Acirc;");
-								break;
-							case 0xC3:
-								*out_size += sprintf(out_buffer+*out_size, "&Atilde;");
-								break;
-							case 0xC4:
-								*out_size += sprintf(out_buffer+*out_size, "&Auml;");
-								break;
-							case 0xC5:
-								*out_size += sprintf(out_buffer+*out_size, "&Aring;");
-								break;
-							case 0xC6:
-								*out_size += sprintf(out_buffer+*out_size, "&AElig;");
-								break;
-							case 0xC7:
-								*out_size += sprintf(out_buffer+*out_size, "&Ccedil;");
-								break;
-							case 0xC8:
-								*out_size += sprintf(out_buffer+*out_size, "&Egrave;");
-								break;
-							case 0xC9:
-								*out_size += sprintf(out_buffer+*out_size, "&Eacute;");
-								break;
-							case 0xCA:
-								*out_size += sprintf(out_buffer+*out_size, "&Ecirc;");
-								break;
-							case 0xCB:
-								*out_size += sprintf(out_buffer+*out_size, "&Euml;");
-								break;
-							case 0xCC:
-								*out_size += sprintf(out_buffer+*out_size, "&Igrave;");
-								break;
-							case 0xCD:
-								*out_size += sprintf(out_buffer+*out_size, "&Iacute;");
-								break;
-							case 0xCE:
-								*out_size += sprintf(out_buffer+*out_size, "&Icirc;");
-								break;
-							case 0xCF:
-								*out_size += sprintf(out_buffer+*out_size, "&Iuml;");
-								break;
-							case 0xD0:
-								*out_size += sprintf(out_buffer+*out_size, "&ETH;");
-								break;
-							case 0xD1:
-								*out_size += sprintf(out_buffer+*out_size, "&Ntilde;");
-								break;
-							case 0xD2:
-								*out_size += sprintf(out_buffer+*out_size, "&Ograve;");
-								break;
-							case 0xD3:
-								*out_size += sprintf(out_buffer+*out_size, "&Oacute;");
-								break;
-							case 0xD4:
-								*out_size += sprintf(out_buffer+*out_size, "&Ocirc;");
-								break;
-							case 0xD5:
-								*out_size += sprintf(out_buffer+*out_size, "&Otilde;");
-								break;
-							case 0xD6:
-								*out_size += sprintf(out_buffer+*out_size, "&Ouml;");
-								break;
-							case 0xD7:
-								*out_size += sprintf(out_buffer+*out_size, "&times;");
-								break;
-							case 0xD8:
-								*out_size += sprintf(out_buffer+*out_size, "&Oslash;");
-								break;
-							case 0xD9:
-								*out_size += sprintf(out_buffer+*out_size, "&Ugrave;");
-								break;
-							case 0xDA:
-								*out_size += sprintf(out_buffer+*out_size, "&Uacute;");
-								break;
-							case 0xDB:
-								*out_size += sprintf(out_buffer+*out_size, "&Ucirc;");
-								break;
-							case 0xDC:
-								*out_size += sprintf(out_buffer+*out_size, "&Uuml;");
-								break;
-							case 0xDD:
-								*out_size += sprintf(out_buffer+*out_size, "&Yacute;");
-								break;
-							case 0xDE:
-								*out_size += sprintf(out_buffer+*out_size, "&THORN;");
-								break;
-							case 0xDF:
-								*out_size += sprintf(out_buffer+*out_size, "&szlig;");
-								break;
-							case 0xE0:
-								*out_size += sprintf(out_buffer+*out_size, "&agrave;");
-								break;
-							case 0xE1:
-								*out_size += sprintf(out_buffer+*out_size, "&aacute;");
-								break;
-							case 0xE2:
-								*out_size += sprintf(out_buffer+*out_size, "&acirc;");
-								break;
-							case 0xE3:
-								*out_size += sprintf(out_buffer+*out_size, "&atilde;");
-								break;
-							case 0xE4:
-								*out_size += sprintf(out_buffer+*out_size, "&auml;");
-								break;
-							case 0xE5:
-								*out_size += sprintf(out_buffer+*out_size, "&aring;");
-								break;
-							case 0xE6:
-								*out_size += sprintf(out_buffer+*out_size, "&aelig;");
-								break;
-							case 0xE7:
-								*out_size += sprintf(out_buffer+*out_size, "&ccedil;");
-								break;
-							case 0xE8:
-								*out_size += sprintf(out_buffer+*out_size, "&egrave;");
-								break;
-							case 0xE9:
-								*out_size += sprintf(out_buffer+*out_size, "&eacute;");
-								break;
-							case 0xEA:
-								*out_size += sprintf(out_buffer+*out_size, "&ecirc;");
-								break;
-							case 0xEB:
-								*out_size += sprintf(out_buffer+*out_size, "&euml;");
-								break;
-							case 0xEC:
-								*out_size += sprintf(out_buffer+*out_size, "&igrave;");
-								break;
-							case 0xED:
-								*out_size += sprintf(out_buffer+*out_size, "&iacute;");
-								break;
-							case 0xEE:
-								*out_size += sprintf(out_buffer+*out_size, "&icirc;");
-								break;
-							case 0xEF:
-								*out_size += sprintf(out_buffer+*out_size, "&iuml;");
-								break;
-							case 0xF0:
-								*out_size += sprintf(out_buffer+*out_size, "&eth;");
-								break;
-							case 0xF1:
-								*out_size += sprintf(out_buffer+*out_size, "&ntilde;");
-								break;
-							case 0xF2:
-								*out_size += sprintf(out_buffer+*out_size, "&ograve;");
-								break;
-							case 0xF3:
-								*out_size += sprintf(out_buffer+*out_size, "&oacute;");
-								break;
-							case 0xF4:
-								*out_size += sprintf(out_buffer+*out_size, "&ocirc;");
-								break;
-							case 0xF5:
-								*out_size += sprintf(out_buffer+*out_size, "&otilde;");
-								break;
-							case 0xF6:
-								*out_size += sprintf(out_buffer+*out_size, "&ouml;");
-								break;
-							case 0xF7:
-								*out_size += sprintf(out_buffer+*out_size, "&divide;");
-								break;
-							case 0xF8:
-								*out_size += sprintf(out_buffer+*out_size, "&oslash;");
-								break;
-							case 0xF9:
-								*out_size += sprintf(out_buffer+*out_size, "&ugrave;");
-								break;
-							case 0xFA:
-								*out_size += sprintf(out_buffer+*out_size, "&uacute;");
-								break;
-							case 0xFB:
-								*out_size += sprintf(out_buffer+*out_size, "&ucirc;");
-								break;
-							case 0xFC:
-								*out_size += sprintf(out_buffer+*out_size, "&uuml;");
-								break;
-							case 0xFD:
-								*out_size += sprintf(out_buffer+*out_size, "&yacute;");
-								break;
-							case 0xFE:
-								*out_size += sprintf(out_buffer+*out_size, "&thorn;");
-								break;
-							case 0xFF:
-								*out_size += sprintf(out_buffer+*out_size, "&yuml;");
-								break;
-							default:
-								*out_size += sprintf(out_buffer+*out_size,"&#%d;",buf[i]);
-						}
-						break;
-					case 2:
-						*out_size += sprintf(out_buffer+*out_size,"&#%d",buf[i]); 
-						break;
-					default:
-						*out_size += sprintf(out_buffer+*out_size,"&#x%x",buf[i]); /* HTML hex-format */
-				}
-				break;
+		out_size = encode_fixed(&enc->table, out_buffer, buf, len, &enc->ide, &enc->wrap);
 
+		if (mode)
+			out_size = encode_end(&enc->table, out_buffer + out_size, enc->tail, &enc->wrap) - out_buffer;
 
-			/* C-style char convertion */
-			case 8: 
-				switch (config->mode2)
-				{
-					case 1:
-					case 2:
-						switch (buf[i])
-						{
-							case '\n':
-								*out_size += sprintf(out_buffer+*out_size, "\\n");
-								break;
-							case '"':
-								*out_size += sprintf(out_buffer+*out_size, "\\\"");
-								break;
-							case '\'':
-								*out_size += sprintf(out_buffer+*out_size, "\\\'");
-								break;
-							case '%':
-								*out_size += sprintf(out_buffer+*out_size, "%%");
-								break;
-							case '\\' :
-								*out_size += sprintf(out_buffer+*out_size, "\\\\");
-								break;
-							case '\t':
-								*out_size += sprintf(out_buffer+*out_size, "\\t");
-								break;
-							case '\v':
-								*out_size += sprintf(out_buffer+*out_size, "\\v");
-								break;
-							case '\b':
-								*out_size += sprintf(out_buffer+*out_size, "\\b");
-								break;
-							case '\r':
-								*out_size += sprintf(out_buffer+*out_size, "\\r");
-								break;
-							case '\f':
-								*out_size += sprintf(out_buffer+*out_size, "\\f");
-								break;
-							case '\a':
-								*out_size += sprintf(out_buffer+*out_size, "\\a");
-								break;
-							default:
-								if (config->mode2 == 1)
-									*out_size += sprintf(out_buffer+*out_size,"\\%o",buf[i]);
-								else
-									*out_size += sprintf(out_buffer+*out_size, "%c", buf[i]);
-						}
-						break;
-					case 3:
-						*out_size += sprintf(out_buffer+*out_size,"\\x%x",buf[i]);
-						break;
-					default:
-						*out_size += sprintf(out_buffer+*out_size,"\\%o",buf[i]);
-				}
-				break;
-			default:
-				*out_size += sprintf(out_buffer+*out_size,"%02x", buf[i]);
-		}
+		return out_size;
 	}
 
-	return out_buffer;
+	/* so are the HTML and C modes, copying the bytes that need no escape in runs */
+	if (enc->table.escape && !config->exclude_symbols_size && !config->include_symbols_size && !config->nlign)
+		return encode_escapes(&enc->table, out_buffer, buf, len, &enc->wrap);
+
+	/* the -i/-e/-q filters */
+	out_size = encoder_filtered(enc, out_buffer, buf, len);
+
+#ifdef WIN32
+	/* a CR or LF at the end of the input has no pair, it is the last byte converted */
+	if (mode && enc->nl)
+	{
+		enc->tail = enc->nl_ide;
+		out_size = encoder_held_byte(enc, out_buffer + out_size) - out_buffer;
+	}
+#endif
+
+	/* the suffix of the mode closes the stream */
+	if (mode && enc->table.width)
+		out_size = encode_end(&enc->table, out_buffer + out_size, enc->tail, &enc->wrap) - out_buffer;
+
+	return out_size;
 }
@@ -2,6 +2,43 @@
 #define __PROCESS_H
 
 #include "main.h"
+#include "encode.h"
+#include "decode.h"
+#include "b64.h"
+#include "md5.h"
+#include "sha256.h"
+#include "number.h"
+
+/* State of one conversion stream; independent streams may run on different threads. */
+typedef struct {
+	struct _config	*config;
+	int	ide;				/* the next cell keeps its separator: -t and -a past the first input byte, MySQL past the first converted one */
+	int	tail;				/* -mc: the last input byte was converted and not first, ")" closes the stream */
+	encode_wrap_t	wrap;			/* line wrapping of the output */
+	encode_table_t	table;
+	base64_state_t	b64_state;
+	base64_decode_state_t	b64d_state;
+	hex_decode_state_t	hexd_state;
+	md5_state_t	md5_state;
+	int	md5_open;			/* -md5l, -md5z: a record goes on in md5_state */
+	sha256_state_t	sha256_state;
+	number_state_t	num_state;
+	int	nl;				/* -q on WIN32: a CR or LF that ended the last chunk, its pair may start the next one */
+	int	nl_ide;				/* the "ide" it gets when it is converted */
+	unsigned char	filter[256];		/* -i/-e/-q: what becomes of every byte value, FILTER_* */
+	encode_class_t	stop;			/* -i/-e/-q: the bytes not copied as they are */
+	encode_class_t	pass;			/* -i/-e/-q: the bytes not converted */
+} encoder_t;
+
+void encoder_init(encoder_t *enc, struct _config *config);
+size_t encoder_bound(encoder_t *enc, size_t len, int mode);
+size_t encoder_update(encoder_t *enc, char *out, unsigned char *buf, size_t len);
+size_t encoder_finish(encoder_t *enc, char *out);
+size_t encoder_align(struct _config *config);
+void encoder_dispatch(void);
+void encoder_seek(encoder_t *enc, unsigned long long offset, unsigned long long written);
+char *encoder_convert(encoder_t *enc, unsigned char *buf, size_t len, size_t *out_size, int mode);
+size_t encoder_convert_into(encoder_t *enc, char *out_buffer, unsigned char *buf, size_t len, int mode);
 
 char *process(unsigned char *buf, size_t *out_size, size_t len, struct _config *config, int mode);
 
@@ -0,0 +1,272 @@
+/*
+ * sha256.c
+ * This file is part of str2hex project.
+ *
+ * Copyright 2005 Dzmitry Plashchynski <plashchynski@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * SHA-256 (FIPS 180-4).
+ *
+ * Blocks are compressed by the x86 SHA extensions when the CPU has them:
+ * sha256rnds2 does two rounds and sha256msg1/sha256msg2 extend the message
+ * four words at a time. Elsewhere the portable rounds run unrolled by
+ * eight, renaming the working variables instead of moving them, with the
+ * message schedule kept in a 16 word ring.
+ */
+
+#include <string.h>
+#include "sha256.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA256_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+static const unsigned int	sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+#define SIGMA0(x)	(ROR(x, 2) ^ ROR(x, 13) ^ ROR(x, 22))
+#define SIGMA1(x)	(ROR(x, 6) ^ ROR(x, 11) ^ ROR(x, 25))
+#define GAMMA0(x)	(ROR(x, 7) ^ ROR(x, 18) ^ ((x) >> 3))
+#define GAMMA1(x)	(ROR(x, 17) ^ ROR(x, 19) ^ ((x) >> 10))
+#define CH(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define MAJ(x, y, z)	(((x) & (y)) | ((z) & ((x) | (y))))
+
+#define W(i)	w[(i) & 15]
+#define ROUND(a, b, c, d, e, f, g, h, i) \
+	t = h + SIGMA1(e) + CH(e, f, g) + sha256_k[i] + W(i); \
+	d += t; \
+	h = t + SIGMA0(a) + MAJ(a, b, c)
+
+static void sha256_blocks_c(unsigned int h[8], const unsigned char *data, size_t blocks)
+{
+	unsigned int	a, b, c, d, e, f, g, hh, t, w[16];
+	int	i;
+
+	for (; blocks--; data += 64)
+	{
+		for (i = 0; i < 16; i++)
+			w[i] = (unsigned int) data[4*i] << 24 | data[4*i + 1] << 16 | data[4*i + 2] << 8 | data[4*i + 3];
+
+		a = h[0]; b = h[1]; c = h[2]; d = h[3];
+		e = h[4]; f = h[5]; g = h[6]; hh = h[7];
+
+		for (i = 0; i < 64; i += 8)
+		{
+			/* the next eight words of the message schedule, in place of the ones used up */
+			if (i >= 16)
+			{
+				int	j;
+
+				for (j = i; j < i + 8; j++)
+					W(j) += GAMMA1(W(j - 2)) + W(j - 7) + GAMMA0(W(j - 15));
+			}
+
+			ROUND(a, b, c, d, e, f, g, hh, i);
+			ROUND(hh, a, b, c, d, e, f, g, i + 1);
+			ROUND(g, hh, a, b, c, d, e, f, i + 2);
+			ROUND(f, g, hh, a, b, c, d, e, i + 3);
+			ROUND(e, f, g, hh, a, b, c, d, i + 4);
+			ROUND(d, e, f, g, hh, a, b, c, i + 5);
+			ROUND(c, d, e, f, g, hh, a, b, i + 6);
+			ROUND(b, c, d, e, f, g, hh, a, i + 7);
+		}
+
+		h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+		h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+	}
+}
+
+#ifdef SHA256_X86
+
+/* Four rounds on the message words in "m" */
+#define SHA_ROUNDS(m, i) \
+	msg = _mm_add_epi32(m, _mm_loadu_si128((const __m128i *) (sha256_k + (i)))); \
+	state1 = _mm_sha256rnds2_epu32(state1, state0, msg); \
+	state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e))
+
+/* The next four message words over the oldest ones, "m0" */
+#define SHA_SCHEDULE(m0, m1, m2, m3) \
+	m0 = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(m0, m1), _mm_alignr_epi8(m3, m2, 4)), m3)
+
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_ni(unsigned int h[8], const unsigned char *data, size_t blocks)
+{
+	const __m128i	bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i	state0, state1, save0, save1, msg, m0, m1, m2, m3, t;
+	int	i;
+
+	/* the instructions keep the state as ABEF and CDGH */
+	t = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) h), 0xb1);
+	state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) (h + 4)), 0x1b);
+	state0 = _mm_alignr_epi8(t, state1, 8);
+	state1 = _mm_blend_epi16(state1, t, 0xf0);
+
+	for (; blocks--; data += 64)
+	{
+		save0 = state0;
+		save1 = state1;
+
+		m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) data), bswap);
+		m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16)), bswap);
+		m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 32)), bswap);
+		m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 48)), bswap);
+
+		SHA_ROUNDS(m0, 0);
+		SHA_ROUNDS(m1, 4);
+		SHA_ROUNDS(m2, 8);
+		SHA_ROUNDS(m3, 12);
+
+		for (i = 16; i < 64; i += 16)
+		{
+			SHA_SCHEDULE(m0, m1, m2, m3);
+			SHA_ROUNDS(m0, i);
+			SHA_SCHEDULE(m1, m2, m3, m0);
+			SHA_ROUNDS(m1, i + 4);
+			SHA_SCHEDULE(m2, m3, m0, m1);
+			SHA_ROUNDS(m2, i + 8);
+			SHA_SCHEDULE(m3, m0, m1, m2);
+			SHA_ROUNDS(m3, i + 12);
+		}
+
+		state0 = _mm_add_epi32(state0, save0);
+		state1 = _mm_add_epi32(state1, save1);
+	}
+
+	/* back to ABCD and EFGH */
+	t = _mm_shuffle_epi32(state0, 0x1b);
+	state1 = _mm_shuffle_epi32(state1, 0xb1);
+	_mm_storeu_si128((__m128i *) h, _mm_blend_epi16(t, state1, 0xf0));
+	_mm_storeu_si128((__m128i *) (h + 4), _mm_alignr_epi8(state1, t, 8));
+}
+
+#endif
+
+typedef void (*sha256_blocks_fn)(unsigned int h[8], const unsigned char *data, size_t blocks);
+
+static sha256_blocks_fn	sha256_fn;
+static int	sha256_ni = 1;	/* the SHA extensions are allowed */
+
+/*
+ * Select the SHA extensions when the CPU has them. Done once, by the first
+ * hash or before the worker threads start, which then only read the choice.
+ */
+void sha256_dispatch(void)
+{
+	if (sha256_fn)
+		return;
+
+	sha256_fn = sha256_blocks_c;
+#ifdef SHA256_X86
+	{
+		unsigned int	a, b, c, d;
+
+		/* SHA (leaf 7, EBX bit 29), SSSE3 and SSE4.1 (leaf 1, ECX bits 9 and 19) */
+		if (sha256_ni && __get_cpuid(1, &a, &b, &c, &d) && (c & (1 << 9)) && (c & (1 << 19)) &&
+			__get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1 << 29)))
+				sha256_fn = sha256_blocks_ni;
+	}
+#endif
+}
+
+/* Select again, with the SHA extensions only if "ni", so the tests can run both kernels on one CPU */
+void sha256_limit(int ni)
+{
+	sha256_ni = ni;
+	sha256_fn = NULL;
+	sha256_dispatch();
+}
+
+static void sha256_blocks(unsigned int h[8], const unsigned char *data, size_t blocks)
+{
+	sha256_dispatch();
+	sha256_fn(h, data, blocks);
+}
+
+void sha256_init(sha256_state_t *state)
+{
+	static const unsigned int	iv[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	memcpy(state->h, iv, sizeof(iv));
+	state->count = 0;
+}
+
+void sha256_append(sha256_state_t *state, const unsigned char *data, size_t len)
+{
+	size_t	used = state->count & 63;
+	size_t	n;
+
+	state->count += len;
+
+	/* fill the partial block first */
+	if (used)
+	{
+		n = (len < 64 - used) ? len : 64 - used;
+		memcpy(state->buf + used, data, n);
+		data += n;
+		len -= n;
+
+		if (used + n < 64)
+			return;
+		sha256_blocks(state->h, state->buf, 1);
+	}
+
+	/* whole blocks straight from the input */
+	if (len >= 64)
+	{
+		sha256_blocks(state->h, data, len / 64);
+		data += len & ~(size_t) 63;
+		len &= 63;
+	}
+
+	memcpy(state->buf, data, len);
+}
+
+void sha256_finish(sha256_state_t *state, unsigned char digest[SHA256_DIGEST_SIZE])
+{
+	unsigned long long	bits = state->count << 3;
+	size_t	used = state->count & 63;
+	int	i;
+
+	/* 0x80, zeros up to 56 bytes of the last block, the length in bits, big endian */
+	state->buf[used++] = 0x80;
+	if (used > 56)
+	{
+		memset(state->buf + used, 0, 64 - used);
+		sha256_blocks(state->h, state->buf, 1);
+		used = 0;
+	}
+	memset(state->buf + used, 0, 56 - used);
+
+	for (i = 0; i < 8; i++)
+		state->buf[56 + i] = (unsigned char) (bits >> (56 - 8*i));
+	sha256_blocks(state->h, state->buf, 1);
+
+	for (i = 0; i < SHA256_DIGEST_SIZE; i++)
+		digest[i] = (unsigned char) (state->h[i >> 2] >> (24 - 8*(i & 3)));
+}
@@ -0,0 +1,21 @@
+#ifndef __SHA256_H
+#define __SHA256_H
+
+#include <stddef.h>
+
+#define SHA256_DIGEST_SIZE	32
+
+/* State of one SHA-256 (FIPS 180-4) computation. */
+typedef struct {
+	unsigned int	h[8];			/* intermediate hash */
+	unsigned long long	count;		/* message length in bytes */
+	unsigned char	buf[64];		/* partial block */
+} sha256_state_t;
+
+void sha256_dispatch(void);
+void sha256_limit(int ni);
+void sha256_init(sha256_state_t *state);
+void sha256_append(sha256_state_t *state, const unsigned char *data, size_t len);
+void sha256_finish(sha256_state_t *state, unsigned char digest[SHA256_DIGEST_SIZE]);
+
+#endif
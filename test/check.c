@@ -0,0 +1,523 @@
+/*
+ * check.c
+ * This file is part of str2hex project.
+ *
+ * Copyright 2005 Dzmitry Plashchynski <plashchynski@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Differential checks of the converter, shared by the test program and
+ * the fuzz targets.
+ *
+ * An input is converted three ways and every result must match the
+ * reference byte for byte: through encoder_convert_into() in random
+ * chunks, each one checked for writing past encoder_bound(); through the
+ * read loop of the program (convert_span()) with a random buffer size; and,
+ * for the modes that can be cut, in random segments converted
+ * independently the way the threads of the program do (convert_memory()).
+ * The decoders have to give the same output and the same error offset
+ * however their input is cut, and give back what was encoded.
+ *
+ * A check returns 0 when everything matches and prints what didn't
+ * otherwise.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "reference.h"
+#include "../process.h"
+#include "../convert.h"
+#include "../io.h"
+#include "../b64.h"
+#include "../decode.h"
+#include "../md5.h"
+#include "../sha256.h"
+
+#define CHECK_GUARD	64		/* bytes past the bound that must stay untouched */
+#define CHECK_FILL	0xa5
+
+const int	check_modes[][2] = {
+	{9, 0}, {1, 0}, {1, 1}, {1, 2}, {2, 0}, {2, 1}, {2, 2}, {3, 0}, {3, 1}, {4, 0},
+	{5, 0}, {5, 1}, {5, 2}, {7, 0}, {7, 1}, {8, 0}, {8, 1}, {8, 2}, {8, 3},
+	{10, 0}, {10, 1}, {10, 2}, {11, 0}, {11, 1}, {11, 2}, {13, 0}
+};
+const int	check_modes_count = sizeof(check_modes) / sizeof(check_modes[0]);
+
+/* the option of every mode, for the reports */
+static const struct {
+	int	mode, mode2;
+	const char	*name;
+} check_names[] = {
+	{9, 0, "-p"}, {1, 0, "-t"}, {1, 1, "-tc"}, {1, 2, "-tp"}, {2, 0, "-a"}, {2, 1, "-ac"}, {2, 2, "-ap"},
+	{3, 0, "-m"}, {3, 1, "-mc"}, {4, 0, "-u"}, {5, 0, "-x"}, {5, 1, "-xe"}, {5, 2, "-xw"},
+	{7, 0, "-b64"}, {7, 1, "-bn"}, {8, 0, "-c"}, {8, 1, "-cf"}, {8, 2, "-cc"}, {8, 3, "-ch"},
+	{10, 0, "-n"}, {10, 1, "-no"}, {10, 2, "-dn"}, {11, 0, "-md5"}, {11, 1, "-md5l"}, {11, 2, "-md5z"},
+	{13, 0, "-sha256"},
+	{12, DECODE_BASE64, "-db64"}, {12, DECODE_PLAIN, "-dp"}, {12, DECODE_MYSQL, "-dm"}, {12, DECODE_CHAR, "-dmc"},
+	{12, DECODE_URL, "-du"}, {12, DECODE_ATT, "-dt"}, {12, DECODE_MASM, "-da"}
+};
+
+/* the encoders whose output every decoder reads */
+const int	check_sources[][2] = {
+	{7, 1}, {9, 0}, {3, 0}, {3, 1}, {4, 0}, {1, 0}, {2, 0}
+};
+const int	check_sources_count = sizeof(check_sources) / sizeof(check_sources[0]);
+
+void exit_error(char *message)
+{
+	fprintf(stderr, "ERROR: %s\n", message);
+	abort();
+}
+
+void add_file(struct _config *config, const char *name)
+{
+	(void) config;
+	(void) name;
+	exit_error("No input files in the tests.");
+}
+
+unsigned check_rand(unsigned *seed)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 17;
+	*seed ^= *seed << 5;
+
+	return *seed;
+}
+
+const char *check_mode_name(int mode, int mode2)
+{
+	size_t	i;
+
+	for (i = 0; i < sizeof(check_names) / sizeof(check_names[0]); i++)
+		if (check_names[i].mode == mode && check_names[i].mode2 == mode2)
+			return check_names[i].name;
+
+	return "?";
+}
+
+static void *check_alloc(size_t size)
+{
+	void	*p = malloc(size ? size : 1);
+
+	if (!p)
+		exit_error("Not enough memory.");
+
+	return p;
+}
+
+/* A chunk length: mostly short ones, sometimes empty, sometimes all that is left */
+static size_t check_cut(unsigned *seed, size_t left)
+{
+	switch (check_rand(seed) % 8)
+	{
+		case 0:
+			return 0;
+		case 1:
+			return left;
+		case 2:
+		case 3:
+			return check_rand(seed) % (left < 8 ? left + 1 : 8);
+		default:
+			return check_rand(seed) % (left + 1);
+	}
+}
+
+static void check_report(const check_case_t *c, const char *way, const char *got, size_t got_len, const char *want, size_t want_len, size_t len)
+{
+	const struct _config	*config = &c->config;
+	size_t	i;
+
+	for (i = 0; i < got_len && i < want_len && got[i] == want[i]; i++);
+
+	fprintf(stderr, "%s %s: %lu input bytes, level %d, seed %u, wrap %d%s%s%s%s\n",
+		check_mode_name(config->mode, config->mode2), way, (unsigned long) len, c->level, c->seed,
+		config->wrap, strcmp(config->eol, "\n") ? " crlf" : "", config->nlign ? " -q" : "",
+		config->include_symbols_size ? " -i" : "", config->exclude_symbols_size ? " -e" : "");
+	fprintf(stderr, "  output differs at %lu: %lu bytes, expected %lu\n  got:      \"%.*s\"\n  expected: \"%.*s\"\n",
+		(unsigned long) i, (unsigned long) got_len, (unsigned long) want_len,
+		(int) ((got_len - i < 40) ? got_len - i : 40), got + i,
+		(int) ((want_len - i < 40) ? want_len - i : 40), want + i);
+}
+
+static int check_same(const check_case_t *c, const char *way, const char *got, size_t got_len, const char *want, size_t want_len, size_t len)
+{
+	if (got_len == want_len && !memcmp(got, want, want_len))
+		return 0;
+
+	check_report(c, way, got, got_len, want, want_len, len);
+	return -1;
+}
+
+/* encoder_convert_into() in random chunks, every one within encoder_bound() */
+static int check_chunks(const check_case_t *c, const unsigned char *in, size_t len, const char *want, size_t want_len)
+{
+	encoder_t	*enc = check_alloc(sizeof(encoder_t));
+	unsigned	seed = c->seed;
+	char	*out = NULL, *buf;
+	size_t	total = 0, i, n, bound, got;
+	int	last, k, result = 0;
+
+	encoder_init(enc, (struct _config *) &c->config);
+
+	for (i = 0, last = 0; !last; i += n)
+	{
+		n = check_cut(&seed, len - i);
+		last = (i + n == len) && check_rand(&seed) % 4;
+		bound = encoder_bound(enc, n, last);
+
+		buf = check_alloc(bound + CHECK_GUARD);
+		memset(buf, CHECK_FILL, bound + CHECK_GUARD);
+		got = encoder_convert_into(enc, buf, (unsigned char *) in + i, n, last);
+
+		for (k = 0; k < CHECK_GUARD && (unsigned char) buf[bound + k] == CHECK_FILL; k++);
+
+		if (got > bound || k < CHECK_GUARD)
+		{
+			fprintf(stderr, "%s chunks: %lu bytes written, %lu bytes past the bound of %lu\n",
+				check_mode_name(c->config.mode, c->config.mode2), (unsigned long) got,
+				(unsigned long) (got > bound ? got - bound : CHECK_GUARD - k), (unsigned long) bound);
+			result = -1;
+		}
+
+		out = realloc(out, total + got + 1);
+		memcpy(out + total, buf, got);
+		total += got;
+		free(buf);
+	}
+
+	if (!result)
+		result = check_same(c, "chunks", out, total, want, want_len, len);
+
+	free(out);
+	free(enc);
+
+	return result;
+}
+
+/* The read loop of the program: spans of the buffer size through the encoder */
+static int check_span(const check_case_t *c, const unsigned char *in, size_t len, const char *want, size_t want_len)
+{
+	encoder_t	*enc = check_alloc(sizeof(encoder_t));
+	struct _config	config = c->config;
+	unsigned	seed = c->seed ^ 0x5bd1e995;
+	io_out_t	out;
+	int	result;
+
+	config.bufsize = 1 + check_rand(&seed) % (len + 1);
+
+	io_out_init(&out, -1, 4096);
+	encoder_init(enc, &config);
+	convert_span(enc, in, len, &out);
+	convert_finish(enc, &out);
+
+	result = check_same(c, "span", out.buf, out.len, want, want_len, len);
+
+	io_out_free(&out);
+	free(enc);
+
+	return result;
+}
+
+/* Segments cut at multiples of encoder_align(), converted on their own and joined */
+static int check_segments(const check_case_t *c, const unsigned char *in, size_t len, const char *want, size_t want_len)
+{
+	struct _config	config = c->config;
+	unsigned	seed = c->seed ^ 0x27d4eb2d;
+	size_t	align = encoder_align(&config), i, n;
+	io_out_t	out;
+	int	result;
+
+	if (!align)
+		return 0;
+
+	config.bufsize = 1 + check_rand(&seed) % 4096;
+	io_out_init(&out, -1, 4096);
+
+	for (i = 0; ; i += n)
+	{
+		n = check_cut(&seed, len - i) / align * align;
+		if (i + n + align > len)
+			n = len - i;
+
+		convert_memory(&config, in + i, n, &out, i, i + n == len);
+
+		if (i + n == len)
+			break;
+	}
+
+	result = check_same(c, "segments", out.buf, out.len, want, want_len, len);
+	io_out_free(&out);
+
+	return result;
+}
+
+/*
+ * No kernel above the instruction set "level" in the encoders, md5_many()
+ * and SHA-256: the portable code at ENCODE_SIMD_NONE, everything this CPU
+ * has at its own level.
+ */
+static void check_limit(int level)
+{
+	encode_simd_limit(ENCODE_SIMD_AVX512);
+	if (level >= encode_simd_level())
+		level = ENCODE_SIMD_AVX512;
+
+	encode_simd_limit(level);
+	md5_limit((level == ENCODE_SIMD_AVX512) ? 512 : (level == ENCODE_SIMD_AVX2) ? 256 : 0);
+	sha256_limit(level != ENCODE_SIMD_NONE);
+}
+
+/* Every way of converting "in" against the reference */
+int check_encoder(const check_case_t *c, const unsigned char *in, size_t len)
+{
+	char	*want;
+	size_t	want_len;
+	int	result;
+
+	want = ref_convert(&c->config, in, len, &want_len);
+
+	check_limit(c->level);
+
+	result = check_chunks(c, in, len, want, want_len);
+	if (!result)
+		result = check_span(c, in, len, want, want_len);
+	if (!result)
+		result = check_segments(c, in, len, want, want_len);
+
+	check_limit(ENCODE_SIMD_AVX512);
+	free(want);
+
+	return result;
+}
+
+/*
+ * Decode in random chunks, or in one when "seed" is 0. Returns the output
+ * and its length in *out_len, the error offset in *error; NULL if a chunk
+ * was written past its bound.
+ */
+static unsigned char *check_decode(int format, unsigned seed, const unsigned char *in, size_t len, size_t *out_len, size_t *error)
+{
+	base64_decode_state_t	b64;
+	hex_decode_state_t	*hex = check_alloc(sizeof(hex_decode_state_t));
+	unsigned char	*out = check_alloc(len + B64_DEC_SLACK + 8 + CHECK_GUARD);
+	size_t	total = 0, i, n, bound, got;
+	int	last, k;
+
+	if (format == DECODE_BASE64)
+		base64_decode_init(&b64);
+	else
+		hex_decode_init(hex, format);
+
+	*error = DECODE_NO_ERROR;
+
+	for (i = 0, last = 0; !last && *error == DECODE_NO_ERROR; i += n)
+	{
+		n = seed ? check_cut(&seed, len - i) : len - i;
+		last = (i + n == len) && (!seed || check_rand(&seed) % 4);
+
+		if (format == DECODE_BASE64)
+			bound = BASE64_DECODED_LENGTH(b64.remlen + n) + B64_DEC_SLACK;
+		else
+			bound = n;
+
+		memset(out + total, CHECK_FILL, bound + CHECK_GUARD);
+
+		if (format == DECODE_BASE64)
+		{
+			got = base64_decode_into(&b64, out + total, in + i, n, last);
+			*error = b64.error;
+		} else
+		{
+			got = hex_decode_into(hex, out + total, in + i, n, last);
+			*error = hex->error;
+		}
+
+		for (k = 0; k < CHECK_GUARD && out[total + bound + k] == CHECK_FILL; k++);
+
+		if (got > bound || k < CHECK_GUARD)
+		{
+			fprintf(stderr, "%s: %lu bytes written past the bound of %lu\n", check_mode_name(12, format),
+				(unsigned long) (got > bound ? got - bound : CHECK_GUARD - k), (unsigned long) bound);
+			free(out);
+			out = NULL;
+			break;
+		}
+
+		total += got;
+	}
+
+	free(hex);
+	*out_len = total;
+
+	return out;
+}
+
+/* The scalar decoder on the whole input against the kernels of "level" on the whole and on random chunks */
+int check_decoder(int format, int level, unsigned seed, const unsigned char *in, size_t len)
+{
+	unsigned char	*want, *got[2];
+	size_t	want_len, want_error, got_len[2], got_error[2];
+	int	k, result = 0;
+
+	check_limit(ENCODE_SIMD_NONE);
+	want = check_decode(format, 0, in, len, &want_len, &want_error);
+
+	check_limit(level);
+	got[0] = check_decode(format, 0, in, len, &got_len[0], &got_error[0]);
+	got[1] = check_decode(format, seed, in, len, &got_len[1], &got_error[1]);
+	check_limit(ENCODE_SIMD_AVX512);
+
+	for (k = 0; k < 2; k++)
+	{
+		if (!want || !got[k])
+			result = -1;
+		else if (got_error[k] != want_error)
+		{
+			fprintf(stderr, "%s %s: %lu input bytes, level %d, seed %u: error at %ld, expected at %ld\n",
+				check_mode_name(12, format), k ? "chunks" : "whole", (unsigned long) len, level, seed,
+				(long) got_error[k], (long) want_error);
+			result = -1;
+		} else if (want_error == DECODE_NO_ERROR && (got_len[k] != want_len || memcmp(got[k], want, want_len)))
+		{
+			fprintf(stderr, "%s %s: %lu input bytes, level %d, seed %u: %lu bytes decoded, expected %lu\n",
+				check_mode_name(12, format), k ? "chunks" : "whole", (unsigned long) len, level, seed,
+				(unsigned long) got_len[k], (unsigned long) want_len);
+			result = -1;
+		}
+
+		free(got[k]);
+	}
+
+	free(want);
+
+	return result;
+}
+
+/* Encode "in" with the reference for the decoder "format" and decode it back */
+int check_round_trip(int format, int level, unsigned seed, const unsigned char *in, size_t len)
+{
+	struct _config	config;
+	unsigned char	*text, *got;
+	size_t	text_len, got_len, error, i;
+	int	result = 0;
+
+	memset(&config, 0, sizeof(config));
+	config.mode = check_sources[format][0];
+	config.mode2 = check_sources[format][1];
+	config.eol = (check_rand(&seed) % 2) ? "\r\n" : "\n";
+
+	/* Base64 in lines as -b64 writes it */
+	if (format == DECODE_BASE64 && check_rand(&seed) % 2)
+		config.wrap = 4 + check_rand(&seed) % 76;
+
+	text = (unsigned char *) ref_convert(&config, in, len, &text_len);
+
+	/* the hex decoders take either case */
+	if (format != DECODE_BASE64)
+		for (i = 0; i < text_len; i++)
+			if (text[i] >= 'a' && text[i] <= 'f' && check_rand(&seed) % 2)
+				text[i] -= 'a' - 'A';
+
+	check_limit(level);
+	got = check_decode(format, seed, text, text_len, &got_len, &error);
+	check_limit(ENCODE_SIMD_AVX512);
+
+	if (!got)
+		result = -1;
+	else if (error != DECODE_NO_ERROR || got_len != len || memcmp(got, in, len))
+	{
+		fprintf(stderr, "%s round trip: %lu bytes, level %d, seed %u: %lu bytes back, error at %ld\n",
+			check_mode_name(12, format), (unsigned long) len, level, seed, (unsigned long) got_len, (long) error);
+		result = -1;
+	}
+
+	free(got);
+	free(text);
+
+	return result;
+}
+
+/*
+ * A fuzzer input for the encoders: the mode, the flags (bit 0 -e, 1 -i,
+ * 2 -q, 3 -wrap, 4 CRLF, 5-6 instruction set), a byte for the filter sets
+ * and the line length, the seed of the chunk splits, then the data.
+ */
+int check_encode_input(const uint8_t *data, size_t size)
+{
+	check_case_t	c;
+	unsigned char	exclude[2], include[4];
+	int	flags, x;
+
+	if (size < 4)
+		return 0;
+
+	memset(&c, 0, sizeof(c));
+	c.config.mode = check_modes[data[0] % check_modes_count][0];
+	c.config.mode2 = check_modes[data[0] % check_modes_count][1];
+	flags = data[1];
+	x = data[2];
+	c.seed = (data[3] + 1) * 2654435761u;
+	c.level = (flags >> 5) & 3;
+
+	c.config.threads = 1;
+	c.config.bufsize = 4096;
+	c.config.eol = (flags & 16) ? "\r\n" : "\n";
+	c.config.wrap = (flags & 8) ? 1 + x % 80 : 0;
+	c.config.nlign = (flags & 4) != 0;
+
+	if (flags & 1)
+	{
+		exclude[0] = x;
+		exclude[1] = x ^ 0x20;
+		c.config.exclude_symbols = (char *) exclude;
+		c.config.exclude_symbols_size = 2;
+	}
+
+	if (flags & 2)
+	{
+		memcpy(include, "/.%", 3);
+		include[3] = x ^ 0x55;
+		c.config.include_symbols = (char *) include;
+		c.config.include_symbols_size = 4;
+	}
+
+	return check_encoder(&c, data + 4, size - 4);
+}
+
+/*
+ * A fuzzer input for the decoders: the format, the instruction set, the
+ * seed of the chunk splits, then the data, decoded as it is and encoded
+ * and decoded back.
+ */
+int check_decode_input(const uint8_t *data, size_t size)
+{
+	int	format, level;
+	unsigned	seed;
+
+	if (size < 3)
+		return 0;
+
+	format = data[0] % check_sources_count;
+	level = data[1] & 3;
+	seed = (data[2] + 1) * 2654435761u;
+
+	if (check_decoder(format, level, seed, data + 3, size - 3))
+		return -1;
+
+	return check_round_trip(format, level, seed, data + 3, size - 3);
+}
@@ -0,0 +1,33 @@
+#ifndef __CHECK_H
+#define __CHECK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../main.h"
+
+/* One way of converting: the settings, the vector kernels allowed and the seed of the chunk splits */
+typedef struct {
+	struct _config	config;
+	int	level;				/* highest instruction set, ENCODE_SIMD_* */
+	unsigned	seed;
+} check_case_t;
+
+/* the encoding modes main() accepts, major and minor */
+extern const int	check_modes[][2];
+extern const int	check_modes_count;
+
+/* the encoder whose output every decoder format reads, DECODE_* order */
+extern const int	check_sources[][2];
+extern const int	check_sources_count;
+
+unsigned check_rand(unsigned *seed);
+const char *check_mode_name(int mode, int mode2);
+
+int check_encoder(const check_case_t *c, const unsigned char *in, size_t len);
+int check_decoder(int format, int level, unsigned seed, const unsigned char *in, size_t len);
+int check_round_trip(int format, int level, unsigned seed, const unsigned char *in, size_t len);
+
+int check_encode_input(const uint8_t *data, size_t size);
+int check_decode_input(const uint8_t *data, size_t size);
+
+#endif
@@ -0,0 +1,988 @@
+/*
+ * reference.c
+ * This file is part of str2hex project.
+ *
+ * Copyright 2005 Dzmitry Plashchynski <plashchynski@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Reference conversions for the tests.
+ *
+ * The byte modes are the byte loop of the original process(), sprintf()
+ * calls and all, run once over the whole input. The rest were never in
+ * that loop, or are new, and are written out the plain way: Base64, MD5
+ * and SHA-256 straight from their specifications, numbers in base 256
+ * with the schoolbook multiplication and division, and line wrapping as
+ * a last pass over the whole output. Nothing here shares code with the
+ * converter, so the tables, the vector kernels and the chunking of the
+ * converter are checked against something that has none of them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include "reference.h"
+
+typedef struct {
+	char	*p;
+	size_t	len;
+	size_t	size;
+} ref_buf_t;
+
+static void ref_grow(ref_buf_t *b, size_t n)
+{
+	if (b->len + n + 1 > b->size)
+	{
+		b->size = (b->len + n + 1) * 2;
+		if (!(b->p = realloc(b->p, b->size)))
+			exit_error("Not enough memory.");
+	}
+}
+
+static void ref_put(ref_buf_t *b, const char *s, size_t n)
+{
+	ref_grow(b, n);
+	memcpy(b->p + b->len, s, n);
+	b->len += n;
+}
+
+static void ref_printf(ref_buf_t *b, const char *format, ...)
+{
+	va_list	ap;
+	int	n;
+
+	ref_grow(b, 64);
+
+	va_start(ap, format);
+	n = vsprintf(b->p + b->len, format, ap);
+	va_end(ap);
+
+	b->len += n;
+}
+
+/* The escape of one byte in the HTML and C modes, the switch of the original converter */
+static int ref_escape(int mode, int mode2, unsigned char c, char *s)
+{
+	int	n;
+
+	switch(mode)
+	{
+		/* HTML Style char convertion */
+		case 5:
+			switch (mode2)
+			{
+				case 1: // as HTML escape codes: &iexcl;&#x78;&copy;...
+					switch (c)
+					{
+						case 0x20:
+							n = sprintf(s, "&nbsp;");
+							break;
+						case 0x22:
+							n = sprintf(s, "&quot;");
+							break;
+						case 0x26:
+							n = sprintf(s, "&amp;");
+							break;
+						case 0x2F:
+							n = sprintf(s, "&frasl;");
+							break;
+						case 0x3C:
+							n = sprintf(s, "&lt;");
+							break;
+						case 0x3E:
+							n = sprintf(s, "&qt;");
+							break;
+						case 0x89:
+							n = sprintf(s, "&permil;");
+							break;
+						case 0x8B:
+							n = sprintf(s, "&lsaquo;");
+							break;
+						case 0x96:
+							n = sprintf(s, "&ndash;");
+							break;
+						case 0x97:
+							n = sprintf(s, "&mdash;");
+							break;
+						case 0x99:
+							n = sprintf(s, "&trade;");
+							break;
+						case 0x9B:
+							n = sprintf(s, "&rsaquo;");
+							break;
+						case 0xA1:
+							n = sprintf(s, "&iexcl;");
+							break;
+						case 0xA2:
+							n = sprintf(s, "&cent;");
+							break;
+						case 0xA3:
+							n = sprintf(s, "&pound;");
+							break;
+						case 0xA4:
+							n = sprintf(s, "&curren;");
+							break;
+						case 0xA5:
+							n = sprintf(s, "&yen;");
+							break;
+						case 0xA6:
+							n = sprintf(s, "&brvbar;");
+							break;
+						case 0xA7:
+							n = sprintf(s, "&sect;");
+							break;
+						case 0xA8:
+							n = sprintf(s, "&uml;");
+							break;
+						case 0xA9:
+							n = sprintf(s, "&yen;");
+							break;
+						case 0xAA:
+							n = sprintf(s, "&ordf;");
+							break;
+						case 0xAB:
+							n = sprintf(s, "&laquo;");
+							break;
+						case 0xAC:
+							n = sprintf(s, "&not;");
+							break;
+						case 0xAD:
+							n = sprintf(s, "&shy;");
+							break;
+						case 0xAE:
+							n = sprintf(s, "&reg;");
+							break;
+						case 0xAF:
+							n = sprintf(s, "&macr;");
+							break;
+						case 0xB0:
+							n = sprintf(s, "&deg;");
+							break;
+						case 0xB1:
+							n = sprintf(s, "&plusmn;");
+							break;
+						case 0xB2:
+							n = sprintf(s, "&sup2;");
+							break;
+						case 0xB3:
+							n = sprintf(s, "&sup3;");
+							break;
+						case 0xB4:
+							n = sprintf(s, "&acute;");
+							break;
+						case 0xB5:
+							n = sprintf(s, "&micro;");
+							break;
+						case 0xB6:
+							n = sprintf(s, "&para;");
+							break;
+						case 0xB7:
+							n = sprintf(s, "&middot;");
+							break;
+						case 0xB8:
+							n = sprintf(s, "&cedil;");
+							break;
+						case 0xB9:
+							n = sprintf(s, "&sup1;");
+							break;
+						case 0xBA:
+							n = sprintf(s, "&ordm;");
+							break;
+						case 0xBB:
+							n = sprintf(s, "&raquo;");
+							break;
+						case 0xBC:
+							n = sprintf(s, "&frac14;");
+							break;
+						case 0xBD:
+							n = sprintf(s, "&frac12;");
+							break;
+						case 0xBE:
+							n = sprintf(s, "&frac34;");
+							break;
+						case 0xBF:
+							n = sprintf(s, "&iquest;");
+							break;
+						case 0xC0:
+							n = sprintf(s, "&agrave;");
+							break;
+						case 0xC1:
+							n = sprintf(s, "&Aacute;");
+							break;
+						case 0xC2:
+							n = sprintf(s, "&Acirc;");
+							break;
+						case 0xC3:
+							n = sprintf(s, "&Atilde;");
+							break;
+						case 0xC4:
+							n = sprintf(s, "&Auml;");
+							break;
+						case 0xC5:
+							n = sprintf(s, "&Aring;");
+							break;
+						case 0xC6:
+							n = sprintf(s, "&AElig;");
+							break;
+						case 0xC7:
+							n = sprintf(s, "&Ccedil;");
+							break;
+						case 0xC8:
+							n = sprintf(s, "&Egrave;");
+							break;
+						case 0xC9:
+							n = sprintf(s, "&Eacute;");
+							break;
+						case 0xCA:
+							n = sprintf(s, "&Ecirc;");
+							break;
+						case 0xCB:
+							n = sprintf(s, "&Euml;");
+							break;
+						case 0xCC:
+							n = sprintf(s, "&Igrave;");
+							break;
+						case 0xCD:
+							n = sprintf(s, "&Iacute;");
+							break;
+						case 0xCE:
+							n = sprintf(s, "&Icirc;");
+							break;
+						case 0xCF:
+							n = sprintf(s, "&Iuml;");
+							break;
+						case 0xD0:
+							n = sprintf(s, "&ETH;");
+							break;
+						case 0xD1:
+							n = sprintf(s, "&Ntilde;");
+							break;
+						case 0xD2:
+							n = sprintf(s, "&Ograve;");
+							break;
+						case 0xD3:
+							n = sprintf(s, "&Oacute;");
+							break;
+						case 0xD4:
+							n = sprintf(s, "&Ocirc;");
+							break;
+						case 0xD5:
+							n = sprintf(s, "&Otilde;");
+							break;
+						case 0xD6:
+							n = sprintf(s, "&Ouml;");
+							break;
+						case 0xD7:
+							n = sprintf(s, "&times;");
+							break;
+						case 0xD8:
+							n = sprintf(s, "&Oslash;");
+							break;
+						case 0xD9:
+							n = sprintf(s, "&Ugrave;");
+							break;
+						case 0xDA:
+							n = sprintf(s, "&Uacute;");
+							break;
+						case 0xDB:
+							n = sprintf(s, "&Ucirc;");
+							break;
+						case 0xDC:
+							n = sprintf(s, "&Uuml;");
+							break;
+						case 0xDD:
+							n = sprintf(s, "&Yacute;");
+							break;
+						case 0xDE:
+							n = sprintf(s, "&THORN;");
+							break;
+						case 0xDF:
+							n = sprintf(s, "&szlig;");
+							break;
+						case 0xE0:
+							n = sprintf(s, "&agrave;");
+							break;
+						case 0xE1:
+							n = sprintf(s, "&aacute;");
+							break;
+						case 0xE2:
+							n = sprintf(s, "&acirc;");
+							break;
+						case 0xE3:
+							n = sprintf(s, "&atilde;");
+							break;
+						case 0xE4:
+							n = sprintf(s, "&auml;");
+							break;
+						case 0xE5:
+							n = sprintf(s, "&aring;");
+							break;
+						case 0xE6:
+							n = sprintf(s, "&aelig;");
+							break;
+						case 0xE7:
+							n = sprintf(s, "&ccedil;");
+							break;
+						case 0xE8:
+							n = sprintf(s, "&egrave;");
+							break;
+						case 0xE9:
+							n = sprintf(s, "&eacute;");
+							break;
+						case 0xEA:
+							n = sprintf(s, "&ecirc;");
+							break;
+						case 0xEB:
+							n = sprintf(s, "&euml;");
+							break;
+						case 0xEC:
+							n = sprintf(s, "&igrave;");
+							break;
+						case 0xED:
+							n = sprintf(s, "&iacute;");
+							break;
+						case 0xEE:
+							n = sprintf(s, "&icirc;");
+							break;
+						case 0xEF:
+							n = sprintf(s, "&iuml;");
+							break;
+						case 0xF0:
+							n = sprintf(s, "&eth;");
+							break;
+						case 0xF1:
+							n = sprintf(s, "&ntilde;");
+							break;
+						case 0xF2:
+							n = sprintf(s, "&ograve;");
+							break;
+						case 0xF3:
+							n = sprintf(s, "&oacute;");
+							break;
+						case 0xF4:
+							n = sprintf(s, "&ocirc;");
+							break;
+						case 0xF5:
+							n = sprintf(s, "&otilde;");
+							break;
+						case 0xF6:
+							n = sprintf(s, "&ouml;");
+							break;
+						case 0xF7:
+							n = sprintf(s, "&divide;");
+							break;
+						case 0xF8:
+							n = sprintf(s, "&oslash;");
+							break;
+						case 0xF9:
+							n = sprintf(s, "&ugrave;");
+							break;
+						case 0xFA:
+							n = sprintf(s, "&uacute;");
+							break;
+						case 0xFB:
+							n = sprintf(s, "&ucirc;");
+							break;
+						case 0xFC:
+							n = sprintf(s, "&uuml;");
+							break;
+						case 0xFD:
+							n = sprintf(s, "&yacute;");
+							break;
+						case 0xFE:
+							n = sprintf(s, "&thorn;");
+							break;
+						case 0xFF:
+							n = sprintf(s, "&yuml;");
+							break;
+						default:
+							n = sprintf(s,"&#%d;",c);
+					}
+					break;
+				case 2:
+					n = sprintf(s,"&#%d",c); 
+					break;
+				default:
+					n = sprintf(s,"&#x%x",c); /* HTML hex-format */
+			}
+			break;
+
+
+		/* C-style char convertion */
+		case 8: 
+			switch (mode2)
+			{
+				case 1:
+				case 2:
+					switch (c)
+					{
+						case '\n':
+							n = sprintf(s, "\\n");
+							break;
+						case '"':
+							n = sprintf(s, "\\\"");
+							break;
+						case '\'':
+							n = sprintf(s, "\\\'");
+							break;
+						case '%':
+							n = sprintf(s, "%%");
+							break;
+						case '\\' :
+							n = sprintf(s, "\\\\");
+							break;
+						case '\t':
+							n = sprintf(s, "\\t");
+							break;
+						case '\v':
+							n = sprintf(s, "\\v");
+							break;
+						case '\b':
+							n = sprintf(s, "\\b");
+							break;
+						case '\r':
+							n = sprintf(s, "\\r");
+							break;
+						case '\f':
+							n = sprintf(s, "\\f");
+							break;
+						case '\a':
+							n = sprintf(s, "\\a");
+							break;
+						default:
+							if (mode2 == 1)
+								n = sprintf(s,"\\%o",c);
+							else
+								n = sprintf(s, "%c", c);
+					}
+					break;
+				case 3:
+					n = sprintf(s,"\\x%x",c);
+					break;
+				default:
+					n = sprintf(s,"\\%o",c);
+			}
+			break;
+		default:
+			n = sprintf(s,"%02x", c);
+	}
+
+	return n;
+}
+
+/*
+ * The byte loop of the original process(), run once over the whole input,
+ * with its sprintf() calls writing through ref_printf(). It differs from
+ * the original only where the program means to:
+ * - the output grows before every write: the original grew it by a fifth
+ *   when four fifths were used, which the wider cells of -t and -xe
+ *   outran;
+ * - "ide" is local: the original kept it in a static, which is the same
+ *   for a single call;
+ * - the WIN32 branch of -q, which read a byte past the input, is left
+ *   out, the tests check the one of the other systems.
+ */
+static void ref_process(ref_buf_t *b, const struct _config *config, const unsigned char *buf, size_t len)
+{
+	char	s[32];
+	size_t	i;
+	int	ide = 0;
+
+	for (i = 0; i < len; i++)
+	{
+		/* include and exclude chars */
+		if (config->exclude_symbols_size)
+			if (memchr(config->exclude_symbols, buf[i],
+				config->exclude_symbols_size))
+					continue;
+
+		if (config->include_symbols_size)
+			if (!memchr(config->include_symbols, buf[i],
+				config->include_symbols_size))
+					{
+						ref_printf(b, "%c", buf[i]);
+						continue;
+					}
+
+		/* Sort by CR. */
+		if (config->nlign)
+			if (buf[i] == '\n')
+			{
+				ref_printf(b, "\n");
+				continue;
+			}
+
+		/* Primary convertion method analys */
+		switch(config->mode)
+		{
+			/* Plain hex style convertion */
+			case 9:
+				ref_printf(b, "%02x", buf[i]);
+				break;
+
+			/* AT&T asm style convertion */
+			case 1:
+				if (i)
+					switch (config->mode2)
+					{
+						case 1:
+							ref_printf(b, " 0x%02x", buf[i]);
+							break;
+						case 2:
+							ref_printf(b, "0x%02x", buf[i]);
+							break;
+						default:
+							ref_printf(b, ", 0x%02x", buf[i]);
+					}
+				else
+					ref_printf(b, "0x%02x", buf[i]);
+				break;
+
+			/* Microsoft assembler hex style */
+			case 2:
+				if (i)
+					switch (config->mode2)
+					{
+						case 1:
+							ref_printf(b, " %02xh", buf[i]);
+							break;
+						case 2:
+							ref_printf(b, "%02xh", buf[i]);
+							break;
+						default:
+							ref_printf(b, ", %02xh", buf[i]);
+					}
+				else
+					ref_printf(b, "%02xh", buf[i]);
+				break;
+
+			/* MySQL Style convertion */
+			case 3:
+				switch(config->mode2)
+				{
+					case 1:
+						if (ide)
+						{
+							if (i == len-1)
+								ref_printf(b, ",%02x)", buf[i]);
+							else
+								ref_printf(b, ",%02x", buf[i]);
+						} else
+							ref_printf(b, "CHAR(%02x", buf[i]);
+						ide++;
+					break;
+					default:
+						if (ide)
+							ref_printf(b, "%02x", buf[i]);
+						else
+							ref_printf(b, "0x%02x", buf[i]);
+						ide++;
+				}
+				break;
+
+			/* URL format */
+			case 4:
+				ref_printf(b, "%%%02x", buf[i]);
+				break;
+
+			/* HTML and C-style char convertion */
+			case 5:
+			case 8:
+				ref_put(b, s, ref_escape(config->mode, config->mode2, buf[i], s));
+				break;
+
+			default:
+				ref_printf(b, "%02x", buf[i]);
+		}
+	}
+}
+
+/* RFC 4648 Base64 with padding */
+static void ref_base64(ref_buf_t *b, const unsigned char *in, size_t len)
+{
+	static const char	digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	unsigned long	v;
+	size_t	i;
+	char	q[4];
+
+	for (i = 0; i < len; i += 3)
+	{
+		v = (unsigned long) in[i] << 16;
+		if (i + 1 < len)
+			v |= in[i+1] << 8;
+		if (i + 2 < len)
+			v |= in[i+2];
+
+		q[0] = digits[v >> 18];
+		q[1] = digits[(v >> 12) & 63];
+		q[2] = (i + 1 < len) ? digits[(v >> 6) & 63] : '=';
+		q[3] = (i + 2 < len) ? digits[v & 63] : '=';
+		ref_put(b, q, 4);
+	}
+}
+
+#define ROL(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+#define ROR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+/* Pad a message to whole 64 byte blocks with its length in bits, little or big endian */
+static unsigned char *ref_pad(const unsigned char *in, size_t len, size_t *blocks, int big)
+{
+	size_t	n = (len + 8) / 64 + 1, i;
+	unsigned char	*m = calloc(n, 64);
+	uint64_t	bits = (uint64_t) len * 8;
+
+	if (!m)
+		exit_error("Not enough memory.");
+
+	memcpy(m, in, len);
+	m[len] = 0x80;
+	for (i = 0; i < 8; i++)
+		m[n*64 - 8 + i] = bits >> (big ? 56 - 8*i : 8*i);
+
+	*blocks = n;
+	return m;
+}
+
+static void ref_hex(ref_buf_t *b, const unsigned char *digest, int n)
+{
+	int	i;
+
+	for (i = 0; i < n; i++)
+		ref_printf(b, "%02x", digest[i]);
+}
+
+/* RFC 1321 */
+static void ref_md5(ref_buf_t *b, const unsigned char *in, size_t len)
+{
+	static const int	r[64] = {
+		7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+		5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+		4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+		6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21};
+	static const uint32_t	k[64] = {
+		0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+		0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+		0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+		0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+		0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+		0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+		0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+		0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+	uint32_t	h[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+	uint32_t	a, bb, c, d, f, t, w[16];
+	unsigned char	digest[16], *m;
+	size_t	blocks, n;
+	int	i, g;
+
+	m = ref_pad(in, len, &blocks, 0);
+
+	for (n = 0; n < blocks; n++)
+	{
+		for (i = 0; i < 16; i++)
+			w[i] = m[n*64 + 4*i] | m[n*64 + 4*i + 1] << 8 | m[n*64 + 4*i + 2] << 16 | (uint32_t) m[n*64 + 4*i + 3] << 24;
+
+		a = h[0], bb = h[1], c = h[2], d = h[3];
+
+		for (i = 0; i < 64; i++)
+		{
+			if (i < 16)
+				f = (bb & c) | (~bb & d), g = i;
+			else if (i < 32)
+				f = (d & bb) | (~d & c), g = (5*i + 1) % 16;
+			else if (i < 48)
+				f = bb ^ c ^ d, g = (3*i + 5) % 16;
+			else
+				f = c ^ (bb | ~d), g = (7*i) % 16;
+
+			t = d;
+			d = c;
+			c = bb;
+			bb = bb + ROL(a + f + k[i] + w[g], r[i]);
+			a = t;
+		}
+
+		h[0] += a, h[1] += bb, h[2] += c, h[3] += d;
+	}
+
+	for (i = 0; i < 16; i++)
+		digest[i] = h[i / 4] >> (8 * (i % 4));
+
+	free(m);
+	ref_hex(b, digest, 16);
+}
+
+/* FIPS 180-4 */
+static void ref_sha256(ref_buf_t *b, const unsigned char *in, size_t len)
+{
+	static const uint32_t	k[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+	uint32_t	h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+	uint32_t	v[8], w[64], t1, t2;
+	unsigned char	digest[32], *m;
+	size_t	blocks, n;
+	int	i;
+
+	m = ref_pad(in, len, &blocks, 1);
+
+	for (n = 0; n < blocks; n++)
+	{
+		for (i = 0; i < 16; i++)
+			w[i] = (uint32_t) m[n*64 + 4*i] << 24 | m[n*64 + 4*i + 1] << 16 | m[n*64 + 4*i + 2] << 8 | m[n*64 + 4*i + 3];
+		for (; i < 64; i++)
+			w[i] = w[i-16] + (ROR(w[i-15], 7) ^ ROR(w[i-15], 18) ^ (w[i-15] >> 3)) +
+				w[i-7] + (ROR(w[i-2], 17) ^ ROR(w[i-2], 19) ^ (w[i-2] >> 10));
+
+		memcpy(v, h, sizeof(v));
+
+		for (i = 0; i < 64; i++)
+		{
+			t1 = v[7] + (ROR(v[4], 6) ^ ROR(v[4], 11) ^ ROR(v[4], 25)) + ((v[4] & v[5]) ^ (~v[4] & v[6])) + k[i] + w[i];
+			t2 = (ROR(v[0], 2) ^ ROR(v[0], 13) ^ ROR(v[0], 22)) + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+			memmove(v + 1, v, 7 * sizeof(uint32_t));
+			v[4] += t1;
+			v[0] = t1 + t2;
+		}
+
+		for (i = 0; i < 8; i++)
+			h[i] += v[i];
+	}
+
+	for (i = 0; i < 32; i++)
+		digest[i] = h[i / 4] >> (24 - 8 * (i % 4));
+
+	free(m);
+	ref_hex(b, digest, 32);
+}
+
+/* -md5l, -md5z: a digest line for every record, the last one only if it isn't empty */
+static void ref_md5_records(ref_buf_t *b, const struct _config *config, const unsigned char *in, size_t len)
+{
+	int	sep = (config->mode2 == 1) ? '\n' : '\0';
+	size_t	start = 0, i;
+
+	for (i = 0; i <= len; i++)
+	{
+		if (i < len && in[i] != sep)
+			continue;
+		if (i == len && i == start)
+			break;
+
+		ref_md5(b, in + start, i - start);
+		ref_put(b, config->eol, strlen(config->eol));
+		start = i + 1;
+	}
+}
+
+static int ref_digit(unsigned char c, int hex)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (hex && (c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+		return (c | 0x20) - 'a' + 10;
+	return -1;
+}
+
+/* One number of the -n, -no and -dn modes, in base 256 from the lowest byte */
+static void ref_number(ref_buf_t *b, int format, int neg, const unsigned char *s, size_t n)
+{
+	const int	hex = (format == 2);
+	unsigned char	*v = calloc(n + 1, 1), *dec;
+	size_t	vn = 0, i, j, k;
+	unsigned	carry;
+
+	if (!v || !(dec = malloc(3 * n + 2)))
+		exit_error("Not enough memory.");
+
+	for (i = 0; i < n; i++)
+	{
+		carry = ref_digit(s[i], hex);
+		for (j = 0; j < vn; j++)
+		{
+			carry += v[j] * (hex ? 16 : 10);
+			v[j] = carry & 0xff;
+			carry >>= 8;
+		}
+		if (carry)
+			v[vn++] = carry;
+	}
+
+	if (neg && vn)
+		ref_put(b, "-", 1);
+
+	if (!vn)
+		ref_put(b, "0", 1);
+	else if (hex)
+	{
+		/* decimal digits by dividing by 10, from the lowest */
+		for (k = 0; vn; )
+		{
+			for (carry = 0, j = vn; j-- > 0; )
+			{
+				carry = carry << 8 | v[j];
+				v[j] = carry / 10;
+				carry %= 10;
+			}
+			dec[k++] = '0' + carry;
+			while (vn && !v[vn-1])
+				vn--;
+		}
+		while (k--)
+			ref_put(b, (char *) dec + k, 1);
+	} else
+	{
+		int	bits = (format == 1) ? 3 : 4;
+		size_t	total = vn * 8, bit;
+
+		while (!(v[(total - 1) / 8] >> ((total - 1) % 8) & 1))
+			total--;
+
+		for (k = (total + bits - 1) / bits; k-- > 0; )
+		{
+			unsigned	d = 0;
+
+			for (bit = k * bits + bits; bit-- > k * bits; )
+				d = d << 1 | (bit < vn * 8 ? v[bit / 8] >> (bit % 8) & 1 : 0);
+			ref_printf(b, "%x", d);
+		}
+	}
+
+	free(v);
+	free(dec);
+}
+
+/* Every run of digits is a number, "0x" may start a hex one, a '-' right before makes it negative */
+static void ref_numbers(ref_buf_t *b, const struct _config *config, const unsigned char *in, size_t len)
+{
+	const int	hex = (config->mode2 == 2);
+	size_t	i = 0, j, k;
+	int	minus = 0, written = 0;
+
+	while (i < len)
+	{
+		if (ref_digit(in[i], hex) < 0)
+		{
+			minus = (in[i++] == '-');
+			continue;
+		}
+
+		for (j = i; j < len && ref_digit(in[j], hex) >= 0; j++);
+
+		if (hex && j == i + 1 && in[i] == '0' && j < len && (in[j] | 0x20) == 'x')
+		{
+			for (i = k = j + 1; k < len && ref_digit(in[k], hex) >= 0; k++);
+			j = k;
+		}
+
+		if (written++)
+			ref_put(b, config->eol, strlen(config->eol));
+		ref_number(b, config->mode2, minus, in + i, j - i);
+
+		i = j;
+		minus = 0;
+	}
+
+	if (!written)
+		ref_put(b, "0", 1);
+}
+
+/* A break before every character that finds its line full; new lines start a line of their own */
+static char *ref_wrap(const char *s, size_t len, int width, const char *eol, size_t *out_len)
+{
+	ref_buf_t	b = {NULL, 0, 0};
+	size_t	i;
+	int	col = 0;
+
+	ref_grow(&b, 0);
+
+	for (i = 0; i < len; i++)
+	{
+		if (col == width)
+		{
+			ref_put(&b, eol, strlen(eol));
+			col = 0;
+		}
+
+		ref_put(&b, s + i, 1);
+		col = (s[i] == '\n') ? 0 : col + 1;
+	}
+
+	*out_len = b.len;
+	return b.p;
+}
+
+/*
+ * The whole output of "config" for the input "in", without the new line
+ * the program writes at the end. Returns a malloc()ed buffer.
+ */
+char *ref_convert(const struct _config *config, const unsigned char *in, size_t len, size_t *out_len)
+{
+	ref_buf_t	b = {NULL, 0, 0};
+	char	*wrapped;
+
+	ref_grow(&b, 0);
+
+	switch (config->mode)
+	{
+		/* process() handed Base64 and MD5 to the library, which is what is under test now */
+		case 7:
+			ref_base64(&b, in, len);
+			break;
+
+		/*
+		 * process() printed atoi() of the whole input; every number of any
+		 * length is converted now, with its sign, and 0 stands for none
+		 */
+		case 10:
+			ref_numbers(&b, config, in, len);
+			break;
+
+		/* -md5l and -md5z are new */
+		case 11:
+			if (config->mode2)
+				ref_md5_records(&b, config, in, len);
+			else
+				ref_md5(&b, in, len);
+			break;
+
+		/* new */
+		case 13:
+			ref_sha256(&b, in, len);
+			break;
+
+		default:
+			ref_process(&b, config, in, len);
+	}
+
+	/* -wrap is new */
+	if (!config->wrap)
+	{
+		*out_len = b.len;
+		return b.p;
+	}
+
+	wrapped = ref_wrap(b.p, b.len, config->wrap, config->eol, out_len);
+	free(b.p);
+
+	return wrapped;
+}
@@ -0,0 +1,9 @@
+#ifndef __REFERENCE_H
+#define __REFERENCE_H
+
+#include <stddef.h>
+#include "../main.h"
+
+char *ref_convert(const struct _config *config, const unsigned char *in, size_t len, size_t *out_len);
+
+#endif
@@ -0,0 +1,328 @@
+/*
+ * str2hex_test.c
+ * This file is part of str2hex project.
+ *
+ * Copyright 2005 Dzmitry Plashchynski <plashchynski@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Random differential test of the converter against the reference in
+ * reference.c.
+ *
+ * Every iteration draws an input (binary, text full of the characters the
+ * escaping modes care about, or numbers), a mode, the filters, the line
+ * length, the line break and the instruction set, and runs the checks of
+ * check.c. Every decoder then gets the output of its encoder, sometimes
+ * spoiled by one byte, and a round trip. The first mismatch is printed
+ * with its seed and ends the run with status 1.
+ *
+ * Files given on the command line are replayed as fuzzer inputs instead,
+ * through both fuzz targets.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "reference.h"
+#include "../encode.h"
+#include "../decode.h"
+
+#define TEST_ITERATIONS	20000
+#define TEST_MAX	(70 * 1024)	/* the longest input */
+
+static unsigned	test_seed = 1;
+
+static const char	test_specials[] = "<>&\"'\\\n\r\t %/.?;:=+-_0123456789xX";
+
+static void test_text(unsigned char *p, size_t len)
+{
+	size_t	i;
+
+	for (i = 0; i < len; i++)
+		switch (check_rand(&test_seed) % 8)
+		{
+			case 0:
+				p[i] = test_specials[check_rand(&test_seed) % (sizeof(test_specials) - 1)];
+				break;
+			case 1:
+				p[i] = 0x80 + check_rand(&test_seed) % 0x80;
+				break;
+			case 2:
+				p[i] = check_rand(&test_seed) % 0x20;
+				break;
+			default:
+				p[i] = 'a' + check_rand(&test_seed) % 26;
+		}
+}
+
+/* Numbers of any length, with signs, "0x" prefixes and leading zeros, in some noise */
+static void test_digits(unsigned char *p, size_t len)
+{
+	size_t	i = 0, n;
+
+	while (i < len)
+	{
+		switch (check_rand(&test_seed) % 8)
+		{
+			case 0:
+				p[i++] = '-';
+				break;
+			case 1:
+				p[i++] = '0';
+				if (i < len)
+					p[i++] = "xX"[check_rand(&test_seed) % 2];
+				break;
+			case 2:
+				p[i++] = test_specials[check_rand(&test_seed) % (sizeof(test_specials) - 1)];
+				break;
+			case 3:
+				p[i++] = "abcdefABCDEF"[check_rand(&test_seed) % 12];
+				break;
+			default:
+				/* mostly short, sometimes long enough for the big number code */
+				n = (check_rand(&test_seed) % 16) ? 1 + check_rand(&test_seed) % 25 : 1 + check_rand(&test_seed) % 3000;
+				for (; n && i < len; n--)
+					p[i++] = '0' + check_rand(&test_seed) % 10;
+		}
+	}
+}
+
+static size_t test_input(unsigned char *p)
+{
+	size_t	len, i;
+
+	switch (check_rand(&test_seed) % 16)
+	{
+		case 0:
+			len = check_rand(&test_seed) % (TEST_MAX + 1);
+			break;
+		case 1:
+			len = check_rand(&test_seed) % 4096;
+			break;
+		default:
+			len = check_rand(&test_seed) % 301;
+	}
+
+	switch (check_rand(&test_seed) % 3)
+	{
+		case 0:
+			for (i = 0; i < len; i++)
+				p[i] = check_rand(&test_seed);
+			break;
+		case 1:
+			test_text(p, len);
+			break;
+		default:
+			test_digits(p, len);
+	}
+
+	return len;
+}
+
+/* One encoder mode with random settings */
+static int test_encoder(const unsigned char *in, size_t len, int levels)
+{
+	check_case_t	c;
+	unsigned char	exclude[4], include[8];
+	int	m = check_rand(&test_seed) % check_modes_count, i, n;
+
+	memset(&c, 0, sizeof(c));
+	c.config.mode = check_modes[m][0];
+	c.config.mode2 = check_modes[m][1];
+	c.config.threads = 1;
+	c.config.bufsize = 4096;
+	c.config.eol = (check_rand(&test_seed) % 4) ? "\n" : "\r\n";
+	c.config.wrap = (check_rand(&test_seed) % 3) ? 0 : 1 + check_rand(&test_seed) % 100;
+	c.level = check_rand(&test_seed) % (levels + 1);
+	c.seed = check_rand(&test_seed) | 1;
+
+	/* the filters only mean something to the byte modes, the rest must ignore them */
+	if (!(check_rand(&test_seed) % 4))
+		c.config.nlign = 1;
+
+	if (!(check_rand(&test_seed) % 4))
+	{
+		n = 1 + check_rand(&test_seed) % sizeof(exclude);
+		for (i = 0; i < n; i++)
+			exclude[i] = (check_rand(&test_seed) % 2) ? test_specials[check_rand(&test_seed) % (sizeof(test_specials) - 1)] : check_rand(&test_seed);
+		c.config.exclude_symbols = (char *) exclude;
+		c.config.exclude_symbols_size = n;
+	}
+
+	if (!(check_rand(&test_seed) % 4))
+	{
+		n = 1 + check_rand(&test_seed) % sizeof(include);
+		for (i = 0; i < n; i++)
+			include[i] = (check_rand(&test_seed) % 2) ? test_specials[check_rand(&test_seed) % (sizeof(test_specials) - 1)] : check_rand(&test_seed);
+		c.config.include_symbols = (char *) include;
+		c.config.include_symbols_size = n;
+	}
+
+	return check_encoder(&c, in, len);
+}
+
+/* One decoder on the output of its encoder, sometimes spoiled, and a round trip */
+static int test_decoder(const unsigned char *in, size_t len, int levels)
+{
+	struct _config	config;
+	int	format = check_rand(&test_seed) % check_sources_count;
+	int	level = check_rand(&test_seed) % (levels + 1), result;
+	unsigned	seed = check_rand(&test_seed) | 1;
+	unsigned char	*text;
+	size_t	text_len;
+
+	memset(&config, 0, sizeof(config));
+	config.mode = check_sources[format][0];
+	config.mode2 = check_sources[format][1];
+	config.eol = "\n";
+
+	text = (unsigned char *) ref_convert(&config, in, len, &text_len);
+
+	if (text_len && check_rand(&test_seed) % 2)
+		text[check_rand(&test_seed) % text_len] = check_rand(&test_seed);
+
+	result = check_decoder(format, level, seed, text, text_len);
+	free(text);
+
+	if (!result)
+		result = check_round_trip(format, level, seed, in, len);
+
+	return result;
+}
+
+/* Syntax is case blind, but only for letters: a control byte with the case bit set is no '0' or '(' */
+static int test_syntax(void)
+{
+	static const struct {
+		int	format;
+		const char	*text;
+		size_t	error;
+	} cases[] = {
+		{DECODE_MYSQL, "0X41", DECODE_NO_ERROR},
+		{DECODE_MYSQL, "\x10x41", 0},
+		{DECODE_ATT, "0x41, 0X42", DECODE_NO_ERROR},
+		{DECODE_ATT, "0x41, \x10x42", 6},
+		{DECODE_CHAR, "CHAR(41,42)", DECODE_NO_ERROR},
+		{DECODE_CHAR, "char\x08" "41,42)", 4},
+		{DECODE_MASM, "41H, 42h", DECODE_NO_ERROR},
+	};
+	hex_decode_state_t	stat;
+	unsigned char	out[16];
+	size_t	i;
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+	{
+		hex_decode_init(&stat, cases[i].format);
+		hex_decode_into(&stat, out, (const unsigned char *) cases[i].text, strlen(cases[i].text), 1);
+
+		if (stat.error != cases[i].error)
+		{
+			fprintf(stderr, "%s on \"%s\": error at %ld, expected at %ld\n", check_mode_name(12, cases[i].format),
+				cases[i].text, (long) stat.error, (long) cases[i].error);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int test_file(const char *name)
+{
+	FILE	*f = fopen(name, "rb");
+	unsigned char	*data = malloc(TEST_MAX + 16);
+	size_t	len;
+	int	result;
+
+	if (!f || !data)
+	{
+		fprintf(stderr, "%s: can\'t read\n", name);
+		exit(1);
+	}
+
+	len = fread(data, 1, TEST_MAX + 16, f);
+	fclose(f);
+
+	result = check_encode_input(data, len) || check_decode_input(data, len);
+	free(data);
+
+	return result;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: str2hex_test [-n ITERATIONS] [-seed N] [FILE ...]\n"
+		"Checks the converter against its reference on random inputs,\n"
+		"or replays the given fuzzer inputs.\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	long	iterations = TEST_ITERATIONS, i;
+	int	levels = encode_simd_level(), files = 0, k;
+	unsigned char	*in;
+	size_t	len;
+
+	for (k = 1; k < argc; k++)
+	{
+		if (argv[k][0] != '-')
+		{
+			if (test_file(argv[k]))
+				return 1;
+			files++;
+		} else if (k + 1 == argc)
+			usage();
+		else if (!strcmp(argv[k], "-n"))
+			iterations = atol(argv[++k]);
+		else if (!strcmp(argv[k], "-seed"))
+		{
+			if (!(test_seed = strtoul(argv[++k], NULL, 0)))
+				usage();
+		} else
+			usage();
+	}
+
+	if (files)
+	{
+		printf("%d inputs replayed\n", files);
+		return 0;
+	}
+
+	if (test_syntax())
+		return 1;
+
+	if (!(in = malloc(TEST_MAX)))
+		return 2;
+
+	for (i = 0; i < iterations; i++)
+	{
+		unsigned	seed = test_seed;
+
+		len = test_input(in);
+
+		if (test_encoder(in, len, levels) || test_decoder(in, len, levels))
+		{
+			fprintf(stderr, "iteration %ld failed, rerun with -seed %u\n", i, seed);
+			free(in);
+			return 1;
+		}
+	}
+
+	printf("%ld iterations passed, %d instruction sets\n", iterations, levels + 1);
+	free(in);
+
+	return 0;
+}
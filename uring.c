@@ -0,0 +1,173 @@
+/*
+ * uring.c
+ * This file is part of str2hex project.
+ *
+ * Copyright 2005 Dzmitry Plashchynski <plashchynski@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Minimal io_uring support on top of the system calls, so no library is
+ * needed. Only what the reader and the writer use: queue a request, submit,
+ * and take completions in any order. Callers fall back to plain read() and
+ * write() when uring_init() fails (old kernel, no Linux, seccomp filter).
+ */
+
+#include "uring.h"
+
+#ifdef HAVE_URING
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+int uring_init(uring_t *ring, unsigned entries)
+{
+	struct io_uring_params	p;
+
+	memset(ring, 0, sizeof(uring_t));
+	memset(&p, 0, sizeof(p));
+
+	ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->fd < 0)
+		return -1;
+
+	ring->entries = p.sq_entries;
+	ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	/* both rings share one mapping on every kernel that has IORING_FEAT_SINGLE_MMAP */
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED)
+		goto fail;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ring->cq_ring = ring->sq_ring;
+	else
+	{
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED)
+			goto fail;
+	}
+
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		goto fail;
+
+	ring->sq_head = (unsigned *) ((char *) ring->sq_ring + p.sq_off.head);
+	ring->sq_tail = (unsigned *) ((char *) ring->sq_ring + p.sq_off.tail);
+	ring->sq_mask = (unsigned *) ((char *) ring->sq_ring + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *) ((char *) ring->sq_ring + p.sq_off.array);
+	ring->cq_head = (unsigned *) ((char *) ring->cq_ring + p.cq_off.head);
+	ring->cq_tail = (unsigned *) ((char *) ring->cq_ring + p.cq_off.tail);
+	ring->cq_mask = (unsigned *) ((char *) ring->cq_ring + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_ring + p.cq_off.cqes);
+
+	return 0;
+
+fail:
+	uring_exit(ring);
+	return -1;
+}
+
+void uring_exit(uring_t *ring)
+{
+	if (ring->sqes && ring->sqes != MAP_FAILED)
+		munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	if (ring->sq_ring && ring->sq_ring != MAP_FAILED)
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	if (ring->fd >= 0)
+		close(ring->fd);
+
+	memset(ring, 0, sizeof(uring_t));
+	ring->fd = -1;
+}
+
+/* Pin the buffers for IORING_OP_READ_FIXED; fails under a low RLIMIT_MEMLOCK */
+int uring_register_buffers(uring_t *ring, const struct iovec *iov, unsigned count)
+{
+	return syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, count);
+}
+
+/* Queue one request. Returns NULL when the submission queue is full. */
+struct io_uring_sqe *uring_sqe(uring_t *ring, int opcode, int fd, void *addr, unsigned len, unsigned long long offset, unsigned long long data)
+{
+	unsigned	tail = *ring->sq_tail + ring->queued;
+	unsigned	head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	struct io_uring_sqe	*sqe;
+
+	if (tail - head >= ring->entries)
+		return NULL;
+
+	sqe = &ring->sqes[tail & *ring->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long) addr;
+	sqe->len = len;
+	sqe->off = offset;
+	sqe->user_data = data;
+
+	ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+	ring->queued++;
+
+	return sqe;
+}
+
+/* Submit the queued requests and wait until at least "wait" completions are ready */
+int uring_submit(uring_t *ring, unsigned wait)
+{
+	unsigned	n = ring->queued;
+	int	ret;
+
+	__atomic_store_n(ring->sq_tail, *ring->sq_tail + n, __ATOMIC_RELEASE);
+	ring->queued = 0;
+
+	do
+		ret = syscall(__NR_io_uring_enter, ring->fd, n, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	while (ret < 0 && errno == EINTR);
+
+	return ret;
+}
+
+/* Take one completion. Returns 0 if none is ready. */
+int uring_reap(uring_t *ring, struct io_uring_cqe *cqe)
+{
+	unsigned	head = *ring->cq_head;
+
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+		return 0;
+
+	*cqe = ring->cqes[head & *ring->cq_mask];
+	__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+	return 1;
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef __URING_H
+#define __URING_H
+
+#include <stddef.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_URING
+#endif
+#endif
+
+#ifdef HAVE_URING
+
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+/* One io_uring instance, driven with the raw system calls */
+typedef struct {
+	int	fd;
+	unsigned	*sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned	*cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe	*sqes;
+	struct io_uring_cqe	*cqes;
+
+	void	*sq_ring, *cq_ring;
+	size_t	sq_ring_size, cq_ring_size, sqes_size;
+	unsigned	entries;
+	unsigned	queued;			/* SQEs filled, not yet submitted */
+} uring_t;
+
+int uring_init(uring_t *ring, unsigned entries);
+void uring_exit(uring_t *ring);
+int uring_register_buffers(uring_t *ring, const struct iovec *iov, unsigned count);
+
+struct io_uring_sqe *uring_sqe(uring_t *ring, int opcode, int fd, void *addr, unsigned len, unsigned long long offset, unsigned long long data);
+int uring_submit(uring_t *ring, unsigned wait);
+int uring_reap(uring_t *ring, struct io_uring_cqe *cqe);
+
+#endif
+
+#endif